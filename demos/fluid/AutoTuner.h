@@ -0,0 +1,97 @@
+#ifndef AUTO_TUNER_H
+#define AUTO_TUNER_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <functional>
+#include <limits>
+#include <thread>
+
+#include <unistd.h>
+
+
+// Picks the fastest of a few configurations by timing each of them on the
+// real workload. The choice is kept in a file, one "key name" line per key,
+// so every machine tunes once; the key names what the result depends on.
+// Deleting the file (or its line) tunes again.
+struct AutoTuner {
+    using Measure = std::function<float(unsigned int candidate)>; // one run, in any unit of time
+
+    std::string cache_filepath;
+    std::string key;
+
+    AutoTuner(const std::string& cache_filepath, const std::string& workload) noexcept
+        : cache_filepath(cache_filepath), key(machine() + '/' + workload) {}
+
+    // Index into names. Each candidate is measured `runs` times, interleaved
+    // with the others, and its fastest run counts.
+    unsigned int pick(const std::vector<std::string>& names, const Measure& measure, unsigned int runs = 5) const noexcept {
+        if (const auto cached = load(); !cached.empty()) {
+            for (unsigned int i = 0; i < names.size(); i++) {
+                if (names[i] == cached) {
+                    std::cout << ":> AutoTuner: " << names[i] << " (cached in " << cache_filepath << " for " << key << ")\n";
+                    return i;
+                }
+            }
+        }
+
+        std::vector<float> best(names.size(), std::numeric_limits<float>::max());
+        for (unsigned int run = 0; run < runs; run++) {
+            for (unsigned int i = 0; i < names.size(); i++) best[i] = std::min(best[i], measure(i));
+        }
+        unsigned int fastest = 0;
+        std::cout << ":> AutoTuner: for " << key << ":\n";
+        for (unsigned int i = 0; i < names.size(); i++) {
+            std::cout << "    " << names[i] << " = " << best[i] << '\n';
+            if (best[i] < best[fastest]) fastest = i;
+        }
+        std::cout << ":> AutoTuner: picked " << names[fastest] << ", saved to " << cache_filepath << '\n';
+        save(names[fastest]);
+        return fastest;
+    }
+
+    private:
+        static std::string machine() noexcept {
+            char hostname[256] = "unknown";
+            gethostname(hostname, sizeof(hostname) - 1);
+            return std::string(hostname) + '/' + std::to_string(std::thread::hardware_concurrency()) + "-threads";
+        }
+
+        std::string load() const noexcept {
+            std::ifstream file(cache_filepath);
+            std::string line;
+            while (std::getline(file, line)) {
+                std::istringstream fields(line);
+                std::string line_key, name;
+                if ((fields >> line_key >> name) && line_key == key) return name;
+            }
+            return "";
+        }
+
+        // Keeps the lines of the other keys
+        void save(const std::string& name) const noexcept {
+            std::vector<std::string> lines;
+            {
+                std::ifstream file(cache_filepath);
+                std::string line;
+                while (std::getline(file, line)) {
+                    std::istringstream fields(line);
+                    std::string line_key;
+                    if ((fields >> line_key) && line_key != key) lines.push_back(line);
+                }
+            }
+            std::ofstream file(cache_filepath);
+            if (!file) {
+                std::cout << ":> AutoTuner: failed to write " << cache_filepath << '\n';
+                return;
+            }
+            for (const auto& line : lines) file << line << '\n';
+            file << key << ' ' << name << '\n';
+        }
+};
+
+
+#endif
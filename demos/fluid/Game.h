@@ -1,7 +1,7 @@
 #ifndef GAME_H
 #define GAME_H
 
-#include "World8.h"
+#include "World22.h"
 
 
 struct Game {
@@ -20,6 +20,16 @@ struct Game {
         bool pressed_rmb = false;
         bool pressed_mmb = false;
         bool pressed_space = false;
+        bool pressed_left = false;
+        bool pressed_right = false;
+        bool pressed_up = false;
+        bool pressed_down = false;
+        bool pressed_0 = false;
+        bool pressed_b = false;
+        bool pressed_o = false;
+        bool pressed_digits[10] = {};
+        bool pressed_t = false;
+        bool pressed_i = false;
         bool physics_on = false;
 
         Vec<2> cursor;
@@ -42,6 +52,50 @@ struct Game {
             return Vec<2>{ static_cast<float>(xpos), static_cast<float>(ypos) };
         }
 
+        // Fires once per press
+        static bool just_pressed(GLFWwindow* window, int key, bool& pressed) noexcept {
+            const bool is_pressed = glfwGetKey(window, key) == GLFW_PRESS;
+            const bool result = is_pressed && !pressed;
+            pressed = is_pressed;
+            return result;
+        }
+
+        // Only the Worlds that are evaluated in closed form can seek
+        template<typename W>
+        void register_time_input(GLFWwindow* window, W& world) noexcept {
+            if constexpr (requires (W& w) { w.seek(0.0f); w.scale_time(1.0f); w.reverse_time(); w.rewind_to_start(); }) {
+                constexpr float seek_step = 5'000'000.0f; // micros
+                if (just_pressed(window, GLFW_KEY_RIGHT, pressed_right)) world.seek(+seek_step);
+                if (just_pressed(window, GLFW_KEY_LEFT,  pressed_left))  world.seek(-seek_step);
+                if (just_pressed(window, GLFW_KEY_UP,    pressed_up))    world.scale_time(2.0f);
+                if (just_pressed(window, GLFW_KEY_DOWN,  pressed_down))  world.scale_time(0.5f);
+                if (just_pressed(window, GLFW_KEY_R,     pressed_r))     world.reverse_time();
+                if (just_pressed(window, GLFW_KEY_0,     pressed_0))     world.rewind_to_start();
+            }
+        }
+
+        // Switches of the features that only some Worlds have
+        template<typename W>
+        void register_feature_input(GLFWwindow* window, W& world) noexcept {
+            if constexpr (requires (W& w) { w.cycle_interaction(); }) {
+                if (just_pressed(window, GLFW_KEY_B, pressed_b)) world.cycle_interaction();
+            }
+            if constexpr (requires (W& w) { w.flip_obstacles(); }) {
+                if (just_pressed(window, GLFW_KEY_O, pressed_o)) world.flip_obstacles();
+            }
+            if constexpr (requires (W& w) { w.flip_scheduler(); }) {
+                if (just_pressed(window, GLFW_KEY_T, pressed_t)) world.flip_scheduler();
+            }
+            if constexpr (requires (W& w) { w.flip_statistics(); }) {
+                if (just_pressed(window, GLFW_KEY_I, pressed_i)) world.flip_statistics();
+            }
+            if constexpr (requires (W& w) { w.flip_feature(0u); }) {
+                for (unsigned int i = 1; i <= 9; i++) {
+                    if (just_pressed(window, GLFW_KEY_0 + i, pressed_digits[i])) world.flip_feature(i - 1);
+                }
+            }
+        }
+
     public:
         Game(unsigned int width, unsigned int height) noexcept
                 : window_size(Vec<2>{ 1.0f * width, 1.0f * height }),
@@ -67,6 +121,9 @@ struct Game {
                 physics_on = true;
                 world.flip_physics();
             }
+
+            register_time_input(window, world);
+            register_feature_input(window, world);
         }
 
         void reset_dimensions(unsigned int width, unsigned int height) noexcept {
@@ -0,0 +1,153 @@
+#ifndef PARTICLE_READBACK_H
+#define PARTICLE_READBACK_H
+
+#include <GL/glew.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <iostream>
+
+
+// Gets GPU-only particle state to the CPU without ever waiting for the GPU.
+// A copy of the source buffer into one of a ring of persistently mapped
+// buffers is queued together with a fence; later frames poll the fence with
+// a zero timeout, and once it has signaled the mapped memory is handed as is
+// to a consumer thread. The render thread never maps, copies or waits.
+// Whatever the consumer needs from the render thread comes as a Context,
+// taken when the copy is requested and handed over with the snapshot, so
+// that the consumer never reads the state of the World itself.
+template<typename Context>
+struct ParticleReadback {
+    using Consumer = std::function<void(const float* data, unsigned int floats, unsigned long frame, const Context& context)>;
+
+    enum class SlotState { Free, InFlight, Consuming };
+
+    struct Slot {
+        unsigned int buffer = 0;
+        const float* mapped = nullptr;
+        GLsync fence = nullptr;
+        unsigned long frame = 0; // when the copy was requested
+        Context context;         // as it was then
+        std::atomic<SlotState> state{ SlotState::Free };
+    };
+
+    static constexpr unsigned int ring_size = 4;
+    Slot slots[ring_size];
+    unsigned int size_bytes;
+    unsigned int interval_frames; // a copy is requested every that many frames
+
+    unsigned long frame = 0;
+    unsigned long completed = 0;
+    unsigned long skipped = 0; // requests with no free slot
+    float average_latency_frames = 0.0f;
+    unsigned int last_latency_frames = 0;
+
+    Consumer consume;
+    std::thread consumer;
+    std::mutex mutex;
+    std::condition_variable ready_condition;
+    std::deque<unsigned int> ready;
+    bool stopping = false;
+
+
+    ParticleReadback(unsigned int size_bytes, unsigned int interval_frames, Consumer consume) noexcept
+            : size_bytes(size_bytes), interval_frames(interval_frames), consume(std::move(consume)) {
+        constexpr GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        for (auto& slot : slots) {
+            glGenBuffers(1, &slot.buffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, slot.buffer);
+            // Client storage: the driver should keep it in CPU-visible memory
+            glBufferStorage(GL_COPY_WRITE_BUFFER, size_bytes, nullptr, flags | GL_CLIENT_STORAGE_BIT);
+            slot.mapped = static_cast<const float*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size_bytes, flags));
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        consumer = std::thread([this]{ consumer_loop(); });
+    }
+
+    ~ParticleReadback() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        ready_condition.notify_one();
+        consumer.join();
+        for (auto& slot : slots) {
+            if (slot.fence) glDeleteSync(slot.fence);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, slot.buffer);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glDeleteBuffers(1, &slot.buffer);
+        }
+    }
+
+    // To be called once per frame, after the commands that write `source`
+    void on_frame(unsigned int source, const Context& context) noexcept {
+        poll();
+        if (frame % interval_frames == 0) request(source, context);
+        frame++;
+    }
+
+    private:
+        void request(unsigned int source, const Context& context) noexcept {
+            for (auto& slot : slots) {
+                if (slot.state.load(std::memory_order_acquire) != SlotState::Free) continue;
+                glBindBuffer(GL_COPY_READ_BUFFER, source);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, slot.buffer);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size_bytes);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+                glBindBuffer(GL_COPY_READ_BUFFER, 0);
+                slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                slot.frame = frame;
+                slot.context = context;
+                slot.state.store(SlotState::InFlight, std::memory_order_relaxed);
+                return;
+            }
+            skipped++; // the consumer is behind; better to lose a snapshot than to wait
+        }
+
+        void poll() noexcept {
+            for (unsigned int i = 0; i < ring_size; i++) {
+                auto& slot = slots[i];
+                if (slot.state.load(std::memory_order_relaxed) != SlotState::InFlight) continue;
+                // Zero timeout: only asks. The flush bit is not needed, the fence
+                // was flushed with the frame that requested it.
+                const GLenum status = glClientWaitSync(slot.fence, 0, 0);
+                if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) continue;
+                glDeleteSync(slot.fence);
+                slot.fence = nullptr;
+
+                last_latency_frames = frame - slot.frame;
+                completed++;
+                average_latency_frames += (last_latency_frames - average_latency_frames) / std::min(completed, 64ul);
+
+                slot.state.store(SlotState::Consuming, std::memory_order_release);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    ready.push_back(i);
+                }
+                ready_condition.notify_one();
+            }
+        }
+
+        void consumer_loop() noexcept {
+            while (true) {
+                unsigned int i;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    ready_condition.wait(lock, [this]{ return stopping || !ready.empty(); });
+                    if (stopping) return;
+                    i = ready.front();
+                    ready.pop_front();
+                }
+                auto& slot = slots[i];
+                consume(slot.mapped, size_bytes / sizeof(float), slot.frame, slot.context);
+                slot.state.store(SlotState::Free, std::memory_order_release);
+            }
+        }
+};
+
+
+#endif
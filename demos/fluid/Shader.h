@@ -37,6 +37,9 @@ class Shader {
         inline void setUniform1f(const std::string& name, float f0) noexcept {
             glUniform1f(getUniformLocation(name), f0);
         }
+        inline void setUniform1d(const std::string& name, double d0) noexcept {
+            glUniform1d(getUniformLocation(name), d0);
+        }
         inline void setUniform1i(const std::string& name, int i0) noexcept {
             glUniform1i(getUniformLocation(name), i0);
         }
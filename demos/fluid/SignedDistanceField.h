@@ -0,0 +1,235 @@
+#ifndef SIGNED_DISTANCE_FIELD_H
+#define SIGNED_DISTANCE_FIELD_H
+
+#include "Texture.h" // for stb_image
+#include "Vec.h"
+
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <string>
+#include <iostream>
+
+#include <immintrin.h>
+
+
+// 8 floats from base[indices]. A single instruction with AVX2, otherwise
+// emulated through memory, which still keeps the rest of the kernel in AVX.
+inline __m256 gather_ps(const float* base, __m256i indices) noexcept {
+#ifdef __AVX2__
+    return _mm256_i32gather_ps(base, indices, 4);
+#else
+    alignas(32) int i[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(i), indices);
+    return _mm256_set_ps(base[i[7]], base[i[6]], base[i[5]], base[i[4]], base[i[3]], base[i[2]], base[i[1]], base[i[0]]);
+#endif
+}
+
+
+// Static obstacles as a low resolution grid of signed distances (negative
+// inside an obstacle) and of their normalized gradients, stretched over the
+// world. Sampled bilinearly, so the cost per particle does not depend on the
+// number or the shape of the obstacles.
+struct SignedDistanceField {
+    unsigned int width = 0;  // in cells
+    unsigned int height = 0; // in cells
+    Vec<2> cell_size;        // in world units
+    std::vector<float> distance;
+    std::vector<float> gradient_x;
+    std::vector<float> gradient_y;
+    bool has_obstacles = false;
+
+    // Dark pixels are obstacles. Without the image the field is empty.
+    SignedDistanceField(const std::string& filepath, const Vec<2>& world_size, unsigned int cells_y = 128) noexcept {
+        stbi_set_flip_vertically_on_load(true); // y goes up, as in the world
+        int image_width, image_height, components;
+        unsigned char* pixels = stbi_load(filepath.c_str(), &image_width, &image_height, &components, 1);
+        if (!pixels) {
+            std::cout << ":> SignedDistanceField: failed to load " << filepath << ", no obstacles\n";
+            image_width = image_height = 1;
+        }
+
+        // At least 2 x 2 cells, which the bilinear lookups need, whatever the
+        // world size (a degenerate resize can give 0, inf or NaN)
+        const float aspect = world_size[0] / world_size[1];
+        height = std::max(2u, cells_y);
+        width = (std::isfinite(aspect) && aspect > 0.0f) ? std::max(2u, static_cast<unsigned int>(std::min(height * aspect, 65536.0f) + 0.5f)) : height;
+        cell_size = Vec<2>{ world_size[0] / width, world_size[1] / height };
+
+        std::vector<bool> inside(width * height, false);
+        if (pixels) {
+            for (unsigned int y = 0; y < height; y++) {
+                for (unsigned int x = 0; x < width; x++) {
+                    const unsigned int px = (x * image_width + image_width / 2) / width;
+                    const unsigned int py = (y * image_height + image_height / 2) / height;
+                    inside[y * width + x] = pixels[py * image_width + px] < 128;
+                }
+            }
+            stbi_image_free(pixels);
+        }
+
+        compute_distances(inside);
+        compute_gradients();
+    }
+
+    // Bilinear lookup of 8 particles: the distance and the gradient of the
+    // field at (x, y), in world units.
+    void sample(__m256 x, __m256 y, __m256& d, __m256& gx, __m256& gy) const noexcept {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 max_u = _mm256_set1_ps(width  - 1.001f);
+        const __m256 max_v = _mm256_set1_ps(height - 1.001f);
+        // Cell centers are at integer (u, v). Clamped as in the scalar twin;
+        // max_ps gives its second operand for a NaN, so a NaN goes to 0.
+        const __m256 u = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.0f / cell_size[0])), half), zero), max_u);
+        const __m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_mul_ps(y, _mm256_set1_ps(1.0f / cell_size[1])), half), zero), max_v);
+        const __m256 u0 = _mm256_floor_ps(u);
+        const __m256 v0 = _mm256_floor_ps(v);
+        const __m256 fu = _mm256_sub_ps(u, u0);
+        const __m256 fv = _mm256_sub_ps(v, v0);
+
+        // Exact in float for any grid below 2^24 cells
+        const __m256 index_f = _mm256_add_ps(_mm256_mul_ps(v0, _mm256_set1_ps(width)), u0);
+        const __m256i i00 = _mm256_cvttps_epi32(index_f);
+        const __m256i i10 = _mm256_cvttps_epi32(_mm256_add_ps(index_f, _mm256_set1_ps(1.0f)));
+        const __m256i i01 = _mm256_cvttps_epi32(_mm256_add_ps(index_f, _mm256_set1_ps(width)));
+        const __m256i i11 = _mm256_cvttps_epi32(_mm256_add_ps(index_f, _mm256_set1_ps(width + 1.0f)));
+
+        const auto bilinear = [&](const float* field) {
+            const __m256 bottom = blend(gather_ps(field, i00), gather_ps(field, i10), fu);
+            const __m256 top    = blend(gather_ps(field, i01), gather_ps(field, i11), fu);
+            return blend(bottom, top, fv);
+        };
+        d  = bilinear(distance.data());
+        gx = bilinear(gradient_x.data());
+        gy = bilinear(gradient_y.data());
+    }
+
+    // Scalar twin of sample() for the remainder loops
+    void sample(float x, float y, float& d, float& gx, float& gy) const noexcept {
+        // std::max(0, NaN) is 0, as for the max_ps above
+        const float u = std::min(std::max(0.0f, x / cell_size[0] - 0.5f), width  - 1.001f);
+        const float v = std::min(std::max(0.0f, y / cell_size[1] - 0.5f), height - 1.001f);
+        const unsigned int u0 = static_cast<unsigned int>(u);
+        const unsigned int v0 = static_cast<unsigned int>(v);
+        const float fu = u - u0;
+        const float fv = v - v0;
+        const unsigned int i00 = v0 * width + u0;
+        const auto bilinear = [&](const std::vector<float>& field) {
+            const float bottom = field[i00]         * (1.0f - fu) + field[i00 + 1]         * fu;
+            const float top    = field[i00 + width] * (1.0f - fu) + field[i00 + width + 1] * fu;
+            return bottom * (1.0f - fv) + top * fv;
+        };
+        d  = bilinear(distance);
+        gx = bilinear(gradient_x);
+        gy = bilinear(gradient_y);
+    }
+
+    private:
+        static __m256 blend(__m256 a, __m256 b, __m256 t) noexcept {
+            return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), t));
+        }
+
+        // Exact squared euclidean distance transform of one row/column,
+        // Felzenszwalb & Huttenlocher. f: 0 at the sites, "infinity" elsewhere.
+        static void distance_transform_1d(const float* f, float* d, unsigned int n, std::vector<int>& v, std::vector<float>& z) noexcept {
+            constexpr float inf = std::numeric_limits<float>::infinity();
+            const auto intersection = [&](int q, int p) {
+                return ((f[q] + q * q) - (f[p] + p * p)) / (2.0f * q - 2.0f * p);
+            };
+            int k = 0;
+            v[0] = 0;
+            z[0] = -inf;
+            z[1] = +inf;
+            for (unsigned int q = 1; q < n; q++) {
+                float s = intersection(q, v[k]);
+                while (s <= z[k]) {
+                    k--;
+                    s = intersection(q, v[k]);
+                }
+                k++;
+                v[k] = q;
+                z[k] = s;
+                z[k + 1] = +inf;
+            }
+            k = 0;
+            for (unsigned int q = 0; q < n; q++) {
+                while (z[k + 1] < q) k++;
+                const float dq = static_cast<float>(q) - v[k];
+                d[q] = dq * dq + f[v[k]];
+            }
+        }
+
+        // Squared distance (in cells) from every cell to the nearest site
+        std::vector<float> squared_distance_to(const std::vector<bool>& sites) const noexcept {
+            constexpr float far = 1e20f;
+            const unsigned int n = std::max(width, height);
+            std::vector<float> grid(width * height);
+            std::vector<float> f(n), d(n), z(n + 1);
+            std::vector<int> v(n);
+            for (unsigned int i = 0; i < width * height; i++) grid[i] = sites[i] ? 0.0f : far;
+            for (unsigned int x = 0; x < width; x++) {
+                for (unsigned int y = 0; y < height; y++) f[y] = grid[y * width + x];
+                distance_transform_1d(f.data(), d.data(), height, v, z);
+                for (unsigned int y = 0; y < height; y++) grid[y * width + x] = d[y];
+            }
+            for (unsigned int y = 0; y < height; y++) {
+                distance_transform_1d(&grid[y * width], d.data(), width, v, z);
+                std::copy(d.begin(), d.begin() + width, &grid[y * width]);
+            }
+            return grid;
+        }
+
+        void compute_distances(const std::vector<bool>& inside) noexcept {
+            std::vector<bool> outside(inside.size());
+            bool any_inside = false;
+            bool any_outside = false;
+            for (unsigned int i = 0; i < inside.size(); i++) {
+                outside[i] = !inside[i];
+                any_inside |= inside[i];
+                any_outside |= outside[i];
+            }
+            const float cell = std::min(cell_size[0], cell_size[1]);
+            distance.assign(width * height, std::numeric_limits<float>::max());
+            has_obstacles = any_inside;
+            if (!any_inside) return; // nothing to collide with
+            if (!any_outside) {
+                std::fill(distance.begin(), distance.end(), -cell);
+                return;
+            }
+            const auto to_obstacle = squared_distance_to(inside);
+            const auto to_free = squared_distance_to(outside);
+            // The boundary lies half a cell away from the cell centers
+            for (unsigned int i = 0; i < distance.size(); i++) {
+                distance[i] = inside[i]
+                    ? -(std::sqrt(to_free[i]) - 0.5f) * cell
+                    : +(std::sqrt(to_obstacle[i]) - 0.5f) * cell;
+            }
+        }
+
+        void compute_gradients() noexcept {
+            gradient_x.assign(width * height, 0.0f);
+            gradient_y.assign(width * height, 0.0f);
+            // Far from the obstacles the field is never sampled for a response
+            for (auto& d : distance) d = std::min(d, 1e6f);
+            for (unsigned int y = 0; y < height; y++) {
+                for (unsigned int x = 0; x < width; x++) {
+                    const unsigned int xl = (x > 0) ? x - 1 : x;
+                    const unsigned int xr = (x + 1 < width) ? x + 1 : x;
+                    const unsigned int yd = (y > 0) ? y - 1 : y;
+                    const unsigned int yu = (y + 1 < height) ? y + 1 : y;
+                    const float gx = (distance[y * width + xr] - distance[y * width + xl]) / ((xr - xl) * cell_size[0] + 1e-6f);
+                    const float gy = (distance[yu * width + x] - distance[yd * width + x]) / ((yu - yd) * cell_size[1] + 1e-6f);
+                    const float length = std::sqrt(gx * gx + gy * gy);
+                    if (length > 1e-6f) {
+                        gradient_x[y * width + x] = gx / length;
+                        gradient_y[y * width + x] = gy / length;
+                    }
+                }
+            }
+        }
+};
+
+
+#endif
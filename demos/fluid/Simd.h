@@ -0,0 +1,174 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "Vec.h"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
+
+// 8 floats in whatever the target has: one AVX register on x86, two NEON
+// registers on aarch64, a plain array elsewhere. The kernels are written
+// once against this, and the loops step by simd::width.
+namespace simd {
+    static constexpr unsigned int width = 8;
+    static constexpr unsigned int alignment = 32; // bytes, for load() and store()
+
+#if defined(__AVX__)
+    static constexpr const char* backend = "AVX";
+
+    struct f32x8 {
+        __m256 v;
+    };
+
+    inline f32x8 set1(float f) noexcept { return { _mm256_set1_ps(f) }; }
+    inline f32x8 load(const float* p) noexcept { return { _mm256_load_ps(p) }; }
+    inline void store(float* p, f32x8 a) noexcept { _mm256_store_ps(p, a.v); }
+
+    inline f32x8 operator+(f32x8 a, f32x8 b) noexcept { return { _mm256_add_ps(a.v, b.v) }; }
+    inline f32x8 operator-(f32x8 a, f32x8 b) noexcept { return { _mm256_sub_ps(a.v, b.v) }; }
+    inline f32x8 operator*(f32x8 a, f32x8 b) noexcept { return { _mm256_mul_ps(a.v, b.v) }; }
+    inline f32x8 min(f32x8 a, f32x8 b) noexcept { return { _mm256_min_ps(a.v, b.v) }; }
+    inline f32x8 max(f32x8 a, f32x8 b) noexcept { return { _mm256_max_ps(a.v, b.v) }; }
+    inline f32x8 floor(f32x8 a) noexcept { return { _mm256_floor_ps(a.v) }; }
+    // About 12 bits
+    inline f32x8 rsqrt(f32x8 a) noexcept { return { _mm256_rsqrt_ps(a.v) }; }
+
+#elif defined(__ARM_NEON)
+    static constexpr const char* backend = "NEON";
+
+    struct f32x8 {
+        float32x4_t lo;
+        float32x4_t hi;
+    };
+
+    inline f32x8 set1(float f) noexcept { return { vdupq_n_f32(f), vdupq_n_f32(f) }; }
+    inline f32x8 load(const float* p) noexcept { return { vld1q_f32(p), vld1q_f32(p + 4) }; }
+    inline void store(float* p, f32x8 a) noexcept { vst1q_f32(p, a.lo); vst1q_f32(p + 4, a.hi); }
+
+    inline f32x8 operator+(f32x8 a, f32x8 b) noexcept { return { vaddq_f32(a.lo, b.lo), vaddq_f32(a.hi, b.hi) }; }
+    inline f32x8 operator-(f32x8 a, f32x8 b) noexcept { return { vsubq_f32(a.lo, b.lo), vsubq_f32(a.hi, b.hi) }; }
+    inline f32x8 operator*(f32x8 a, f32x8 b) noexcept { return { vmulq_f32(a.lo, b.lo), vmulq_f32(a.hi, b.hi) }; }
+    inline f32x8 min(f32x8 a, f32x8 b) noexcept { return { vminq_f32(a.lo, b.lo), vminq_f32(a.hi, b.hi) }; }
+    inline f32x8 max(f32x8 a, f32x8 b) noexcept { return { vmaxq_f32(a.lo, b.lo), vmaxq_f32(a.hi, b.hi) }; }
+    inline f32x8 floor(f32x8 a) noexcept { return { vrndmq_f32(a.lo), vrndmq_f32(a.hi) }; }
+    // The estimate alone is about 8 bits; one Newton step brings it to
+    // about the precision of the AVX one
+    inline f32x8 rsqrt(f32x8 a) noexcept {
+        const auto refined = [](float32x4_t x) {
+            const float32x4_t e = vrsqrteq_f32(x);
+            return vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(x, e), e));
+        };
+        return { refined(a.lo), refined(a.hi) };
+    }
+
+#else
+    static constexpr const char* backend = "scalar";
+
+    struct f32x8 {
+        float v[width];
+    };
+
+    template<typename F>
+    inline f32x8 each(F&& f) noexcept {
+        f32x8 r;
+        for (unsigned int i = 0; i < width; i++) r.v[i] = f(i);
+        return r;
+    }
+
+    inline f32x8 set1(float f) noexcept { return each([&](unsigned int) { return f; }); }
+    inline f32x8 load(const float* p) noexcept { return each([&](unsigned int i) { return p[i]; }); }
+    inline void store(float* p, f32x8 a) noexcept { for (unsigned int i = 0; i < width; i++) p[i] = a.v[i]; }
+
+    inline f32x8 operator+(f32x8 a, f32x8 b) noexcept { return each([&](unsigned int i) { return a.v[i] + b.v[i]; }); }
+    inline f32x8 operator-(f32x8 a, f32x8 b) noexcept { return each([&](unsigned int i) { return a.v[i] - b.v[i]; }); }
+    inline f32x8 operator*(f32x8 a, f32x8 b) noexcept { return each([&](unsigned int i) { return a.v[i] * b.v[i]; }); }
+    inline f32x8 min(f32x8 a, f32x8 b) noexcept { return each([&](unsigned int i) { return std::min(a.v[i], b.v[i]); }); }
+    inline f32x8 max(f32x8 a, f32x8 b) noexcept { return each([&](unsigned int i) { return std::max(a.v[i], b.v[i]); }); }
+    inline f32x8 floor(f32x8 a) noexcept { return each([&](unsigned int i) { return std::floor(a.v[i]); }); }
+    inline f32x8 rsqrt(f32x8 a) noexcept { return each([&](unsigned int i) { return 1.0f / std::sqrt(a.v[i]); }); }
+#endif
+
+
+    // Across the lanes. Through memory, so for the end of a loop, not inside it.
+    inline float sum(f32x8 a) noexcept {
+        alignas(alignment) float lanes[width];
+        store(lanes, a);
+        float res = 0.0f;
+        for (unsigned int i = 0; i < width; i++) res += lanes[i];
+        return res;
+    }
+
+    inline float min(f32x8 a) noexcept {
+        alignas(alignment) float lanes[width];
+        store(lanes, a);
+        return *std::min_element(lanes, lanes + width);
+    }
+
+    inline float max(f32x8 a) noexcept {
+        alignas(alignment) float lanes[width];
+        store(lanes, a);
+        return *std::max_element(lanes, lanes + width);
+    }
+
+
+    // The same Vec<DIM>, for 8 nodes at once: one f32x8 per coordinate.
+    // Loaded from and stored to SoA streams (all xs, then all ys, ...).
+    template<unsigned int DIM>
+    struct Vecs {
+        f32x8 d[DIM];
+
+        static Vecs<DIM> broadcast(const Vec<DIM>& v) noexcept {
+            Vecs<DIM> res;
+            for (unsigned int i = 0; i < DIM; i++) res.d[i] = set1(v[i]);
+            return res;
+        }
+
+        // Coordinate c of node n is at streams[c * stream_size + n]
+        static Vecs<DIM> load(const float* streams, unsigned int stream_size, unsigned int n) noexcept {
+            Vecs<DIM> res;
+            for (unsigned int i = 0; i < DIM; i++) res.d[i] = simd::load(&streams[i * stream_size + n]);
+            return res;
+        }
+
+        void store(float* streams, unsigned int stream_size, unsigned int n) const noexcept {
+            for (unsigned int i = 0; i < DIM; i++) simd::store(&streams[i * stream_size + n], d[i]);
+        }
+
+        f32x8  operator[](unsigned int i) const noexcept { return d[i]; }
+        f32x8& operator[](unsigned int i)       noexcept { return d[i]; }
+
+        Vecs<DIM> operator+(const Vecs<DIM>& other) const noexcept {
+            Vecs<DIM> res;
+            for (unsigned int i = 0; i < DIM; i++) res.d[i] = d[i] + other.d[i];
+            return res;
+        }
+
+        Vecs<DIM> operator-(const Vecs<DIM>& other) const noexcept {
+            Vecs<DIM> res;
+            for (unsigned int i = 0; i < DIM; i++) res.d[i] = d[i] - other.d[i];
+            return res;
+        }
+
+        Vecs<DIM> operator*(f32x8 scalar) const noexcept {
+            Vecs<DIM> res;
+            for (unsigned int i = 0; i < DIM; i++) res.d[i] = d[i] * scalar;
+            return res;
+        }
+
+        f32x8 length_sqr() const noexcept {
+            f32x8 res = d[0] * d[0];
+            for (unsigned int i = 1; i < DIM; i++) res = res + d[i] * d[i];
+            return res;
+        }
+    };
+}
+
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+
+// Persistent workers for the per-frame parallel loops, so that no thread is
+// created inside a frame. The calling thread takes part in the work, so a
+// pool of size 1 has no workers at all.
+struct ThreadPool {
+    using Task = std::function<void(unsigned int task_index, unsigned int thread_index)>;
+
+    unsigned int size; // including the calling thread
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const Task* job = nullptr;
+    unsigned int job_tasks = 0;
+    std::atomic<unsigned int> next_task{ 0 };
+    unsigned int busy_workers = 0;
+    unsigned long generation = 0;
+    bool stopping = false;
+
+
+    ThreadPool(unsigned int size = std::thread::hardware_concurrency()) : size(std::max(1u, size)) {
+        for (unsigned int i = 1; i < this->size; i++) {
+            workers.emplace_back([this, i]{ worker_loop(i); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    // Calls task(task_index, thread_index) for every task_index in [0, tasks)
+    // and returns when all of them are done. thread_index is in [0, size).
+    void run(unsigned int tasks, const Task& task) noexcept {
+        if (workers.empty()) {
+            for (unsigned int i = 0; i < tasks; i++) task(i, 0);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &task;
+            job_tasks = tasks;
+            next_task = 0;
+            busy_workers = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        work(task, tasks, 0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]{ return busy_workers == 0; });
+    }
+
+    // Splits [0, count) into chunks of `granularity` (rounded up to a multiple
+    // of 8 to keep the SIMD loops aligned) and calls f(begin, end, thread_index).
+    template<typename F>
+    void parallel_for(std::size_t count, std::size_t granularity, F&& f) noexcept {
+        granularity = std::max<std::size_t>(8, (granularity + 7) & ~static_cast<std::size_t>(7));
+        const unsigned int tasks = (count + granularity - 1) / granularity;
+        run(tasks, [&](unsigned int task_index, unsigned int thread_index) {
+            const std::size_t begin = task_index * granularity;
+            const std::size_t end = std::min(count, begin + granularity);
+            f(begin, end, thread_index);
+        });
+    }
+
+    private:
+        void work(const Task& task, unsigned int tasks, unsigned int thread_index) noexcept {
+            for (unsigned int i = next_task.fetch_add(1); i < tasks; i = next_task.fetch_add(1)) {
+                task(i, thread_index);
+            }
+        }
+
+        void worker_loop(unsigned int thread_index) noexcept {
+            unsigned long seen_generation = 0;
+            while (true) {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]{ return stopping || generation != seen_generation; });
+                if (stopping) return;
+                seen_generation = generation;
+                const Task* task = job;
+                const unsigned int tasks = job_tasks;
+                lock.unlock();
+
+                work(*task, tasks, thread_index);
+
+                lock.lock();
+                if (--busy_workers == 0) done.notify_one();
+            }
+        }
+};
+
+
+#endif
@@ -2,6 +2,7 @@
 #define VEC_H
 
 #include <cmath>
+#include <cassert>
 #include <iostream>
 
 // template<typename T>
@@ -0,0 +1,176 @@
+#ifndef VORTEX_KERNEL_H
+#define VORTEX_KERNEL_H
+
+#include "Simd.h"
+#include "Vec.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+
+// Summary of the nodes, gathered by the step itself. The radii are those
+// the step has computed, before it; the box and the escapes are after it.
+// One per thread; merge() them at the end.
+struct VortexStatistics {
+    Vec<2> world_size; // out of [0, world_size] counts as escaped
+
+    double count = 0.0;
+    double sum_radius = 0.0;
+    double sum_radius_sqr = 0.0; // the exact r^2 of the step, not the square of its approximate radius
+    double escaped = 0.0;
+    Vec<2> min{ std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+    Vec<2> max{ std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
+
+    VortexStatistics(const Vec<2>& world_size) noexcept : world_size(world_size) {}
+
+    void merge(const VortexStatistics& other) noexcept {
+        count += other.count;
+        sum_radius += other.sum_radius;
+        sum_radius_sqr += other.sum_radius_sqr;
+        escaped += other.escaped;
+        for (unsigned int i = 0; i < 2; i++) {
+            min[i] = std::min(min[i], other.min[i]);
+            max[i] = std::max(max[i], other.max[i]);
+        }
+    }
+
+    float mean_radius() const noexcept {
+        return sum_radius / count;
+    }
+
+    float radius_variance() const noexcept {
+        const double mean = sum_radius / count;
+        return std::max(0.0, sum_radius_sqr / count - mean * mean);
+    }
+
+    // Per node of unit mass, about the attractor, in world units^2 per
+    // second; clockwise is negative. The step moves a node by
+    // (r_y, -r_x) * mul, with mul = (1/r - one_over_max_attractor) * speed * dt,
+    // so r x v = -(r - one_over_max_attractor * r^2) * speed: the sums of the
+    // radii are enough, nothing more is needed in the loop.
+    // speed = speed_scaler * MAX_MAGNITUDE, per micro.
+    float angular_momentum(float one_over_max_attractor, float speed) const noexcept {
+        return -(sum_radius - one_over_max_attractor * sum_radius_sqr) / count * speed * 1'000'000.0;
+    }
+};
+
+
+// One step of the vortex of World7 on nodes [begin, end) of SoA positions
+// (stream_size xs, then stream_size ys), xs_ys aligned to simd::alignment.
+// With STATISTICS the nodes are also summarized into *statistics on the way,
+// from the registers the step has loaded anyway.
+template<bool STATISTICS>
+inline void advect_vortex_impl(float* xs_ys, unsigned int stream_size, unsigned int begin, unsigned int end, const Vec<2>& attractor,
+        float one_over_max_attractor, float speed_scaler_mul_max_magnitude_mul_dt, VortexStatistics* statistics) noexcept {
+    // The loads are only aligned when both streams start at a multiple of the width
+    const bool aligned = (begin % simd::width == 0) && (stream_size % simd::width == 0);
+    const unsigned int bulk_end = aligned ? end - (end - begin) % simd::width : begin;
+
+    // Process bulk part
+    {
+        const auto attr = simd::Vecs<2>::broadcast(attractor);
+        const auto one_over_max = simd::set1(one_over_max_attractor);
+        const auto k = simd::set1(speed_scaler_mul_max_magnitude_mul_dt);
+
+        // Per lane; a range of a few thousand nodes per lane keeps the float
+        // sums within about 1e-4 of the double ones
+        [[maybe_unused]] simd::f32x8 sum_radius, sum_radius_sqr, min_x, min_y, max_x, max_y;
+        if constexpr (STATISTICS) {
+            sum_radius = sum_radius_sqr = simd::set1(0.0f);
+            min_x = min_y = simd::set1(std::numeric_limits<float>::max());
+            max_x = max_y = simd::set1(std::numeric_limits<float>::lowest());
+        }
+
+        for (unsigned int i = begin; i < bulk_end; i += simd::width) {
+            auto pos = simd::Vecs<2>::load(xs_ys, stream_size, i);
+            const auto r = pos - attr;
+            const auto r2 = r.length_sqr();
+            const auto one_over_length = simd::rsqrt(r2);
+            const auto mul = (one_over_length - one_over_max) * k;
+            if constexpr (STATISTICS) {
+                sum_radius = sum_radius + r2 * one_over_length;
+                sum_radius_sqr = sum_radius_sqr + r2;
+            }
+            pos[0] = pos[0] + r[1] * mul;
+            pos[1] = pos[1] - r[0] * mul;
+            pos.store(xs_ys, stream_size, i);
+            if constexpr (STATISTICS) {
+                min_x = simd::min(min_x, pos[0]);
+                min_y = simd::min(min_y, pos[1]);
+                max_x = simd::max(max_x, pos[0]);
+                max_y = simd::max(max_y, pos[1]);
+            }
+        }
+
+        if constexpr (STATISTICS) {
+            statistics->count += bulk_end - begin;
+            statistics->sum_radius += simd::sum(sum_radius);
+            statistics->sum_radius_sqr += simd::sum(sum_radius_sqr);
+            const Vec<2> min{ simd::min(min_x), simd::min(min_y) };
+            const Vec<2> max{ simd::max(max_x), simd::max(max_y) };
+            // Escapes are rare, so they are only counted, in a second pass
+            // over what is still in the cache, when the box says there are any
+            const auto& size = statistics->world_size;
+            if (bulk_end > begin && (min[0] < 0.0f || min[1] < 0.0f || max[0] > size[0] || max[1] > size[1])) {
+                const float* xs = xs_ys;
+                const float* ys = xs_ys + stream_size;
+                for (unsigned int i = begin; i < bulk_end; i++) {
+                    if (xs[i] < 0.0f || ys[i] < 0.0f || xs[i] > size[0] || ys[i] > size[1]) statistics->escaped += 1.0;
+                }
+            }
+            for (unsigned int i = 0; i < 2; i++) {
+                statistics->min[i] = std::min(statistics->min[i], min[i]);
+                statistics->max[i] = std::max(statistics->max[i], max[i]);
+            }
+        }
+    }
+
+    // Process remainder
+    {
+        float* xs = xs_ys;
+        float* ys = xs_ys + stream_size;
+        for (unsigned int i = bulk_end; i < end; i++) {
+            const float x = xs[i] - attractor[0];
+            const float y = ys[i] - attractor[1];
+            const float r2 = x * x + y * y;
+            const float one_over_length = 1.0f / std::sqrt(r2);
+            const float mul = (one_over_length - one_over_max_attractor) * speed_scaler_mul_max_magnitude_mul_dt;
+            xs[i] += y * mul;
+            ys[i] -= x * mul;
+            if constexpr (STATISTICS) {
+                statistics->count += 1.0;
+                statistics->sum_radius += r2 * one_over_length;
+                statistics->sum_radius_sqr += r2;
+                statistics->min[0] = std::min(statistics->min[0], xs[i]);
+                statistics->min[1] = std::min(statistics->min[1], ys[i]);
+                statistics->max[0] = std::max(statistics->max[0], xs[i]);
+                statistics->max[1] = std::max(statistics->max[1], ys[i]);
+                if (xs[i] < 0.0f || ys[i] < 0.0f || xs[i] > statistics->world_size[0] || ys[i] > statistics->world_size[1]) {
+                    statistics->escaped += 1.0;
+                }
+            }
+        }
+    }
+}
+
+// Shared by World19, World20, World21 and simd_bench
+inline void advect_vortex(float* xs_ys, unsigned int stream_size, unsigned int begin, unsigned int end, const Vec<2>& attractor,
+        float one_over_max_attractor, float speed_scaler_mul_max_magnitude_mul_dt) noexcept {
+    advect_vortex_impl<false>(xs_ys, stream_size, begin, end, attractor, one_over_max_attractor, speed_scaler_mul_max_magnitude_mul_dt, nullptr);
+}
+
+// With the summary, for World21
+inline void advect_vortex(float* xs_ys, unsigned int stream_size, unsigned int begin, unsigned int end, const Vec<2>& attractor,
+        float one_over_max_attractor, float speed_scaler_mul_max_magnitude_mul_dt, VortexStatistics& statistics) noexcept {
+    advect_vortex_impl<true>(xs_ys, stream_size, begin, end, attractor, one_over_max_attractor, speed_scaler_mul_max_magnitude_mul_dt, &statistics);
+}
+
+// All the nodes
+inline void advect_vortex(float* xs_ys, unsigned int count, const Vec<2>& attractor,
+        float one_over_max_attractor, float speed_scaler_mul_max_magnitude_mul_dt) noexcept {
+    advect_vortex(xs_ys, count, 0, count, attractor, one_over_max_attractor, speed_scaler_mul_max_magnitude_mul_dt);
+}
+
+
+#endif
@@ -0,0 +1,781 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include "Shader.h"
+#include "Texture.h"
+#include "Vec.h"
+#include "ThreadPool.h"
+#include "util.h"
+
+#include <cmath>
+#include <algorithm>
+#include <optional>
+#include <random>
+#include <limits>
+#include <vector>
+#include <cstdint>
+
+#include <immintrin.h>
+
+#include <GLFW/glfw3.h>
+
+
+// float, double, long double
+// [low, high)
+template<typename T = float>
+T getRandomUniformFloat(T low, T high) {
+    static std::random_device rd;
+    static std::seed_seq seed{1, 2, 3, 300};
+    static std::mt19937 e2(seed);
+    // static std::mt19937 e2(rd());
+    std::uniform_real_distribution<T> dist(low, high);
+
+    return dist(e2);
+}
+
+
+// NOTE The rendered node size is actually set in geometry shader
+static constexpr float NODE_SIZE = 0.2f;
+
+
+enum class Interaction {
+    None,      // independent particles, same as World7
+    BarnesHut, // O(N log N) quadtree approximation
+    DirectSum  // O(N^2) reference
+};
+
+const char* to_string(Interaction interaction) noexcept {
+    switch (interaction) {
+        case Interaction::None:      return "None";
+        case Interaction::BarnesHut: return "Barnes-Hut";
+        case Interaction::DirectSum: return "Direct sum";
+    }
+    return "?";
+}
+
+
+inline float horizontal_sum(__m256 v) noexcept {
+    const __m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    const __m128 sum2 = _mm_add_ps(sum4, _mm_movehl_ps(sum4, sum4));
+    const __m128 sum1 = _mm_add_ss(sum2, _mm_shuffle_ps(sum2, sum2, 0b01));
+    return _mm_cvtss_f32(sum1);
+}
+
+// Spreads the lower 16 bits of x into the even bits
+inline uint32_t part_1_by_1(uint32_t x) noexcept {
+    x &= 0x0000FFFF;
+    x = (x | (x << 8)) & 0x00FF00FF;
+    x = (x | (x << 4)) & 0x0F0F0F0F;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    return x;
+}
+
+
+struct QuadTreeNode {
+    float com_x, com_y; // center of mass
+    float mass;
+    float size;         // side of the square cell
+    int child[4];       // -1 if absent; quadrant bit 0 is x, bit 1 is y
+    unsigned int begin, end; // range of bodies in Morton order
+    bool is_leaf;
+};
+
+
+// Point masses acting on one leaf of bodies, in SoA for the AVX loop
+struct InteractionList {
+    std::vector<float> xs, ys, masses;
+
+    void clear() noexcept {
+        xs.clear();
+        ys.clear();
+        masses.clear();
+    }
+
+    void add(float x, float y, float mass) noexcept {
+        xs.push_back(x);
+        ys.push_back(y);
+        masses.push_back(mass);
+    }
+};
+
+
+struct World {
+    bool physics_on = true;
+
+    Vec<2> world_size;
+
+    unsigned int nodes_size;
+
+    float* nodes_pos_xs_ys;
+    float* nodes_vel_xs_ys;
+    float* nodes_acc_xs_ys;
+    Vec<3>* nodes_color;
+
+    unsigned int vao_nodes;
+    unsigned int vbo_nodes;
+
+    static constexpr unsigned int node_vertex_components = 2 + 3; // x,y + color3
+
+    Shader shader_node{"node_geo_sep.vert", "node.geom", "node.frag"};
+
+    ThreadPool pool;
+
+    Interaction interaction = Interaction::BarnesHut;
+
+    // All bodies have the same mass, so it is folded into the strength
+    static constexpr float interaction_strength = 2.5e-9f; // G * total mass, in world units^3 / micros^2
+    static constexpr float softening_sqr = 0.5f * 0.5f;
+    static constexpr float theta = 0.6f; // opening angle
+    static constexpr unsigned int leaf_size = 32;
+    static constexpr unsigned int morton_levels = 16;
+    static constexpr unsigned int parallel_build_depth = 3; // up to 4^3 subtrees built in parallel
+
+    // Tree state, rebuilt every step
+    uint32_t* morton_keys;
+    uint32_t* morton_keys_tmp;
+    uint32_t* sorted_index;
+    uint32_t* sorted_index_tmp;
+    float* sorted_xs;
+    float* sorted_ys;
+    std::vector<QuadTreeNode> tree;
+    std::vector<unsigned int> leaves;
+    std::vector<InteractionList> interaction_lists; // one per thread
+    Vec<2> tree_origin;
+    float tree_size;
+
+    float last_accuracy_report = 0.0f;
+
+
+    World(const Vec<2>& world_size) : world_size(world_size) {
+        prepare_nodes(1 << 18);
+        interaction_lists.resize(pool.size);
+        std::cout << "Interaction: " << to_string(interaction) << " (B to change) on " << pool.size << " threads\n";
+    }
+
+    ~World() {
+        ::operator delete[] (nodes_pos_xs_ys, std::align_val_t(32));
+        ::operator delete[] (nodes_vel_xs_ys, std::align_val_t(32));
+        ::operator delete[] (nodes_acc_xs_ys, std::align_val_t(32));
+        ::operator delete[] (sorted_xs, std::align_val_t(32));
+        ::operator delete[] (sorted_ys, std::align_val_t(32));
+        delete[] morton_keys;
+        delete[] morton_keys_tmp;
+        delete[] sorted_index;
+        delete[] sorted_index_tmp;
+        delete[] nodes_color;
+        glDeleteBuffers(1, &vbo_nodes);
+        glDeleteVertexArrays(1, &vao_nodes);
+    }
+
+    void prepare_nodes(unsigned int count) noexcept {
+        nodes_size = count;
+        nodes_pos_xs_ys = new (std::align_val_t(32)) float[2 * count];
+        nodes_vel_xs_ys = new (std::align_val_t(32)) float[2 * count];
+        nodes_acc_xs_ys = new (std::align_val_t(32)) float[2 * count];
+        sorted_xs = new (std::align_val_t(32)) float[count];
+        sorted_ys = new (std::align_val_t(32)) float[count];
+        morton_keys = new uint32_t[count];
+        morton_keys_tmp = new uint32_t[count];
+        sorted_index = new uint32_t[count];
+        sorted_index_tmp = new uint32_t[count];
+        nodes_color = new Vec<3>[count];
+
+        const auto border = 10.5f * NODE_SIZE;
+        for (unsigned int i = 0; i < count; i++) {
+            const auto x = getRandomUniformFloat(border, world_size[0] - border);
+            const auto y = getRandomUniformFloat(border, world_size[1] - border);
+            const auto color = Vec<3>{ x / world_size[0], y / world_size[1], 0.7f };
+            nodes_pos_xs_ys[i]         = x;
+            nodes_pos_xs_ys[count + i] = y;
+            nodes_vel_xs_ys[i]         = 0.0f;
+            nodes_vel_xs_ys[count + i] = 0.0f;
+            nodes_acc_xs_ys[i]         = 0.0f;
+            nodes_acc_xs_ys[count + i] = 0.0f;
+            nodes_color[i] = color;
+        }
+
+        glGenVertexArrays(1, &vao_nodes);
+        glBindVertexArray(vao_nodes);
+        {
+            glGenBuffers(1, &vbo_nodes);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes);
+            const unsigned int size_bytes = nodes_size * node_vertex_components * sizeof(float);
+            const float* nodes_data = allocate_and_init_all_nodes_data();
+            glBufferData(GL_ARRAY_BUFFER, size_bytes, nodes_data, GL_DYNAMIC_DRAW);
+            delete[] nodes_data;
+
+            specify_attribs_for_nodes(); // proper GL_ARRAY_BUFFER must be bound!
+        }
+
+        shader_node.bind();
+    }
+
+    void specify_attribs_for_nodes() const noexcept {
+        {
+            const auto index = 0;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 1; // x
+            const auto stride_bytes = 0;
+            const auto offset_bytes = 0;
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+        {
+            const auto index = 1;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 1; // y
+            const auto stride_bytes = 0;
+            const auto offset_bytes = nodes_size * sizeof(float); // skip xs
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+        {
+            const auto index = 2;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 3; // color3
+            const auto stride_bytes = 0;
+            const auto offset_bytes = 2 * nodes_size * sizeof(float); // skip xs and ys
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+    }
+
+    void update_and_render(float dt, const Vec<2>& cursor) noexcept {
+        static auto last = get_time_micros();
+        const auto p0 = get_time_micros();
+        float tree_time = 0.0f;
+        float forces_time = 0.0f;
+        if (physics_on) do_physics(dt, cursor, tree_time, forces_time);
+        const auto p1 = get_time_micros();
+        resubmit_nodes_vertices_pos();
+        const auto p2 = get_time_micros();
+        render_nodes();
+        const auto p3 = get_time_micros();
+        const auto frame_time = p3 - last;
+        const auto fps = 1'000'000.0f / frame_time;
+        std::cout
+            << "Idle = " << std::setw(5) << (p0 - last) << "  "
+            << "Physics = " << std::setw(5) << (p1 - p0) << "  "
+            << "(Tree = " << std::setw(5) << tree_time << "  "
+            << "Forces = " << std::setw(5) << forces_time << ")  "
+            << "Resubmit = " << std::setw(5) << (p2 - p1) << "  "
+            << "Render = " << std::setw(5) << (p3 - p2) << "  "
+            << "Frame time = " << std::setw(5) << frame_time << "  "
+            << "FPS = " << std::setw(5) << fps << '\n';
+        if (interaction == Interaction::BarnesHut && p3 - last_accuracy_report > 1'000'000.0f) {
+            last_accuracy_report = p3;
+            report_accuracy(forces_time);
+        }
+        last = p3;
+    }
+
+    void render_nodes() const noexcept {
+        glDrawArrays(GL_POINTS, 0, nodes_size);
+    }
+
+    void do_physics(float dt, const Vec<2>& cursor, float& tree_time, float& forces_time) noexcept {
+        const auto t0 = get_time_micros();
+        switch (interaction) {
+            case Interaction::None:
+                break;
+            case Interaction::BarnesHut:
+                build_tree();
+                tree_time = get_time_micros() - t0;
+                compute_accelerations_barnes_hut();
+                break;
+            case Interaction::DirectSum:
+                compute_accelerations_direct();
+                break;
+        }
+        forces_time = get_time_micros() - t0 - tree_time;
+
+        advect(dt);
+    }
+
+    void cycle_interaction() noexcept {
+        switch (interaction) {
+            case Interaction::None:      interaction = Interaction::BarnesHut; break;
+            case Interaction::BarnesHut: interaction = Interaction::DirectSum; break;
+            case Interaction::DirectSum: interaction = Interaction::None;      break;
+        }
+        if (interaction == Interaction::None) {
+            std::fill(nodes_acc_xs_ys, nodes_acc_xs_ys + 2 * nodes_size, 0.0f);
+        }
+        std::cout << "Interaction: " << to_string(interaction) << '\n';
+    }
+
+    // The World7 vortex plus the velocity gained from the interaction
+    void advect(float dt) noexcept {
+        constexpr float speed_scaler = 5.0f * 0.0000025f;
+        constexpr auto MAX_MAGNITUDE = 2.0f;
+        const float strength_mul_dt = interaction_strength / nodes_size * dt;
+
+        pool.parallel_for(nodes_size, 1 << 14, [&](std::size_t begin, std::size_t end, unsigned int) {
+            const __m256 attr_x                                = _mm256_set1_ps((world_size * 0.5f)[0]);
+            const __m256 attr_y                                = _mm256_set1_ps((world_size * 0.5f)[1]);
+            const __m256 one_over_max_attractor                = _mm256_set1_ps(1.0f / world_size.length());
+            const __m256 speed_scaler_mul_max_magnitude_mul_dt = _mm256_set1_ps(speed_scaler * MAX_MAGNITUDE * dt);
+            const __m256 strength_mul_dt8                      = _mm256_set1_ps(strength_mul_dt);
+            const __m256 dt8                                   = _mm256_set1_ps(dt);
+            std::size_t i = begin;
+            for (; i + 7 < end; i += 8) {
+                __m256 vel_x = _mm256_load_ps(&nodes_vel_xs_ys[i]);
+                __m256 vel_y = _mm256_load_ps(&nodes_vel_xs_ys[nodes_size + i]);
+                vel_x = _mm256_add_ps(vel_x, _mm256_mul_ps(_mm256_load_ps(&nodes_acc_xs_ys[             i]), strength_mul_dt8));
+                vel_y = _mm256_add_ps(vel_y, _mm256_mul_ps(_mm256_load_ps(&nodes_acc_xs_ys[nodes_size + i]), strength_mul_dt8));
+
+                __m256 pos_x = _mm256_load_ps(&nodes_pos_xs_ys[i]);
+                const __m256 x = _mm256_sub_ps(pos_x, attr_x);
+                const __m256 xx = _mm256_mul_ps(x, x);
+
+                __m256 pos_y = _mm256_load_ps(&nodes_pos_xs_ys[nodes_size + i]);
+                const __m256 y = _mm256_sub_ps(pos_y, attr_y);
+                const __m256 yy = _mm256_mul_ps(y, y);
+
+                const __m256 xx_plus_yy = _mm256_add_ps(xx, yy);
+                const __m256 one_over_length = _mm256_rsqrt_ps(xx_plus_yy);
+
+                const __m256 mul = _mm256_mul_ps(_mm256_sub_ps(one_over_length, one_over_max_attractor), speed_scaler_mul_max_magnitude_mul_dt);
+
+                pos_x = _mm256_add_ps(pos_x, _mm256_add_ps(_mm256_mul_ps(y, mul), _mm256_mul_ps(vel_x, dt8)));
+                pos_y = _mm256_sub_ps(pos_y, _mm256_sub_ps(_mm256_mul_ps(x, mul), _mm256_mul_ps(vel_y, dt8)));
+
+                _mm256_store_ps(&nodes_pos_xs_ys[             i], pos_x);
+                _mm256_store_ps(&nodes_pos_xs_ys[nodes_size + i], pos_y);
+                _mm256_store_ps(&nodes_vel_xs_ys[             i], vel_x);
+                _mm256_store_ps(&nodes_vel_xs_ys[nodes_size + i], vel_y);
+            }
+
+            // Process remainder
+            const auto attractor = world_size * 0.5f;
+            const auto one_over_max_attractor_1 = 1.0f / world_size.length();
+            const auto speed_scaler_mul_max_magnitude_mul_dt_1 = speed_scaler * MAX_MAGNITUDE * dt;
+            for (; i < end; i++) {
+                nodes_vel_xs_ys[             i] += nodes_acc_xs_ys[             i] * strength_mul_dt;
+                nodes_vel_xs_ys[nodes_size + i] += nodes_acc_xs_ys[nodes_size + i] * strength_mul_dt;
+                const float x = nodes_pos_xs_ys[             i] - attractor[0];
+                const float y = nodes_pos_xs_ys[nodes_size + i] - attractor[1];
+                const float one_over_length = 1.0f / std::sqrt(x * x + y * y);
+                const float mul = (one_over_length - one_over_max_attractor_1) * speed_scaler_mul_max_magnitude_mul_dt_1;
+                nodes_pos_xs_ys[             i] += y * mul + nodes_vel_xs_ys[             i] * dt;
+                nodes_pos_xs_ys[nodes_size + i] -= x * mul - nodes_vel_xs_ys[nodes_size + i] * dt;
+            }
+        });
+    }
+
+    // ======================== Tree construction =========================
+
+    void build_tree() noexcept {
+        compute_bounds();
+        compute_morton_keys();
+        sort_by_morton_keys();
+
+        // Bodies in Morton order, so that every tree node is a contiguous range
+        pool.parallel_for(nodes_size, 1 << 14, [&](std::size_t begin, std::size_t end, unsigned int) {
+            for (std::size_t i = begin; i < end; i++) {
+                sorted_xs[i] = nodes_pos_xs_ys[             sorted_index[i]];
+                sorted_ys[i] = nodes_pos_xs_ys[nodes_size + sorted_index[i]];
+            }
+        });
+
+        // The top levels are built serially and leave holes for the
+        // subtrees, which are then built in parallel into separate vectors
+        // and appended.
+        struct SubtreeTask {
+            unsigned int begin, end, level;
+            float size;
+            int parent, quadrant;
+            std::vector<QuadTreeNode> nodes;
+        };
+        std::vector<SubtreeTask> tasks;
+        tree.clear();
+        const auto build_top = [&](auto& self, unsigned int begin, unsigned int end, unsigned int level, float size) -> int {
+            const int index = tree.size();
+            tree.push_back(QuadTreeNode{});
+            tree[index].size = size;
+            tree[index].begin = begin;
+            tree[index].end = end;
+            if (end - begin <= leaf_size || level == morton_levels) {
+                make_leaf(tree[index]);
+                return index;
+            }
+            tree[index].is_leaf = false;
+            unsigned int child_begin = begin;
+            for (unsigned int q = 0; q < 4; q++) {
+                const unsigned int child_end = quadrant_end(child_begin, end, level, q);
+                int child = -1;
+                if (child_end > child_begin) {
+                    if (level + 1 == parallel_build_depth) {
+                        tasks.push_back(SubtreeTask{ child_begin, child_end, level + 1, 0.5f * size, index, static_cast<int>(q), {} });
+                    } else {
+                        child = self(self, child_begin, child_end, level + 1, 0.5f * size);
+                    }
+                }
+                tree[index].child[q] = child;
+                child_begin = child_end;
+            }
+            return index;
+        };
+        build_top(build_top, 0, nodes_size, 0, tree_size);
+        const unsigned int top_size = tree.size();
+
+        pool.run(tasks.size(), [&](unsigned int task_index, unsigned int) {
+            auto& task = tasks[task_index];
+            task.nodes.reserve(2 * (task.end - task.begin) / leaf_size + 1);
+            build_subtree(task.nodes, task.begin, task.end, task.level, task.size);
+        });
+
+        for (auto& task : tasks) {
+            const int offset = tree.size();
+            tree[task.parent].child[task.quadrant] = offset;
+            for (auto& node : task.nodes) {
+                for (auto& c : node.child) if (c >= 0) c += offset;
+                tree.push_back(node);
+            }
+        }
+
+        // The top nodes get their mass last, when all subtrees are done
+        for (int i = top_size - 1; i >= 0; i--) {
+            if (!tree[i].is_leaf) accumulate_mass_from_children(tree, tree[i]);
+        }
+
+        leaves.clear();
+        for (unsigned int i = 0; i < tree.size(); i++) {
+            if (tree[i].is_leaf) leaves.push_back(i);
+        }
+    }
+
+    void compute_bounds() noexcept {
+        float min_x = std::numeric_limits<float>::max();
+        float min_y = std::numeric_limits<float>::max();
+        float max_x = std::numeric_limits<float>::lowest();
+        float max_y = std::numeric_limits<float>::lowest();
+        std::vector<float> bounds(4 * pool.size);
+        for (unsigned int t = 0; t < pool.size; t++) {
+            bounds[4 * t + 0] = min_x; bounds[4 * t + 1] = min_y;
+            bounds[4 * t + 2] = max_x; bounds[4 * t + 3] = max_y;
+        }
+        pool.parallel_for(nodes_size, 1 << 15, [&](std::size_t begin, std::size_t end, unsigned int thread_index) {
+            float* b = &bounds[4 * thread_index];
+            for (std::size_t i = begin; i < end; i++) {
+                const float x = nodes_pos_xs_ys[i];
+                const float y = nodes_pos_xs_ys[nodes_size + i];
+                b[0] = std::min(b[0], x); b[1] = std::min(b[1], y);
+                b[2] = std::max(b[2], x); b[3] = std::max(b[3], y);
+            }
+        });
+        for (unsigned int t = 0; t < pool.size; t++) {
+            min_x = std::min(min_x, bounds[4 * t + 0]); min_y = std::min(min_y, bounds[4 * t + 1]);
+            max_x = std::max(max_x, bounds[4 * t + 2]); max_y = std::max(max_y, bounds[4 * t + 3]);
+        }
+        tree_origin = Vec<2>{ min_x, min_y };
+        // Square cells; slightly enlarged so that the max maps inside the grid
+        tree_size = std::max(max_x - min_x, max_y - min_y) * 1.0001f + std::numeric_limits<float>::min();
+    }
+
+    void compute_morton_keys() noexcept {
+        const float scale = 65535.0f / tree_size;
+        pool.parallel_for(nodes_size, 1 << 15, [&](std::size_t begin, std::size_t end, unsigned int) {
+            for (std::size_t i = begin; i < end; i++) {
+                const uint32_t qx = static_cast<uint32_t>((nodes_pos_xs_ys[             i] - tree_origin[0]) * scale);
+                const uint32_t qy = static_cast<uint32_t>((nodes_pos_xs_ys[nodes_size + i] - tree_origin[1]) * scale);
+                morton_keys[i] = part_1_by_1(qx) | (part_1_by_1(qy) << 1);
+                sorted_index[i] = i;
+            }
+        });
+    }
+
+    // Parallel LSD radix sort of (key, index), 8 bits per pass
+    void sort_by_morton_keys() noexcept {
+        constexpr unsigned int radix = 256;
+        const unsigned int chunks = std::min(nodes_size / 4096 + 1, 4 * pool.size);
+        const unsigned int chunk_size = (nodes_size + chunks - 1) / chunks;
+        std::vector<unsigned int> histograms(chunks * radix);
+
+        for (unsigned int shift = 0; shift < 32; shift += 8) {
+            std::fill(histograms.begin(), histograms.end(), 0);
+            pool.run(chunks, [&](unsigned int chunk, unsigned int) {
+                unsigned int* histogram = &histograms[chunk * radix];
+                const unsigned int end = std::min(nodes_size, (chunk + 1) * chunk_size);
+                for (unsigned int i = chunk * chunk_size; i < end; i++) {
+                    histogram[(morton_keys[i] >> shift) & (radix - 1)]++;
+                }
+            });
+            // Exclusive prefix over (digit, chunk), so that the sort is stable
+            unsigned int sum = 0;
+            for (unsigned int digit = 0; digit < radix; digit++) {
+                for (unsigned int chunk = 0; chunk < chunks; chunk++) {
+                    const unsigned int count = histograms[chunk * radix + digit];
+                    histograms[chunk * radix + digit] = sum;
+                    sum += count;
+                }
+            }
+            pool.run(chunks, [&](unsigned int chunk, unsigned int) {
+                unsigned int* offsets = &histograms[chunk * radix];
+                const unsigned int end = std::min(nodes_size, (chunk + 1) * chunk_size);
+                for (unsigned int i = chunk * chunk_size; i < end; i++) {
+                    const unsigned int dst = offsets[(morton_keys[i] >> shift) & (radix - 1)]++;
+                    morton_keys_tmp[dst] = morton_keys[i];
+                    sorted_index_tmp[dst] = sorted_index[i];
+                }
+            });
+            std::swap(morton_keys, morton_keys_tmp);
+            std::swap(sorted_index, sorted_index_tmp);
+        }
+    }
+
+    static unsigned int quadrant_of(uint32_t key, unsigned int level) noexcept {
+        return (key >> (2 * (morton_levels - 1 - level))) & 0b11;
+    }
+
+    // Bodies of one cell share the key prefix, so its quadrants are consecutive
+    unsigned int quadrant_end(unsigned int begin, unsigned int end, unsigned int level, unsigned int quadrant) const noexcept {
+        return std::partition_point(morton_keys + begin, morton_keys + end, [level, quadrant](uint32_t key) {
+            return quadrant_of(key, level) <= quadrant;
+        }) - morton_keys;
+    }
+
+    int build_subtree(std::vector<QuadTreeNode>& nodes, unsigned int begin, unsigned int end, unsigned int level, float size) const noexcept {
+        const int index = nodes.size();
+        nodes.push_back(QuadTreeNode{});
+        nodes[index].size = size;
+        nodes[index].begin = begin;
+        nodes[index].end = end;
+        if (end - begin <= leaf_size || level == morton_levels) {
+            make_leaf(nodes[index]);
+            return index;
+        }
+        nodes[index].is_leaf = false;
+        unsigned int child_begin = begin;
+        for (unsigned int q = 0; q < 4; q++) {
+            const unsigned int child_end = quadrant_end(child_begin, end, level, q);
+            int child = -1;
+            if (child_end > child_begin) child = build_subtree(nodes, child_begin, child_end, level + 1, 0.5f * size);
+            nodes[index].child[q] = child;
+            child_begin = child_end;
+        }
+        accumulate_mass_from_children(nodes, nodes[index]);
+        return index;
+    }
+
+    void make_leaf(QuadTreeNode& node) const noexcept {
+        node.is_leaf = true;
+        node.child[0] = node.child[1] = node.child[2] = node.child[3] = -1;
+        float sum_x = 0.0f;
+        float sum_y = 0.0f;
+        for (unsigned int i = node.begin; i < node.end; i++) {
+            sum_x += sorted_xs[i];
+            sum_y += sorted_ys[i];
+        }
+        node.mass = node.end - node.begin; // in body masses
+        node.com_x = sum_x / node.mass;
+        node.com_y = sum_y / node.mass;
+    }
+
+    static void accumulate_mass_from_children(const std::vector<QuadTreeNode>& nodes, QuadTreeNode& node) noexcept {
+        float mass = 0.0f;
+        float sum_x = 0.0f;
+        float sum_y = 0.0f;
+        for (int c : node.child) {
+            if (c < 0) continue;
+            mass  += nodes[c].mass;
+            sum_x += nodes[c].mass * nodes[c].com_x;
+            sum_y += nodes[c].mass * nodes[c].com_y;
+        }
+        node.mass = mass;
+        node.com_x = sum_x / mass;
+        node.com_y = sum_y / mass;
+    }
+
+    // ======================== Force evaluation ==========================
+    // Accelerations are in body masses / distance^2; interaction_strength / N
+    // turns them into world units / micros^2 in advect().
+
+    // Sum over the bodies [begin, end) of the sorted arrays, 8 at a time
+    static Vec<2> direct_acceleration(const float* xs, const float* ys, unsigned int begin, unsigned int end, float px, float py) noexcept {
+        const __m256 px8 = _mm256_set1_ps(px);
+        const __m256 py8 = _mm256_set1_ps(py);
+        const __m256 softening8 = _mm256_set1_ps(softening_sqr);
+        __m256 ax8 = _mm256_setzero_ps();
+        __m256 ay8 = _mm256_setzero_ps();
+        unsigned int j = begin;
+        for (; j + 7 < end; j += 8) {
+            const __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(&xs[j]), px8);
+            const __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(&ys[j]), py8);
+            const __m256 r2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), softening8);
+            const __m256 inv = _mm256_rsqrt_ps(r2);
+            const __m256 inv3 = _mm256_mul_ps(inv, _mm256_mul_ps(inv, inv));
+            ax8 = _mm256_add_ps(ax8, _mm256_mul_ps(dx, inv3));
+            ay8 = _mm256_add_ps(ay8, _mm256_mul_ps(dy, inv3));
+        }
+        float ax = horizontal_sum(ax8);
+        float ay = horizontal_sum(ay8);
+        for (; j < end; j++) {
+            const float dx = xs[j] - px;
+            const float dy = ys[j] - py;
+            const float inv = 1.0f / std::sqrt(dx * dx + dy * dy + softening_sqr);
+            const float inv3 = inv * inv * inv;
+            ax += dx * inv3;
+            ay += dy * inv3;
+        }
+        return Vec<2>{ ax, ay };
+    }
+
+    // Sum over a list of point masses, 8 at a time
+    static Vec<2> list_acceleration(const InteractionList& list, float px, float py) noexcept {
+        const __m256 px8 = _mm256_set1_ps(px);
+        const __m256 py8 = _mm256_set1_ps(py);
+        const __m256 softening8 = _mm256_set1_ps(softening_sqr);
+        __m256 ax8 = _mm256_setzero_ps();
+        __m256 ay8 = _mm256_setzero_ps();
+        const unsigned int count = list.xs.size();
+        unsigned int j = 0;
+        for (; j + 7 < count; j += 8) {
+            const __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(&list.xs[j]), px8);
+            const __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(&list.ys[j]), py8);
+            const __m256 r2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), softening8);
+            const __m256 inv = _mm256_rsqrt_ps(r2);
+            const __m256 m_inv3 = _mm256_mul_ps(_mm256_loadu_ps(&list.masses[j]), _mm256_mul_ps(inv, _mm256_mul_ps(inv, inv)));
+            ax8 = _mm256_add_ps(ax8, _mm256_mul_ps(dx, m_inv3));
+            ay8 = _mm256_add_ps(ay8, _mm256_mul_ps(dy, m_inv3));
+        }
+        float ax = horizontal_sum(ax8);
+        float ay = horizontal_sum(ay8);
+        for (; j < count; j++) {
+            const float dx = list.xs[j] - px;
+            const float dy = list.ys[j] - py;
+            const float inv = 1.0f / std::sqrt(dx * dx + dy * dy + softening_sqr);
+            const float m_inv3 = list.masses[j] * inv * inv * inv;
+            ax += dx * m_inv3;
+            ay += dy * m_inv3;
+        }
+        return Vec<2>{ ax, ay };
+    }
+
+    // One tree walk for all bodies of a leaf: a cell is accepted as a point
+    // mass only if it passes the opening angle test against the closest point
+    // of the leaf's bounding box, so it would pass for every body of the leaf.
+    // Cells that must be opened down to a leaf contribute their bodies.
+    void collect_interactions(const QuadTreeNode& group, InteractionList& list) const noexcept {
+        constexpr float theta_sqr = theta * theta;
+        list.clear();
+
+        float min_x = std::numeric_limits<float>::max();
+        float min_y = std::numeric_limits<float>::max();
+        float max_x = std::numeric_limits<float>::lowest();
+        float max_y = std::numeric_limits<float>::lowest();
+        for (unsigned int i = group.begin; i < group.end; i++) {
+            min_x = std::min(min_x, sorted_xs[i]); max_x = std::max(max_x, sorted_xs[i]);
+            min_y = std::min(min_y, sorted_ys[i]); max_y = std::max(max_y, sorted_ys[i]);
+        }
+
+        int stack[4 * (morton_levels + 1)];
+        unsigned int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const auto& node = tree[stack[--top]];
+            const float dx = std::max({ 0.0f, min_x - node.com_x, node.com_x - max_x });
+            const float dy = std::max({ 0.0f, min_y - node.com_y, node.com_y - max_y });
+            if (node.size * node.size < theta_sqr * (dx * dx + dy * dy)) {
+                list.add(node.com_x, node.com_y, node.mass);
+            } else if (node.is_leaf) {
+                for (unsigned int i = node.begin; i < node.end; i++) list.add(sorted_xs[i], sorted_ys[i], 1.0f);
+            } else {
+                for (int c : node.child) if (c >= 0) stack[top++] = c;
+            }
+        }
+    }
+
+    void compute_accelerations_barnes_hut() noexcept {
+        pool.run(leaves.size(), [&](unsigned int leaf_index, unsigned int thread_index) {
+            const auto& leaf = tree[leaves[leaf_index]];
+            auto& list = interaction_lists[thread_index];
+            collect_interactions(leaf, list);
+            for (unsigned int s = leaf.begin; s < leaf.end; s++) {
+                const auto a = list_acceleration(list, sorted_xs[s], sorted_ys[s]);
+                nodes_acc_xs_ys[             sorted_index[s]] = a[0];
+                nodes_acc_xs_ys[nodes_size + sorted_index[s]] = a[1];
+            }
+        });
+    }
+
+    void compute_accelerations_direct() noexcept {
+        const float* xs = nodes_pos_xs_ys;
+        const float* ys = nodes_pos_xs_ys + nodes_size;
+        pool.parallel_for(nodes_size, 256, [&](std::size_t begin, std::size_t end, unsigned int) {
+            for (std::size_t i = begin; i < end; i++) {
+                const auto a = direct_acceleration(xs, ys, 0, nodes_size, xs[i], ys[i]);
+                nodes_acc_xs_ys[             i] = a[0];
+                nodes_acc_xs_ys[nodes_size + i] = a[1];
+            }
+        });
+    }
+
+    // Compares the last Barnes-Hut accelerations of a sample of bodies with
+    // the direct sum, and extrapolates the direct sum cost to all bodies.
+    void report_accuracy(float barnes_hut_forces_time) noexcept {
+        constexpr unsigned int sample_size = 256;
+        const unsigned int step = nodes_size / sample_size;
+        float relative_errors[sample_size];
+
+        const auto t0 = get_time_micros();
+        pool.run(sample_size, [&](unsigned int k, unsigned int) {
+            // The tree was built from the positions before advect(), which are still in sorted_xs/ys
+            const unsigned int s = k * step;
+            const auto exact = direct_acceleration(sorted_xs, sorted_ys, 0, nodes_size, sorted_xs[s], sorted_ys[s]);
+            const auto approx = Vec<2>{ nodes_acc_xs_ys[sorted_index[s]], nodes_acc_xs_ys[nodes_size + sorted_index[s]] };
+            relative_errors[k] = (approx - exact).length() / std::max(exact.length(), std::numeric_limits<float>::min());
+        });
+        const auto direct_time = (get_time_micros() - t0) * (static_cast<float>(nodes_size) / sample_size);
+
+        float sum = 0.0f;
+        float max = 0.0f;
+        for (float e : relative_errors) {
+            sum += e;
+            max = std::max(max, e);
+        }
+        std::cout
+            << "Barnes-Hut (theta = " << theta << ", " << tree.size() << " tree nodes) vs direct sum on " << sample_size << " bodies: "
+            << "mean relative error = " << (sum / sample_size) << "  "
+            << "max relative error = " << max << "  "
+            << "forces time = " << barnes_hut_forces_time << " vs ~" << direct_time << " micros for the direct sum\n";
+    }
+
+    float* allocate_and_init_all_nodes_data() const noexcept {
+        const auto count = nodes_size * node_vertex_components;
+        float* nodes_data = new float[count];
+        unsigned int i = 0;
+
+        for (; i < 2 * nodes_size; i++) { // xy
+            nodes_data[i] = nodes_pos_xs_ys[i];
+        }
+
+        for (unsigned int j = 0; j < nodes_size; j++, i += 3) { // color3
+            nodes_data[i + 0] = nodes_color[j][0];
+            nodes_data[i + 1] = nodes_color[j][1];
+            nodes_data[i + 2] = nodes_color[j][2];
+        }
+
+        return nodes_data;
+    }
+
+    void resubmit_nodes_vertices_pos() const noexcept {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes);
+        const auto count = nodes_size * 2;
+        const auto actual_size_bytes = count * sizeof(float);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, actual_size_bytes, nodes_pos_xs_ys);
+    }
+
+    void set_mvp(const Matrix4f& mvp) noexcept {
+        shader_node.bind();
+        shader_node.setUniformMat4f("u_mvp", mvp);
+    }
+
+    void set_size(const Vec<2>& size) noexcept {
+        world_size = size;
+    }
+
+    void flip_physics() noexcept {
+        physics_on = !physics_on;
+    }
+};
+
+#endif
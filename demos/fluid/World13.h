@@ -0,0 +1,485 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include "Shader.h"
+#include "Texture.h"
+#include "Vec.h"
+#include "util.h"
+
+#include <cmath>
+#include <algorithm>
+#include <optional>
+#include <random>
+#include <limits>
+
+#include <immintrin.h>
+
+#include <GLFW/glfw3.h>
+
+
+// float, double, long double
+// [low, high)
+template<typename T = float>
+T getRandomUniformFloat(T low, T high) {
+    static std::random_device rd;
+    static std::seed_seq seed{1, 2, 3, 300};
+    static std::mt19937 e2(seed);
+    // static std::mt19937 e2(rd());
+    std::uniform_real_distribution<T> dist(low, high);
+
+    return dist(e2);
+}
+
+
+// NOTE The rendered node size is actually set with point size
+static constexpr float NODE_SIZE = 0.2f;
+
+
+struct World {
+    bool physics_on = true;
+
+    Vec<2> world_size;
+
+    unsigned int nodes_size;
+
+    // Nodes [0, split) are advected on the CPU (as in World7),
+    // nodes [split, nodes_size) in the vertex shader (as in World8)
+    unsigned int split;
+
+    // Has room for all nodes, but only [0, split) is up to date
+    float* nodes_pos_xs_ys;
+    Vec<3>* nodes_color;
+
+    // CPU part: xs, ys, colors
+    unsigned int vao_cpu_nodes;
+    unsigned int vbo_cpu_nodes;
+
+    // GPU part: interleaved, ping-pong through transform feedback
+    unsigned int vao_nodes[2];
+    unsigned int vbo_nodes[2];
+    unsigned int tfo_nodes[2];
+    unsigned int swap_index = 0;
+
+    static constexpr unsigned int node_vertex_components = 2 + 3; // x,y + color3
+
+    static constexpr float speed_scaler = 5.0f * 0.0000025f;
+    static constexpr float MAX_MAGNITUDE = 2.0f;
+
+    static constexpr const char* const transform_variables[] = { "DataBlock.new_pos", "DataBlock.color" };
+    Shader shader_node = Shader("node_sep_calc.vert", "node_point.frag", transform_variables, 2);
+    Shader shader_cpu_node{"node_point_sep.vert", "node_point.frag"};
+
+    // GPU times are read a few frames late, so that asking never stalls
+    static constexpr unsigned int query_ring_size = 4;
+    unsigned int queries_gpu_part[query_ring_size];
+    unsigned int queries_cpu_part_draw[query_ring_size];
+    unsigned int query_split[query_ring_size];
+    bool query_issued[query_ring_size] = {};
+    unsigned int query_index = 0;
+
+    // Smoothed costs per node, in micros
+    float cpu_cost = 0.0f;       // advect and upload
+    float gpu_cost = 0.0f;       // advect and draw with transform feedback
+    float cpu_draw_cost = 0.0f;  // draw of a node advected on the CPU
+    unsigned int frames_since_rebalance = 0;
+    static constexpr unsigned int rebalance_interval_frames = 30;
+    static constexpr float cost_smoothing = 0.1f;
+
+
+    World(const Vec<2>& world_size) : world_size(world_size) {
+        prepare_nodes(4 * 500000);
+        glPointSize(0.1f);
+    }
+
+    ~World() {
+        ::operator delete[] (nodes_pos_xs_ys, std::align_val_t(32));
+        delete[] nodes_color;
+        glDeleteQueries(query_ring_size, queries_gpu_part);
+        glDeleteQueries(query_ring_size, queries_cpu_part_draw);
+        glDeleteTransformFeedbacks(2, tfo_nodes);
+        glDeleteBuffers(2, vbo_nodes);
+        glDeleteVertexArrays(2, vao_nodes);
+        glDeleteBuffers(1, &vbo_cpu_nodes);
+        glDeleteVertexArrays(1, &vao_cpu_nodes);
+    }
+
+    void prepare_nodes(unsigned int count) noexcept {
+        nodes_size = count;
+        nodes_pos_xs_ys = new (std::align_val_t(32)) float[2 * count];
+        nodes_color = new Vec<3>[count];
+
+        const auto border = 10.5f * NODE_SIZE;
+        for (unsigned int i = 0; i < count; i++) {
+            const auto x = getRandomUniformFloat(border, world_size[0] - border);
+            const auto y = getRandomUniformFloat(border, world_size[1] - border);
+            const auto color = Vec<3>{ x / world_size[0], y / world_size[1], 0.7f };
+            nodes_pos_xs_ys[i]         = x;
+            nodes_pos_xs_ys[count + i] = y;
+            nodes_color[i] = color;
+        }
+
+        // Start from an even split and let the measurements move it
+        split = clamp_split(nodes_size / 2);
+
+        glGenVertexArrays(1, &vao_cpu_nodes);
+        glBindVertexArray(vao_cpu_nodes);
+        {
+            glGenBuffers(1, &vbo_cpu_nodes);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_cpu_nodes);
+            const unsigned int size_bytes = nodes_size * node_vertex_components * sizeof(float);
+            const float* nodes_data = allocate_and_init_cpu_nodes_data();
+            // Room for all nodes, so that moving the split never reallocates
+            glBufferData(GL_ARRAY_BUFFER, size_bytes, nodes_data, GL_DYNAMIC_DRAW);
+            delete[] nodes_data;
+
+            specify_attribs_for_cpu_nodes(); // proper GL_ARRAY_BUFFER must be bound!
+        }
+
+        for (unsigned int i = 0; i < 2; i++) {
+            glGenVertexArrays(1, &vao_nodes[i]);
+            glBindVertexArray(vao_nodes[i]);
+            {
+                glGenBuffers(1, &vbo_nodes[i]);
+                glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes[i]);
+                const unsigned int size_bytes = nodes_size * node_vertex_components * sizeof(float);
+                if (i == 0) {
+                    const float* nodes_data = allocate_and_init_all_nodes_data();
+                    glBufferData(GL_ARRAY_BUFFER, size_bytes, nodes_data, GL_DYNAMIC_COPY);
+                    delete[] nodes_data;
+                } else {
+                    // Just allocate, do not initialize
+                    glBufferData(GL_ARRAY_BUFFER, size_bytes, nullptr, GL_DYNAMIC_COPY);
+                }
+
+                specify_attribs_for_nodes(); // proper GL_ARRAY_BUFFER must be bound!
+            }
+        }
+
+        glBindVertexArray(0);
+
+        glGenTransformFeedbacks(2, tfo_nodes);
+        bind_transform_feedback_ranges();
+
+        glGenQueries(query_ring_size, queries_gpu_part);
+        glGenQueries(query_ring_size, queries_cpu_part_draw);
+
+        shader_node.bind();
+        set_field_uniforms();
+    }
+
+    void specify_attribs_for_nodes() const noexcept {
+        {
+            const auto index = 0;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 2; // xy
+            const auto stride_bytes = 5 * sizeof(float);
+            const auto offset_bytes = 0;
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+        {
+            const auto index = 1;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 3; // color3
+            const auto stride_bytes = 5 * sizeof(float);
+            const auto offset_bytes = 2 * sizeof(float); // skip all xy
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+    }
+
+    void specify_attribs_for_cpu_nodes() const noexcept {
+        {
+            const auto index = 0;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 1; // x
+            const auto stride_bytes = 0;
+            const auto offset_bytes = 0;
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+        {
+            const auto index = 1;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 1; // y
+            const auto stride_bytes = 0;
+            const auto offset_bytes = nodes_size * sizeof(float); // skip xs
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+        {
+            const auto index = 2;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 3; // color3
+            const auto stride_bytes = 0;
+            const auto offset_bytes = 2 * nodes_size * sizeof(float); // skip xs and ys
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+    }
+
+    // The GPU part is written at its own place in the buffers, so that the
+    // split can move without the GPU nodes having to
+    void bind_transform_feedback_ranges() const noexcept {
+        const unsigned int stride_bytes = node_vertex_components * sizeof(float);
+        for (unsigned int i = 0; i < 2; i++) {
+            glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tfo_nodes[i]);
+            glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, vbo_nodes[i], split * stride_bytes, (nodes_size - split) * stride_bytes);
+        }
+        glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+    }
+
+    void update_and_render(float dt, const Vec<2>& cursor) noexcept {
+        static auto last = get_time_micros();
+        const auto p0 = get_time_micros();
+        if (physics_on) do_physics(dt, cursor);
+        const auto p1 = get_time_micros();
+        resubmit_nodes_vertices_pos();
+        const auto p2 = get_time_micros();
+        render_nodes();
+        const auto p3 = get_time_micros();
+        collect_gpu_times();
+        if (physics_on && split > 0) {
+            const float micros_per_node = static_cast<float>(p2 - p0) / split;
+            cpu_cost = (cpu_cost == 0.0f) ? micros_per_node : blend_unchecked(cpu_cost, micros_per_node, cost_smoothing);
+        }
+        if (++frames_since_rebalance >= rebalance_interval_frames) {
+            frames_since_rebalance = 0;
+            rebalance();
+        }
+        const auto frame_time = p3 - last;
+        const auto fps = 1'000'000.0f / frame_time;
+        std::cout
+            << "Idle = " << std::setw(5) << (p0 - last) << "  "
+            << "Physics = " << std::setw(5) << (p1 - p0) << "  "
+            << "Resubmit = " << std::setw(5) << (p2 - p1) << "  "
+            << "Render = " << std::setw(5) << (p3 - p2) << "  "
+            << "Frame time = " << std::setw(5) << frame_time << "  "
+            << "FPS = " << std::setw(5) << fps << "  "
+            << "CPU share = " << std::setw(5) << (100.0f * split / nodes_size) << "%\n";
+        last = p3;
+    }
+
+    void render_nodes() noexcept {
+        const auto query = query_index % query_ring_size;
+
+        shader_cpu_node.bind();
+        glBindVertexArray(vao_cpu_nodes);
+        glBeginQuery(GL_TIME_ELAPSED, queries_cpu_part_draw[query]);
+        glDrawArrays(GL_POINTS, 0, split);
+        glEndQuery(GL_TIME_ELAPSED);
+
+        shader_node.bind();
+        glBindVertexArray(vao_nodes[swap_index]);
+        // Transform feedback goes into the other VBO, at the same offset
+        glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tfo_nodes[1 - swap_index]);
+        glBeginQuery(GL_TIME_ELAPSED, queries_gpu_part[query]);
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, split, nodes_size - split);
+        glEndTransformFeedback();
+        glEndQuery(GL_TIME_ELAPSED);
+        glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+
+        query_split[query] = split;
+        query_issued[query] = true;
+        query_index++;
+
+        glFlush();
+        swap_index = 1 - swap_index;
+    }
+
+    // Takes the results of the oldest queries, if they are there already
+    void collect_gpu_times() noexcept {
+        const auto query = query_index % query_ring_size;
+        if (!query_issued[query]) return;
+        int available = 0;
+        glGetQueryObjectiv(queries_gpu_part[query], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) return;
+        glGetQueryObjectiv(queries_cpu_part_draw[query], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) return;
+        query_issued[query] = false;
+
+        GLuint64 gpu_part_nanos = 0;
+        GLuint64 cpu_part_draw_nanos = 0;
+        glGetQueryObjectui64v(queries_gpu_part[query], GL_QUERY_RESULT, &gpu_part_nanos);
+        glGetQueryObjectui64v(queries_cpu_part_draw[query], GL_QUERY_RESULT, &cpu_part_draw_nanos);
+        const unsigned int measured_split = query_split[query];
+        if (measured_split < nodes_size) {
+            const float micros_per_node = gpu_part_nanos / 1000.0f / (nodes_size - measured_split);
+            gpu_cost = (gpu_cost == 0.0f) ? micros_per_node : blend_unchecked(gpu_cost, micros_per_node, cost_smoothing);
+        }
+        if (measured_split > 0) {
+            const float micros_per_node = cpu_part_draw_nanos / 1000.0f / measured_split;
+            cpu_draw_cost = (cpu_draw_cost == 0.0f) ? micros_per_node : blend_unchecked(cpu_draw_cost, micros_per_node, cost_smoothing);
+        }
+    }
+
+    // The GPU works on frame n while the CPU works on frame n + 1, so the
+    // frame takes as long as the slower of the two:
+    //     CPU: cpu_cost * split
+    //     GPU: cpu_draw_cost * split + gpu_cost * (nodes_size - split)
+    // and is shortest where they are equal.
+    void rebalance() noexcept {
+        if (cpu_cost == 0.0f || gpu_cost == 0.0f) return; // not measured yet
+        const float cpu_advantage = cpu_cost - cpu_draw_cost + gpu_cost;
+        const float best = (cpu_advantage > 0.0f) ? gpu_cost * nodes_size / cpu_advantage : nodes_size;
+        const unsigned int target = clamp_split(static_cast<unsigned int>(std::min(best, static_cast<float>(nodes_size))));
+        // Moving nodes has a cost of its own, so not for the noise
+        const unsigned int hysteresis = nodes_size / 128;
+        if (std::max(target, split) - std::min(target, split) <= hysteresis) return;
+        // Small steps: the costs per node are only linear near the measured point
+        const unsigned int max_step = nodes_size / 8;
+        const unsigned int new_split = (target > split)
+            ? clamp_split(std::min(target, split + max_step))
+            : clamp_split(split - std::min(split - target, max_step));
+        move_split(new_split);
+        std::cout
+            << "Rebalanced: CPU = " << (1000.0f * cpu_cost) << " ns/node  "
+            << "GPU = " << (1000.0f * gpu_cost) << " ns/node  "
+            << "draw of CPU part = " << (1000.0f * cpu_draw_cost) << " ns/node  "
+            << "CPU share = " << (100.0f * split / nodes_size) << "%\n";
+    }
+
+    // Each side keeps a share, so that its cost per node stays measured.
+    // A multiple of 8 keeps the CPU part whole for the AVX loop.
+    unsigned int clamp_split(unsigned int s) const noexcept {
+        const unsigned int min_share = nodes_size / 64;
+        s = std::clamp(s, min_share, nodes_size - min_share);
+        return s & ~0b111u;
+    }
+
+    // Moves the nodes between the sides. Blocks when the GPU gives nodes
+    // away, but that happens once in a while at most.
+    void move_split(unsigned int new_split) noexcept {
+        if (new_split == split) return;
+        const unsigned int stride_bytes = node_vertex_components * sizeof(float);
+        const unsigned int begin = std::min(split, new_split);
+        const unsigned int end = std::max(split, new_split);
+        float* moved = new float[(end - begin) * node_vertex_components];
+        // After a render vbo_nodes[swap_index] has the latest GPU part
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes[swap_index]);
+        if (new_split > split) {
+            glGetBufferSubData(GL_ARRAY_BUFFER, begin * stride_bytes, (end - begin) * stride_bytes, moved);
+            for (unsigned int i = begin; i < end; i++) {
+                nodes_pos_xs_ys[             i] = moved[(i - begin) * node_vertex_components + 0];
+                nodes_pos_xs_ys[nodes_size + i] = moved[(i - begin) * node_vertex_components + 1];
+            }
+        } else {
+            for (unsigned int i = begin; i < end; i++) {
+                moved[(i - begin) * node_vertex_components + 0] = nodes_pos_xs_ys[             i];
+                moved[(i - begin) * node_vertex_components + 1] = nodes_pos_xs_ys[nodes_size + i];
+                moved[(i - begin) * node_vertex_components + 2] = nodes_color[i][0];
+                moved[(i - begin) * node_vertex_components + 3] = nodes_color[i][1];
+                moved[(i - begin) * node_vertex_components + 4] = nodes_color[i][2];
+            }
+            glBufferSubData(GL_ARRAY_BUFFER, begin * stride_bytes, (end - begin) * stride_bytes, moved);
+        }
+        delete[] moved;
+        split = new_split;
+        bind_transform_feedback_ranges();
+    }
+
+    float blend_unchecked(float x, float y, float t) const noexcept {
+        return x * (1.0f - t) + y * t;
+    }
+
+    void do_physics(float dt, const Vec<2>& cursor) noexcept {
+        shader_node.bind();
+        shader_node.setUniform1f("speed_scaler_mul_max_magnitude_mul_dt", speed_scaler * MAX_MAGNITUDE * dt);
+
+        // split is a multiple of 8, so there is no remainder
+        const __m256 attr_x                                = _mm256_set1_ps((world_size * 0.5f)[0]);
+        const __m256 attr_y                                = _mm256_set1_ps((world_size * 0.5f)[1]);
+        const __m256 one_over_max_attractor                = _mm256_set1_ps(1.0f / world_size.length());
+        const __m256 speed_scaler_mul_max_magnitude_mul_dt = _mm256_set1_ps(speed_scaler * MAX_MAGNITUDE * dt);
+        for (unsigned int i = 0; i < split; i += 8) {
+            __m256 pos_x = _mm256_load_ps(&nodes_pos_xs_ys[i]);
+            const __m256 x = _mm256_sub_ps(pos_x, attr_x);
+            const __m256 xx = _mm256_mul_ps(x, x);
+
+            __m256 pos_y = _mm256_load_ps(&nodes_pos_xs_ys[nodes_size + i]);
+            const __m256 y = _mm256_sub_ps(pos_y, attr_y);
+            const __m256 yy = _mm256_mul_ps(y, y);
+
+            const __m256 xx_plus_yy = _mm256_add_ps(xx, yy);
+            const __m256 one_over_length = _mm256_rsqrt_ps(xx_plus_yy);
+
+            const __m256 mul = _mm256_mul_ps(_mm256_sub_ps(one_over_length, one_over_max_attractor), speed_scaler_mul_max_magnitude_mul_dt);
+
+            pos_x = _mm256_add_ps(pos_x, _mm256_mul_ps(y, mul));
+            pos_y = _mm256_sub_ps(pos_y, _mm256_mul_ps(x, mul));
+
+            _mm256_store_ps(&nodes_pos_xs_ys[             i], pos_x);
+            _mm256_store_ps(&nodes_pos_xs_ys[nodes_size + i], pos_y);
+        }
+    }
+
+    // Interleaved, for the GPU part
+    float* allocate_and_init_all_nodes_data() const noexcept {
+        const auto count = nodes_size * node_vertex_components;
+        float* nodes_data = new float[count];
+        unsigned int i = 0;
+
+        for (unsigned int j = 0; j < nodes_size; j++, i += 5) {
+            nodes_data[i + 0] = nodes_pos_xs_ys[j];
+            nodes_data[i + 1] = nodes_pos_xs_ys[nodes_size + j];
+            nodes_data[i + 2] = nodes_color[j][0];
+            nodes_data[i + 3] = nodes_color[j][1];
+            nodes_data[i + 4] = nodes_color[j][2];
+        }
+
+        return nodes_data;
+    }
+
+    // xs, ys, colors, for the CPU part
+    float* allocate_and_init_cpu_nodes_data() const noexcept {
+        const auto count = nodes_size * node_vertex_components;
+        float* nodes_data = new float[count];
+        unsigned int i = 0;
+
+        for (; i < 2 * nodes_size; i++) { // xy
+            nodes_data[i] = nodes_pos_xs_ys[i];
+        }
+
+        for (unsigned int j = 0; j < nodes_size; j++, i += 3) { // color3
+            nodes_data[i + 0] = nodes_color[j][0];
+            nodes_data[i + 1] = nodes_color[j][1];
+            nodes_data[i + 2] = nodes_color[j][2];
+        }
+
+        return nodes_data;
+    }
+
+    void resubmit_nodes_vertices_pos() const noexcept {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_cpu_nodes);
+        const auto actual_size_bytes = split * sizeof(float);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, actual_size_bytes, nodes_pos_xs_ys);
+        glBufferSubData(GL_ARRAY_BUFFER, nodes_size * sizeof(float), actual_size_bytes, nodes_pos_xs_ys + nodes_size);
+    }
+
+    void set_field_uniforms() noexcept {
+        const auto attractor = world_size * 0.5f;
+        const auto one_over_max_attractor = 1.0f / world_size.length();
+        shader_node.setUniform1f("one_over_max_attractor", one_over_max_attractor);
+        shader_node.setUniform2f("attractor", attractor[0], attractor[1]);
+    }
+
+    void set_mvp(const Matrix4f& mvp) noexcept {
+        shader_cpu_node.bind();
+        shader_cpu_node.setUniformMat4f("u_mvp", mvp);
+        shader_node.bind();
+        shader_node.setUniformMat4f("u_mvp", mvp);
+    }
+
+    void set_size(const Vec<2>& size) noexcept {
+        world_size = size;
+        shader_node.bind();
+        set_field_uniforms();
+    }
+
+    void flip_physics() noexcept {
+        physics_on = !physics_on;
+        // Otherwise the GPU part would go on with the last dt
+        if (!physics_on) {
+            shader_node.bind();
+            shader_node.setUniform1f("speed_scaler_mul_max_magnitude_mul_dt", 0.0f);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,311 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include "Shader.h"
+#include "Texture.h"
+#include "Vec.h"
+#include "ThreadPool.h"
+#include "util.h"
+
+#include <cmath>
+#include <algorithm>
+#include <optional>
+#include <random>
+#include <limits>
+#include <vector>
+#include <string>
+
+#include <immintrin.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <GLFW/glfw3.h>
+
+
+// float, double, long double
+// [low, high)
+template<typename T = float>
+T getRandomUniformFloat(T low, T high) {
+    static std::random_device rd;
+    static std::seed_seq seed{1, 2, 3, 300};
+    static std::mt19937 e2(seed);
+    // static std::mt19937 e2(rd());
+    std::uniform_real_distribution<T> dist(low, high);
+
+    return dist(e2);
+}
+
+
+// NOTE The rendered node size is actually set with point size
+static constexpr float NODE_SIZE = 0.2f;
+
+
+// Positions of all the chunks in one file mapped into memory, so that the
+// kernel pages out whatever does not fit into RAM.
+struct MappedNodes {
+    int file = -1;
+    float* data = nullptr;
+    std::size_t size_bytes = 0;
+
+    MappedNodes(const std::string& filepath, std::size_t size_bytes) noexcept : size_bytes(size_bytes) {
+        file = open(filepath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (file < 0 || ftruncate(file, size_bytes) != 0) {
+            std::cout << ":> MappedNodes: failed to create " << filepath << '\n';
+            return;
+        }
+        void* mapped = mmap(nullptr, size_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+        if (mapped == MAP_FAILED) {
+            std::cout << ":> MappedNodes: failed to map " << filepath << '\n';
+            return;
+        }
+        data = static_cast<float*>(mapped);
+    }
+
+    ~MappedNodes() {
+        if (data) munmap(data, size_bytes);
+        if (file >= 0) close(file);
+    }
+};
+
+
+struct World {
+    bool physics_on = true;
+
+    Vec<2> world_size;
+
+    // May go past 32 bits; all sizes in bytes are std::size_t
+    std::size_t nodes_size;
+
+    // A chunk is small enough for 32-bit counts and offsets and for any
+    // per-buffer limit, and is processed and drawn on its own.
+    static constexpr unsigned int chunk_capacity = 1 << 20;
+
+    struct Chunk {
+        unsigned int count;
+        float* pos_xs_ys; // xs, then ys; aligned to 32
+        unsigned int vao;
+        unsigned int vbo;
+    };
+    std::vector<Chunk> chunks;
+
+    // Empty: the positions live on the heap. Otherwise they live in this file.
+    static constexpr const char* backing_filepath = "";
+    std::optional<MappedNodes> mapped_nodes;
+
+    static constexpr unsigned int node_vertex_components = 2 + 3; // x,y + color3
+
+    static constexpr float speed_scaler = 5.0f * 0.0000025f;
+    static constexpr float MAX_MAGNITUDE = 2.0f;
+
+    Shader shader_node{"node_point_sep.vert", "node_point.frag"};
+
+    ThreadPool pool;
+
+
+    World(const Vec<2>& world_size) : world_size(world_size) {
+        prepare_nodes(4 * 500000);
+        glPointSize(0.1f);
+    }
+
+    ~World() {
+        for (auto& chunk : chunks) {
+            if (!mapped_nodes) ::operator delete[] (chunk.pos_xs_ys, std::align_val_t(32));
+            glDeleteBuffers(1, &chunk.vbo);
+            glDeleteVertexArrays(1, &chunk.vao);
+        }
+    }
+
+    void prepare_nodes(std::size_t count) noexcept {
+        nodes_size = count;
+        const std::size_t chunks_count = (count + chunk_capacity - 1) / chunk_capacity;
+        if (backing_filepath[0] != '\0') {
+            mapped_nodes.emplace(backing_filepath, chunks_count * chunk_capacity * 2 * sizeof(float));
+            if (!mapped_nodes->data) mapped_nodes.reset();
+        }
+
+        chunks.resize(chunks_count);
+        for (std::size_t c = 0; c < chunks_count; c++) {
+            auto& chunk = chunks[c];
+            chunk.count = static_cast<unsigned int>(std::min<std::size_t>(chunk_capacity, count - c * chunk_capacity));
+            // The mapping is page aligned and chunk_capacity is a multiple of 8
+            chunk.pos_xs_ys = mapped_nodes
+                ? mapped_nodes->data + c * chunk_capacity * 2
+                : new (std::align_val_t(32)) float[2 * chunk.count];
+            prepare_chunk(chunk);
+        }
+
+        glBindVertexArray(0);
+        shader_node.bind();
+        std::cout << "Nodes: " << nodes_size << " in " << chunks.size() << " chunks of " << chunk_capacity
+            << (mapped_nodes ? ", positions mapped from a file" : "") << '\n';
+    }
+
+    void prepare_chunk(Chunk& chunk) noexcept {
+        // Uploaded chunk by chunk, so the staging memory is bounded by the chunk
+        float* nodes_data = new float[chunk.count * node_vertex_components];
+        float* colors = nodes_data + 2 * chunk.count;
+        const auto border = 10.5f * NODE_SIZE;
+        for (unsigned int i = 0; i < chunk.count; i++) {
+            const auto x = getRandomUniformFloat(border, world_size[0] - border);
+            const auto y = getRandomUniformFloat(border, world_size[1] - border);
+            chunk.pos_xs_ys[              i] = x;
+            chunk.pos_xs_ys[chunk.count + i] = y;
+            colors[3 * i + 0] = x / world_size[0];
+            colors[3 * i + 1] = y / world_size[1];
+            colors[3 * i + 2] = 0.7f;
+        }
+        std::copy(chunk.pos_xs_ys, chunk.pos_xs_ys + 2 * chunk.count, nodes_data);
+
+        glGenVertexArrays(1, &chunk.vao);
+        glBindVertexArray(chunk.vao);
+        {
+            glGenBuffers(1, &chunk.vbo);
+            glBindBuffer(GL_ARRAY_BUFFER, chunk.vbo);
+            const std::size_t size_bytes = static_cast<std::size_t>(chunk.count) * node_vertex_components * sizeof(float);
+            glBufferData(GL_ARRAY_BUFFER, size_bytes, nodes_data, GL_DYNAMIC_DRAW);
+
+            specify_attribs_for_nodes(chunk.count); // proper GL_ARRAY_BUFFER must be bound!
+        }
+        delete[] nodes_data;
+    }
+
+    void specify_attribs_for_nodes(unsigned int count) const noexcept {
+        {
+            const auto index = 0;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 1; // x
+            const auto stride_bytes = 0;
+            const std::size_t offset_bytes = 0;
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+        {
+            const auto index = 1;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 1; // y
+            const auto stride_bytes = 0;
+            const std::size_t offset_bytes = count * sizeof(float); // skip xs
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+        {
+            const auto index = 2;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 3; // color3
+            const auto stride_bytes = 0;
+            const std::size_t offset_bytes = 2 * count * sizeof(float); // skip xs and ys
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+    }
+
+    void update_and_render(float dt, const Vec<2>& cursor) noexcept {
+        static auto last = get_time_micros();
+        const auto p0 = get_time_micros();
+        if (physics_on) do_physics(dt, cursor);
+        const auto p1 = get_time_micros();
+        resubmit_nodes_vertices_pos();
+        const auto p2 = get_time_micros();
+        render_nodes();
+        const auto p3 = get_time_micros();
+        const auto frame_time = p3 - last;
+        const auto fps = 1'000'000.0f / frame_time;
+        std::cout
+            << "Idle = " << std::setw(5) << (p0 - last) << "  "
+            << "Physics = " << std::setw(5) << (p1 - p0) << "  "
+            << "Resubmit = " << std::setw(5) << (p2 - p1) << "  "
+            << "Render = " << std::setw(5) << (p3 - p2) << "  "
+            << "Frame time = " << std::setw(5) << frame_time << "  "
+            << "FPS = " << std::setw(5) << fps << '\n';
+        last = p3;
+    }
+
+    void render_nodes() const noexcept {
+        for (const auto& chunk : chunks) {
+            glBindVertexArray(chunk.vao);
+            glDrawArrays(GL_POINTS, 0, chunk.count);
+        }
+        glBindVertexArray(0);
+    }
+
+    // The chunks are independent, so they are also the tasks of the pool
+    void do_physics(float dt, const Vec<2>& cursor) noexcept {
+        pool.run(chunks.size(), [&](unsigned int chunk_index, unsigned int) {
+            advect_chunk(chunks[chunk_index], dt);
+        });
+    }
+
+    void advect_chunk(Chunk& chunk, float dt) const noexcept {
+        const unsigned int count = chunk.count;
+        float* xs = chunk.pos_xs_ys;
+        float* ys = chunk.pos_xs_ys + count;
+        // ys are only 32-byte aligned when count is a multiple of 8
+        const bool aligned = (count & 0b111) == 0;
+
+        // Process bulk part
+        {
+            const __m256 attr_x                                = _mm256_set1_ps((world_size * 0.5f)[0]);
+            const __m256 attr_y                                = _mm256_set1_ps((world_size * 0.5f)[1]);
+            const __m256 one_over_max_attractor                = _mm256_set1_ps(1.0f / world_size.length());
+            const __m256 speed_scaler_mul_max_magnitude_mul_dt = _mm256_set1_ps(speed_scaler * MAX_MAGNITUDE * dt);
+            for (unsigned int i = 0; i + 7 < count; i += 8) {
+                __m256 pos_x = _mm256_load_ps(&xs[i]);
+                const __m256 x = _mm256_sub_ps(pos_x, attr_x);
+                const __m256 xx = _mm256_mul_ps(x, x);
+
+                __m256 pos_y = aligned ? _mm256_load_ps(&ys[i]) : _mm256_loadu_ps(&ys[i]);
+                const __m256 y = _mm256_sub_ps(pos_y, attr_y);
+                const __m256 yy = _mm256_mul_ps(y, y);
+
+                const __m256 xx_plus_yy = _mm256_add_ps(xx, yy);
+                const __m256 one_over_length = _mm256_rsqrt_ps(xx_plus_yy);
+
+                const __m256 mul = _mm256_mul_ps(_mm256_sub_ps(one_over_length, one_over_max_attractor), speed_scaler_mul_max_magnitude_mul_dt);
+
+                pos_x = _mm256_add_ps(pos_x, _mm256_mul_ps(y, mul));
+                pos_y = _mm256_sub_ps(pos_y, _mm256_mul_ps(x, mul));
+
+                _mm256_store_ps(&xs[i], pos_x);
+                if (aligned) _mm256_store_ps(&ys[i], pos_y);
+                else         _mm256_storeu_ps(&ys[i], pos_y);
+            }
+        }
+
+        // Process remainder
+        {
+            const auto attractor = world_size * 0.5f;
+            const auto one_over_max_attractor = 1.0f / world_size.length();
+            const auto speed_scaler_mul_max_magnitude_mul_dt = speed_scaler * MAX_MAGNITUDE * dt;
+            for (unsigned int i = count - (count & 0b111); i < count; i++) {
+                const float x = xs[i] - attractor[0];
+                const float y = ys[i] - attractor[1];
+                const float one_over_length = 1.0f / std::sqrt(x * x + y * y);
+                const float mul = (one_over_length - one_over_max_attractor) * speed_scaler_mul_max_magnitude_mul_dt;
+                xs[i] += y * mul;
+                ys[i] -= x * mul;
+            }
+        }
+    }
+
+    void resubmit_nodes_vertices_pos() const noexcept {
+        for (const auto& chunk : chunks) {
+            glBindBuffer(GL_ARRAY_BUFFER, chunk.vbo);
+            const std::size_t actual_size_bytes = 2 * static_cast<std::size_t>(chunk.count) * sizeof(float);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, actual_size_bytes, chunk.pos_xs_ys);
+        }
+    }
+
+    void set_mvp(const Matrix4f& mvp) noexcept {
+        shader_node.bind();
+        shader_node.setUniformMat4f("u_mvp", mvp);
+    }
+
+    void set_size(const Vec<2>& size) noexcept {
+        world_size = size;
+    }
+
+    void flip_physics() noexcept {
+        physics_on = !physics_on;
+    }
+};
+
+#endif
@@ -0,0 +1,356 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include "Shader.h"
+#include "Texture.h"
+#include "Vec.h"
+#include "util.h"
+
+#include <cmath>
+#include <algorithm>
+#include <optional>
+#include <random>
+#include <limits>
+#include <chrono>
+
+#include <immintrin.h>
+
+#include <GLFW/glfw3.h>
+
+
+// float, double, long double
+// [low, high)
+template<typename T = float>
+T getRandomUniformFloat(T low, T high) {
+    static std::random_device rd;
+    static std::seed_seq seed{1, 2, 3, 300};
+    static std::mt19937 e2(seed);
+    // static std::mt19937 e2(rd());
+    std::uniform_real_distribution<T> dist(low, high);
+
+    return dist(e2);
+}
+
+
+// NOTE The rendered node size is actually set with point size
+static constexpr float NODE_SIZE = 0.2f;
+
+
+struct World {
+    bool physics_on = true;
+
+    Vec<2> world_size;
+    float world_depth; // along z, the axis of the vortex
+
+    unsigned int nodes_size;
+
+    // z is in depths, [0, 1), so that wrapping it around is a floor and a sub
+    float* nodes_pos_xs_ys_zs;
+    Vec<3>* nodes_color;
+
+    unsigned int vao_nodes;
+    unsigned int vbo_nodes;
+
+    static constexpr unsigned int node_vertex_components = 3 + 3; // x,y,z + color3
+
+    static constexpr float speed_scaler = 5.0f * 0.0000025f;
+    static constexpr float MAX_MAGNITUDE = 2.0f;
+    // Up along the axis, down far from it: together with the swirl a helix
+    static constexpr float axial_speed_scaler = 0.000002f;
+
+    // The camera ignores the 2D orthographic mvp from Game and orbits the axis
+    static constexpr float camera_fov_deg = 60.0f;
+    static constexpr float camera_tilt_deg = -65.0f;
+    static constexpr float camera_orbit_deg_per_micro = 0.000005f;
+    float camera_orbit_deg = 0.0f;
+
+    Shader shader_node{"node_point_sep3d.vert", "node_point.frag"};
+
+
+    World(const Vec<2>& world_size) : world_size(world_size), world_depth(world_size[1]) {
+        prepare_nodes(4 * 500000);
+        glPointSize(0.1f);
+        benchmark_kernels();
+    }
+
+    ~World() {
+        ::operator delete[] (nodes_pos_xs_ys_zs, std::align_val_t(32));
+        delete[] nodes_color;
+        glDeleteBuffers(1, &vbo_nodes);
+        glDeleteVertexArrays(1, &vao_nodes);
+    }
+
+    void prepare_nodes(unsigned int count) noexcept {
+        nodes_size = count;
+        nodes_pos_xs_ys_zs = new (std::align_val_t(32)) float[3 * count];
+        nodes_color = new Vec<3>[count];
+
+        const auto border = 10.5f * NODE_SIZE;
+        for (unsigned int i = 0; i < count; i++) {
+            const auto x = getRandomUniformFloat(border, world_size[0] - border);
+            const auto y = getRandomUniformFloat(border, world_size[1] - border);
+            const auto z = getRandomUniformFloat(0.0f, 1.0f);
+            const auto color = Vec<3>{ x / world_size[0], y / world_size[1], 0.3f + 0.7f * z };
+            nodes_pos_xs_ys_zs[                 i] = x;
+            nodes_pos_xs_ys_zs[    nodes_size + i] = y;
+            nodes_pos_xs_ys_zs[2 * nodes_size + i] = z;
+            nodes_color[i] = color;
+        }
+
+        glGenVertexArrays(1, &vao_nodes);
+        glBindVertexArray(vao_nodes);
+        {
+            glGenBuffers(1, &vbo_nodes);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes);
+            const unsigned int size_bytes = nodes_size * node_vertex_components * sizeof(float);
+            const float* nodes_data = allocate_and_init_all_nodes_data();
+            glBufferData(GL_ARRAY_BUFFER, size_bytes, nodes_data, GL_DYNAMIC_DRAW);
+            delete[] nodes_data;
+
+            specify_attribs_for_nodes(); // proper GL_ARRAY_BUFFER must be bound!
+        }
+
+        shader_node.bind();
+    }
+
+    void specify_attribs_for_nodes() const noexcept {
+        for (unsigned int index = 0; index < 3; index++) { // x, y, z
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 1;
+            const auto stride_bytes = 0;
+            const auto offset_bytes = index * nodes_size * sizeof(float); // skip the previous coordinates
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+        {
+            const auto index = 3;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 3; // color3
+            const auto stride_bytes = 0;
+            const auto offset_bytes = 3 * nodes_size * sizeof(float); // skip xs, ys and zs
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+    }
+
+    void update_and_render(float dt, const Vec<2>& cursor) noexcept {
+        static auto last = get_time_micros();
+        const auto p0 = get_time_micros();
+        if (physics_on) do_physics(dt, cursor);
+        const auto p1 = get_time_micros();
+        resubmit_nodes_vertices_pos();
+        const auto p2 = get_time_micros();
+        camera_orbit_deg += camera_orbit_deg_per_micro * dt;
+        update_camera();
+        render_nodes();
+        const auto p3 = get_time_micros();
+        const auto frame_time = p3 - last;
+        const auto fps = 1'000'000.0f / frame_time;
+        std::cout
+            << "Idle = " << std::setw(5) << (p0 - last) << "  "
+            << "Physics = " << std::setw(5) << (p1 - p0) << "  "
+            << "Resubmit = " << std::setw(5) << (p2 - p1) << "  "
+            << "Render = " << std::setw(5) << (p3 - p2) << "  "
+            << "Frame time = " << std::setw(5) << frame_time << "  "
+            << "FPS = " << std::setw(5) << fps << '\n';
+        last = p3;
+    }
+
+    void render_nodes() const noexcept {
+        glDrawArrays(GL_POINTS, 0, nodes_size);
+    }
+
+    void do_physics(float dt, const Vec<2>& cursor) noexcept {
+        advect_3d(nodes_pos_xs_ys_zs, nodes_size, dt);
+    }
+
+    // The swirl of World7 around the z axis through the attractor, plus an
+    // axial flow that goes up near the axis and down far from it. z wraps
+    // around, so the particles stay in the box.
+    void advect_3d(float* xs_ys_zs, unsigned int count, float dt) const noexcept {
+        float* xs = xs_ys_zs;
+        float* ys = xs_ys_zs + count;
+        float* zs = xs_ys_zs + 2 * count;
+        const auto attractor = world_size * 0.5f;
+        const float one_over_max_attractor_sqr = 1.0f / world_size.length_sqr();
+        const float axial_speed_mul_dt = axial_speed_scaler * dt / world_depth;
+        // ys and zs are only 32-byte aligned when count is a multiple of 8
+        const bool aligned = (count & 0b111) == 0;
+
+        // Process bulk part
+        {
+            const __m256 attr_x                                = _mm256_set1_ps(attractor[0]);
+            const __m256 attr_y                                = _mm256_set1_ps(attractor[1]);
+            const __m256 one_over_max_attractor                = _mm256_set1_ps(1.0f / world_size.length());
+            const __m256 speed_scaler_mul_max_magnitude_mul_dt = _mm256_set1_ps(speed_scaler * MAX_MAGNITUDE * dt);
+            // Up to a quarter of the way out, down beyond: w = a - b * r^2
+            const __m256 axial_a                               = _mm256_set1_ps(axial_speed_mul_dt);
+            const __m256 axial_b                               = _mm256_set1_ps(4.0f * axial_speed_mul_dt * one_over_max_attractor_sqr);
+            for (unsigned int i = 0; i + 7 < count; i += 8) {
+                __m256 pos_x = _mm256_load_ps(&xs[i]);
+                const __m256 x = _mm256_sub_ps(pos_x, attr_x);
+                const __m256 xx = _mm256_mul_ps(x, x);
+
+                __m256 pos_y = aligned ? _mm256_load_ps(&ys[i]) : _mm256_loadu_ps(&ys[i]);
+                const __m256 y = _mm256_sub_ps(pos_y, attr_y);
+                const __m256 yy = _mm256_mul_ps(y, y);
+
+                const __m256 xx_plus_yy = _mm256_add_ps(xx, yy);
+                const __m256 one_over_length = _mm256_rsqrt_ps(xx_plus_yy);
+
+                const __m256 mul = _mm256_mul_ps(_mm256_sub_ps(one_over_length, one_over_max_attractor), speed_scaler_mul_max_magnitude_mul_dt);
+
+                pos_x = _mm256_add_ps(pos_x, _mm256_mul_ps(y, mul));
+                pos_y = _mm256_sub_ps(pos_y, _mm256_mul_ps(x, mul));
+
+                __m256 pos_z = aligned ? _mm256_load_ps(&zs[i]) : _mm256_loadu_ps(&zs[i]);
+                pos_z = _mm256_add_ps(pos_z, _mm256_sub_ps(axial_a, _mm256_mul_ps(axial_b, xx_plus_yy)));
+                pos_z = _mm256_sub_ps(pos_z, _mm256_floor_ps(pos_z));
+
+                _mm256_store_ps(&xs[i], pos_x);
+                if (aligned) {
+                    _mm256_store_ps(&ys[i], pos_y);
+                    _mm256_store_ps(&zs[i], pos_z);
+                } else {
+                    _mm256_storeu_ps(&ys[i], pos_y);
+                    _mm256_storeu_ps(&zs[i], pos_z);
+                }
+            }
+        }
+
+        // Process remainder
+        {
+            const auto one_over_max_attractor = 1.0f / world_size.length();
+            const auto speed_scaler_mul_max_magnitude_mul_dt = speed_scaler * MAX_MAGNITUDE * dt;
+            for (unsigned int i = count - (count & 0b111); i < count; i++) {
+                const float x = xs[i] - attractor[0];
+                const float y = ys[i] - attractor[1];
+                const float xx_plus_yy = x * x + y * y;
+                const float one_over_length = 1.0f / std::sqrt(xx_plus_yy);
+                const float mul = (one_over_length - one_over_max_attractor) * speed_scaler_mul_max_magnitude_mul_dt;
+                xs[i] += y * mul;
+                ys[i] -= x * mul;
+                const float z = zs[i] + axial_speed_mul_dt * (1.0f - 4.0f * xx_plus_yy * one_over_max_attractor_sqr);
+                zs[i] = z - std::floor(z);
+            }
+        }
+    }
+
+    // The loop of World7, on xs and ys only (count is a multiple of 8 here)
+    void advect_2d(float* xs_ys, unsigned int count, float dt) const noexcept {
+        float* xs = xs_ys;
+        float* ys = xs_ys + count;
+        const __m256 attr_x                                = _mm256_set1_ps((world_size * 0.5f)[0]);
+        const __m256 attr_y                                = _mm256_set1_ps((world_size * 0.5f)[1]);
+        const __m256 one_over_max_attractor                = _mm256_set1_ps(1.0f / world_size.length());
+        const __m256 speed_scaler_mul_max_magnitude_mul_dt = _mm256_set1_ps(speed_scaler * MAX_MAGNITUDE * dt);
+        for (unsigned int i = 0; i + 7 < count; i += 8) {
+            __m256 pos_x = _mm256_load_ps(&xs[i]);
+            const __m256 x = _mm256_sub_ps(pos_x, attr_x);
+            const __m256 xx = _mm256_mul_ps(x, x);
+
+            __m256 pos_y = _mm256_load_ps(&ys[i]);
+            const __m256 y = _mm256_sub_ps(pos_y, attr_y);
+            const __m256 yy = _mm256_mul_ps(y, y);
+
+            const __m256 xx_plus_yy = _mm256_add_ps(xx, yy);
+            const __m256 one_over_length = _mm256_rsqrt_ps(xx_plus_yy);
+
+            const __m256 mul = _mm256_mul_ps(_mm256_sub_ps(one_over_length, one_over_max_attractor), speed_scaler_mul_max_magnitude_mul_dt);
+
+            pos_x = _mm256_add_ps(pos_x, _mm256_mul_ps(y, mul));
+            pos_y = _mm256_sub_ps(pos_y, _mm256_mul_ps(x, mul));
+
+            _mm256_store_ps(&xs[i], pos_x);
+            _mm256_store_ps(&ys[i], pos_y);
+        }
+    }
+
+    // Both kernels on copies of the same nodes, so the memory traffic is
+    // the real one: 8 bytes per node in 2D, 12 in 3D. Interleaved and the
+    // fastest run of each kept, since the machine is busy with other things.
+    void benchmark_kernels() const noexcept {
+        constexpr unsigned int runs = 30;
+        constexpr float dt = 16'000.0f;
+        float* xs_ys_zs = new (std::align_val_t(32)) float[3 * nodes_size];
+        float* xs_ys = new (std::align_val_t(32)) float[2 * nodes_size];
+        std::copy(nodes_pos_xs_ys_zs, nodes_pos_xs_ys_zs + 3 * nodes_size, xs_ys_zs);
+        std::copy(nodes_pos_xs_ys_zs, nodes_pos_xs_ys_zs + 2 * nodes_size, xs_ys);
+
+        // get_time_micros() is a float and too coarse for a single run
+        using clock = std::chrono::steady_clock;
+        auto best_2d = clock::duration::max();
+        auto best_3d = clock::duration::max();
+        for (unsigned int i = 0; i < runs; i++) {
+            const auto t0 = clock::now();
+            advect_2d(xs_ys, nodes_size, dt);
+            const auto t1 = clock::now();
+            advect_3d(xs_ys_zs, nodes_size, dt);
+            const auto t2 = clock::now();
+            best_2d = std::min(best_2d, t1 - t0);
+            best_3d = std::min(best_3d, t2 - t1);
+        }
+
+        const float ns_2d = std::chrono::duration<float, std::nano>(best_2d).count() / nodes_size;
+        const float ns_3d = std::chrono::duration<float, std::nano>(best_3d).count() / nodes_size;
+        std::cout << "Kernels on " << nodes_size << " nodes: "
+            << "2D = " << ns_2d << " ns/node  "
+            << "3D = " << ns_3d << " ns/node  "
+            << "3D/2D = " << (ns_3d / ns_2d) << '\n';
+
+        ::operator delete[] (xs_ys_zs, std::align_val_t(32));
+        ::operator delete[] (xs_ys, std::align_val_t(32));
+    }
+
+    float* allocate_and_init_all_nodes_data() const noexcept {
+        const auto count = nodes_size * node_vertex_components;
+        float* nodes_data = new float[count];
+        unsigned int i = 0;
+
+        for (; i < 3 * nodes_size; i++) { // xyz
+            nodes_data[i] = nodes_pos_xs_ys_zs[i];
+        }
+
+        for (unsigned int j = 0; j < nodes_size; j++, i += 3) { // color3
+            nodes_data[i + 0] = nodes_color[j][0];
+            nodes_data[i + 1] = nodes_color[j][1];
+            nodes_data[i + 2] = nodes_color[j][2];
+        }
+
+        return nodes_data;
+    }
+
+    void resubmit_nodes_vertices_pos() const noexcept {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes);
+        const auto count = nodes_size * 3;
+        const auto actual_size_bytes = count * sizeof(float);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, actual_size_bytes, nodes_pos_xs_ys_zs);
+    }
+
+    // Looks at the center of the box from the side and a bit from above,
+    // orbiting around the axis of the vortex
+    void update_camera() noexcept {
+        const auto center = Vec<3>{ world_size[0] * 0.5f, world_size[1] * 0.5f, world_depth * 0.5f };
+        const float distance = 1.2f * world_size.length();
+        Matrix4f mvp = Matrix4f::perspective(world_size[0], world_size[1], camera_fov_deg, 0.1f * distance, 3.0f * distance);
+        mvp.translate(0.0f, 0.0f, -distance);
+        mvp.rotate(camera_tilt_deg, 1.0f, 0.0f, 0.0f);
+        mvp.rotate(camera_orbit_deg, 0.0f, 0.0f, 1.0f);
+        mvp.translate(-center[0], -center[1], -center[2]);
+        mvp.scale(1.0f, 1.0f, world_depth); // z of the nodes is in depths
+        shader_node.setUniformMat4f("u_mvp", mvp);
+    }
+
+    void set_mvp(const Matrix4f& mvp) noexcept {
+        shader_node.bind();
+        update_camera();
+    }
+
+    void set_size(const Vec<2>& size) noexcept {
+        world_size = size;
+    }
+
+    void flip_physics() noexcept {
+        physics_on = !physics_on;
+    }
+};
+
+#endif
@@ -0,0 +1,344 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include "Shader.h"
+#include "Texture.h"
+#include "Vec.h"
+#include "util.h"
+
+#include <cmath>
+#include <algorithm>
+#include <optional>
+#include <random>
+#include <limits>
+#include <vector>
+
+#include <GLFW/glfw3.h>
+
+
+// float, double, long double
+// [low, high)
+template<typename T = float>
+T getRandomUniformFloat(T low, T high) {
+    static std::random_device rd;
+    static std::seed_seq seed{1, 2, 3, 300};
+    static std::mt19937 e2(seed);
+    // static std::mt19937 e2(rd());
+    std::uniform_real_distribution<T> dist(low, high);
+
+    return dist(e2);
+}
+
+
+// NOTE The rendered node size is actually set with point size
+static constexpr float NODE_SIZE = 0.2f;
+
+
+struct World {
+    bool physics_on = true;
+
+    Vec<2> world_size;
+
+    unsigned int nodes_size;
+
+    Vec<2>* nodes_pos;
+    Vec<3>* nodes_color;
+
+    // Positions ping-pong through transform feedback, the color is static
+    // and shared by both VAOs
+    unsigned int vao_nodes[2];
+    unsigned int vbo_nodes_pos[2];
+    unsigned int vbo_nodes_color;
+    unsigned int tfo_nodes[2];
+    unsigned int swap_index = 0;
+    bool first_render = true;
+
+    static constexpr unsigned int node_pos_components = 2; // x,y
+    static constexpr unsigned int node_color_components = 3; // color3
+
+    static constexpr const char* const transform_variables[] = { "DataBlock.new_pos" };
+    Shader shader_node = Shader("node_sep_calc_pos.vert", "node_point.frag", transform_variables, 1);
+
+    // The time of the transform feedback pass, read a few frames late so
+    // that asking never stalls
+    static constexpr unsigned int query_ring_size = 4;
+    unsigned int queries[query_ring_size];
+    bool query_issued[query_ring_size] = {};
+    unsigned int query_index = 0;
+    float gpu_micros = 0.0f;
+
+
+    World(const Vec<2>& world_size) : world_size(world_size) {
+        prepare_nodes(4 * 500000);
+        glPointSize(0.1f);
+        glGenQueries(query_ring_size, queries);
+        benchmark_layouts();
+    }
+
+    ~World() {
+        delete[] nodes_pos;
+        delete[] nodes_color;
+        glDeleteQueries(query_ring_size, queries);
+        glDeleteTransformFeedbacks(2, tfo_nodes);
+        glDeleteBuffers(2, vbo_nodes_pos);
+        glDeleteBuffers(1, &vbo_nodes_color);
+        glDeleteVertexArrays(2, vao_nodes);
+    }
+
+    void prepare_nodes(unsigned int count) noexcept {
+        nodes_size = count;
+        nodes_pos = new Vec<2>[count];
+        nodes_color = new Vec<3>[count];
+
+        const auto border = 10.5f * NODE_SIZE;
+        for (unsigned int i = 0; i < count; i++) {
+            const auto x = getRandomUniformFloat(border, world_size[0] - border);
+            const auto y = getRandomUniformFloat(border, world_size[1] - border);
+            const auto color = Vec<3>{ x / world_size[0], y / world_size[1], 0.7f };
+            nodes_pos[i] = Vec<2>{ x, y };
+            nodes_color[i] = color;
+        }
+
+        static_assert(sizeof(Vec<2>) == node_pos_components * sizeof(float) && sizeof(Vec<3>) == node_color_components * sizeof(float));
+
+        // Uploaded once, never written again
+        glGenBuffers(1, &vbo_nodes_color);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes_color);
+        glBufferData(GL_ARRAY_BUFFER, nodes_size * node_color_components * sizeof(float), nodes_color, GL_STATIC_DRAW);
+
+        const unsigned int pos_size_bytes = nodes_size * node_pos_components * sizeof(float);
+        glGenBuffers(2, vbo_nodes_pos);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes_pos[0]);
+        glBufferData(GL_ARRAY_BUFFER, pos_size_bytes, nodes_pos, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes_pos[1]);
+        // Just allocate, do not initialize
+        glBufferData(GL_ARRAY_BUFFER, pos_size_bytes, nullptr, GL_DYNAMIC_COPY);
+
+        glGenVertexArrays(2, vao_nodes);
+        for (unsigned int i = 0; i < 2; i++) {
+            glBindVertexArray(vao_nodes[i]);
+            specify_attribs_for_nodes(vbo_nodes_pos[i]);
+        }
+        glBindVertexArray(0);
+
+        glGenTransformFeedbacks(2, tfo_nodes);
+        for (unsigned int i = 0; i < 2; i++) {
+            glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tfo_nodes[i]);
+            glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, vbo_nodes_pos[i]);
+        }
+        glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+
+        shader_node.bind();
+
+        const auto attractor = world_size * 0.5f;
+        const auto one_over_max_attractor = 1.0f / world_size.length();
+        shader_node.setUniform1f("one_over_max_attractor", one_over_max_attractor);
+        shader_node.setUniform2f("attractor", attractor[0], attractor[1]);
+    }
+
+    void specify_attribs_for_nodes(unsigned int vbo_pos) const noexcept {
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_pos);
+            const auto index = 0;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 2; // xy
+            const auto stride_bytes = 0;
+            const auto offset_bytes = 0;
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes_color);
+            const auto index = 1;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 3; // color3
+            const auto stride_bytes = 0;
+            const auto offset_bytes = 0;
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+    }
+
+    void update_and_render(float dt, const Vec<2>& cursor) noexcept {
+        static auto last = get_time_micros();
+        const auto p0 = get_time_micros();
+        if (physics_on) do_physics(dt, cursor);
+        const auto p1 = get_time_micros();
+        render_nodes();
+        const auto p2 = get_time_micros();
+        collect_gpu_time();
+        const auto frame_time = p2 - last;
+        const auto fps = 1'000'000.0f / frame_time;
+        // Computed, not measured; benchmark_layouts() measures it against World8
+        const float captured_mb = nodes_size * node_pos_components * sizeof(float) / 1'000'000.0f;
+        std::cout
+            << "Idle = " << std::setw(5) << (p0 - last) << "  "
+            << "Physics = " << std::setw(5) << (p1 - p0) << "  "
+            << "Render = " << std::setw(5) << (p2 - p1) << "  "
+            << "GPU = " << std::setw(5) << gpu_micros << "  "
+            << "Captured = " << captured_mb << " MB  "
+            << "Frame time = " << std::setw(5) << frame_time << "  "
+            << "FPS = " << std::setw(5) << fps << '\n';
+        last = p2;
+    }
+
+    void render_nodes() noexcept {
+        const auto query = query_index % query_ring_size;
+
+        glBindVertexArray(vao_nodes[swap_index]);
+
+        // Transform feedback goes into the other position VBO
+        glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tfo_nodes[1 - swap_index]);
+        glBeginQuery(GL_TIME_ELAPSED, queries[query]);
+        glBeginTransformFeedback(GL_POINTS);
+
+        if (first_render) {
+            first_render = false;
+            glDrawArrays(GL_POINTS, 0, nodes_size);
+        } else {
+            // This uses the size of the Transform Feedback data to specify the number of points.
+            // Apart from that, the next line is equivalent to using glDrawArrays(GL_POINTS, 0, ...).
+            glDrawTransformFeedback(GL_POINTS, tfo_nodes[swap_index]);
+        }
+
+        glEndTransformFeedback();
+        glEndQuery(GL_TIME_ELAPSED);
+        query_issued[query] = true;
+        query_index++;
+
+        glFlush();
+
+        swap_index = 1 - swap_index;
+    }
+
+    // Takes the result of the oldest query, if it is there already
+    void collect_gpu_time() noexcept {
+        const auto query = query_index % query_ring_size;
+        if (!query_issued[query]) return;
+        int available = 0;
+        glGetQueryObjectiv(queries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) return;
+        query_issued[query] = false;
+        GLuint64 nanos = 0;
+        glGetQueryObjectui64v(queries[query], GL_QUERY_RESULT, &nanos);
+        gpu_micros = nanos / 1000.0f;
+    }
+
+    // The feedback pass of World8 (position and color captured, interleaved)
+    // against the one of this World, on the same nodes and in the same run,
+    // each timed with a query and the fastest of the runs kept. Nothing is
+    // rasterized, only the capture is measured. An even number of passes
+    // leaves the latest positions in vbo_nodes_pos[0], where render_nodes()
+    // starts from.
+    void benchmark_layouts() noexcept {
+        constexpr unsigned int runs = 20;
+        constexpr unsigned int interleaved_components = node_pos_components + node_color_components;
+        static constexpr const char* const interleaved_variables[] = { "DataBlock.new_pos", "DataBlock.color" };
+        Shader shader_interleaved("node_sep_calc.vert", "node_point.frag", interleaved_variables, 2);
+
+        std::vector<float> interleaved(nodes_size * interleaved_components);
+        for (unsigned int i = 0; i < nodes_size; i++) {
+            float* node = &interleaved[i * interleaved_components];
+            node[0] = nodes_pos[i][0];
+            node[1] = nodes_pos[i][1];
+            node[2] = nodes_color[i][0];
+            node[3] = nodes_color[i][1];
+            node[4] = nodes_color[i][2];
+        }
+        unsigned int vao_interleaved[2], vbo_interleaved[2], tfo_interleaved[2];
+        glGenVertexArrays(2, vao_interleaved);
+        glGenBuffers(2, vbo_interleaved);
+        glGenTransformFeedbacks(2, tfo_interleaved);
+        for (unsigned int i = 0; i < 2; i++) {
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_interleaved[i]);
+            glBufferData(GL_ARRAY_BUFFER, interleaved.size() * sizeof(float), (i == 0) ? interleaved.data() : nullptr, GL_DYNAMIC_COPY);
+            glBindVertexArray(vao_interleaved[i]);
+            const auto stride_bytes = interleaved_components * sizeof(float);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, node_pos_components, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(0));
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, node_color_components, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(node_pos_components * sizeof(float)));
+            glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tfo_interleaved[i]);
+            glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, vbo_interleaved[i]);
+        }
+        glBindVertexArray(0);
+
+        const auto attractor = world_size * 0.5f;
+        const auto one_over_max_attractor = 1.0f / world_size.length();
+        constexpr float speed_scaler_mul_max_magnitude_mul_dt = 5.0f * 0.0000025f * 2.0f * 16'000.0f;
+        for (Shader* shader : { &shader_interleaved, &shader_node }) {
+            shader->bind();
+            shader->setUniform1f("one_over_max_attractor", one_over_max_attractor);
+            shader->setUniform2f("attractor", attractor[0], attractor[1]);
+            shader->setUniform1f("speed_scaler_mul_max_magnitude_mul_dt", speed_scaler_mul_max_magnitude_mul_dt);
+        }
+
+        const auto timed_pass = [this](Shader& shader, unsigned int vao, unsigned int tfo, unsigned int query) {
+            shader.bind();
+            glBindVertexArray(vao);
+            glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tfo);
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            glBeginTransformFeedback(GL_POINTS);
+            glDrawArrays(GL_POINTS, 0, nodes_size);
+            glEndTransformFeedback();
+            glEndQuery(GL_TIME_ELAPSED);
+        };
+        const auto micros_of = [](unsigned int query) {
+            GLuint64 nanos = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanos); // waits, which is fine at startup
+            return nanos / 1000.0f;
+        };
+
+        unsigned int bench_queries[2];
+        glGenQueries(2, bench_queries);
+        glEnable(GL_RASTERIZER_DISCARD);
+        float best_interleaved = std::numeric_limits<float>::max();
+        float best_split = std::numeric_limits<float>::max();
+        for (unsigned int i = 0; i < runs; i++) {
+            const unsigned int from = i % 2;
+            timed_pass(shader_interleaved, vao_interleaved[from], tfo_interleaved[1 - from], bench_queries[0]);
+            timed_pass(shader_node, vao_nodes[from], tfo_nodes[1 - from], bench_queries[1]);
+            best_interleaved = std::min(best_interleaved, micros_of(bench_queries[0]));
+            best_split = std::min(best_split, micros_of(bench_queries[1]));
+        }
+        glDisable(GL_RASTERIZER_DISCARD);
+        glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+        glBindVertexArray(0);
+
+        glDeleteQueries(2, bench_queries);
+        glDeleteTransformFeedbacks(2, tfo_interleaved);
+        glDeleteBuffers(2, vbo_interleaved);
+        glDeleteVertexArrays(2, vao_interleaved);
+
+        std::cout << "Transform feedback of " << nodes_size << " nodes, fastest of " << runs << ": "
+            << "interleaved (World8, " << interleaved_components * sizeof(float) << " B/node) = " << best_interleaved << " us  "
+            << "position only (" << node_pos_components * sizeof(float) << " B/node) = " << best_split << " us  "
+            << "ratio = " << ((best_interleaved > 0.0f) ? best_split / best_interleaved : 0.0f) << '\n';
+    }
+
+    void do_physics(float dt, const Vec<2>& cursor) noexcept {
+        const float speed_scaler = 5.0f * 0.0000025f;
+        const auto MAX_MAGNITUDE = 2.0f;
+        const auto speed_scaler_mul_max_magnitude = speed_scaler * MAX_MAGNITUDE;
+        const auto speed_scaler_mul_max_magnitude_mul_dt = speed_scaler_mul_max_magnitude * dt;
+        shader_node.setUniform1f("speed_scaler_mul_max_magnitude_mul_dt", speed_scaler_mul_max_magnitude_mul_dt);
+    }
+
+    void set_mvp(const Matrix4f& mvp) noexcept {
+        shader_node.bind();
+        shader_node.setUniformMat4f("u_mvp", mvp);
+    }
+
+    void set_size(const Vec<2>& size) noexcept {
+        world_size = size;
+
+        const auto attractor = world_size * 0.5f;
+        const auto one_over_max_attractor = 1.0f / world_size.length();
+        shader_node.setUniform1f("one_over_max_attractor", one_over_max_attractor);
+        shader_node.setUniform2f("attractor", attractor[0], attractor[1]);
+    }
+
+    void flip_physics() noexcept {
+        physics_on = !physics_on;
+    }
+};
+
+#endif
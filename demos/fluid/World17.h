@@ -0,0 +1,310 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include "Shader.h"
+#include "Texture.h"
+#include "Vec.h"
+#include "util.h"
+
+#include <cmath>
+#include <algorithm>
+#include <optional>
+#include <random>
+#include <limits>
+#include <array>
+#include <utility>
+
+#include <immintrin.h>
+
+#include <GLFW/glfw3.h>
+
+
+// float, double, long double
+// [low, high)
+template<typename T = float>
+T getRandomUniformFloat(T low, T high) {
+    static std::random_device rd;
+    static std::seed_seq seed{1, 2, 3, 300};
+    static std::mt19937 e2(seed);
+    // static std::mt19937 e2(rd());
+    std::uniform_real_distribution<T> dist(low, high);
+
+    return dist(e2);
+}
+
+
+// NOTE The rendered node size is actually set with point size
+static constexpr float NODE_SIZE = 0.2f;
+
+
+// Optional parts of the advection step, on top of the vortex
+enum Feature : unsigned int {
+    CursorAttraction = 1 << 0, // pulled towards the cursor
+    BoundaryBounce   = 1 << 1, // reflected back into the world at the borders
+    CoreDamping      = 1 << 2, // no spinning out of control next to the attractor
+    ColorOutput      = 1 << 3, // red by speed
+};
+static constexpr unsigned int FEATURES_COUNT = 4;
+static constexpr unsigned int FEATURE_COMBINATIONS = 1 << FEATURES_COUNT;
+
+inline const char* to_string(Feature feature) noexcept {
+    switch (feature) {
+        case CursorAttraction: return "Cursor attraction";
+        case BoundaryBounce:   return "Boundary bounce";
+        case CoreDamping:      return "Core damping";
+        case ColorOutput:      return "Color output";
+    }
+    return "?";
+}
+
+
+struct World {
+    bool physics_on = true;
+
+    Vec<2> world_size;
+
+    unsigned int nodes_size;
+
+    // xs, ys, rs, gs, bs
+    float* nodes_data;
+    float* nodes_initial_color_rs_bs;
+
+    unsigned int vao_nodes;
+    unsigned int vbo_nodes;
+
+    static constexpr unsigned int node_vertex_components = 2 + 3; // x,y + color3
+
+    static constexpr float speed_scaler = 5.0f * 0.0000025f;
+    static constexpr float MAX_MAGNITUDE = 2.0f;
+    static constexpr float cursor_attraction = 0.000002f;  // world units per micro
+    static constexpr float core_radius = 2.0f;
+    static constexpr float speed_to_red = 1.0f / 0.00002f; // full red at 0.00002 world units per micro
+    static constexpr float border = 10.5f * NODE_SIZE;
+
+    unsigned int features = 0;
+
+    // One kernel per combination of the features, all instantiated at
+    // compile time; toggling a feature only changes the index.
+    using Kernel = void (World::*)(float dt, const Vec<2>& cursor) noexcept;
+
+    Shader shader_node{"node_point_sep_rgb.vert", "node_point.frag"};
+
+
+    World(const Vec<2>& world_size) : world_size(world_size) {
+        prepare_nodes(4 * 500000);
+        glPointSize(0.1f);
+        std::cout << "Features (1-" << FEATURES_COUNT << " to toggle):";
+        for (unsigned int i = 0; i < FEATURES_COUNT; i++) std::cout << ' ' << (i + 1) << " = " << to_string(static_cast<Feature>(1 << i)) << ';';
+        std::cout << '\n';
+    }
+
+    ~World() {
+        ::operator delete[] (nodes_data, std::align_val_t(32));
+        delete[] nodes_initial_color_rs_bs;
+        glDeleteBuffers(1, &vbo_nodes);
+        glDeleteVertexArrays(1, &vao_nodes);
+    }
+
+    float* xs() const noexcept { return nodes_data; }
+    float* ys() const noexcept { return nodes_data + 1 * nodes_size; }
+    float* rs() const noexcept { return nodes_data + 2 * nodes_size; }
+    float* gs() const noexcept { return nodes_data + 3 * nodes_size; }
+    float* bs() const noexcept { return nodes_data + 4 * nodes_size; }
+
+    void prepare_nodes(unsigned int count) noexcept {
+        // Every stream stays 32-byte aligned
+        nodes_size = (count + 7) & ~0b111u;
+        nodes_data = new (std::align_val_t(32)) float[node_vertex_components * nodes_size];
+        nodes_initial_color_rs_bs = new float[2 * nodes_size];
+
+        for (unsigned int i = 0; i < nodes_size; i++) {
+            const auto x = getRandomUniformFloat(border, world_size[0] - border);
+            const auto y = getRandomUniformFloat(border, world_size[1] - border);
+            xs()[i] = x;
+            ys()[i] = y;
+            rs()[i] = x / world_size[0];
+            gs()[i] = y / world_size[1];
+            bs()[i] = 0.7f;
+        }
+        std::copy(rs(), rs() + nodes_size, nodes_initial_color_rs_bs);
+        std::copy(bs(), bs() + nodes_size, nodes_initial_color_rs_bs + nodes_size);
+
+        glGenVertexArrays(1, &vao_nodes);
+        glBindVertexArray(vao_nodes);
+        {
+            glGenBuffers(1, &vbo_nodes);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes);
+            const unsigned int size_bytes = nodes_size * node_vertex_components * sizeof(float);
+            glBufferData(GL_ARRAY_BUFFER, size_bytes, nodes_data, GL_DYNAMIC_DRAW);
+
+            specify_attribs_for_nodes(); // proper GL_ARRAY_BUFFER must be bound!
+        }
+
+        shader_node.bind();
+    }
+
+    void specify_attribs_for_nodes() const noexcept {
+        for (unsigned int index = 0; index < node_vertex_components; index++) { // x, y, r, g, b
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 1;
+            const auto stride_bytes = 0;
+            const auto offset_bytes = index * nodes_size * sizeof(float); // skip the previous streams
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+    }
+
+    void update_and_render(float dt, const Vec<2>& cursor) noexcept {
+        static auto last = get_time_micros();
+        const auto p0 = get_time_micros();
+        if (physics_on) do_physics(dt, cursor);
+        const auto p1 = get_time_micros();
+        resubmit_nodes_vertices();
+        const auto p2 = get_time_micros();
+        render_nodes();
+        const auto p3 = get_time_micros();
+        const auto frame_time = p3 - last;
+        const auto fps = 1'000'000.0f / frame_time;
+        std::cout
+            << "Idle = " << std::setw(5) << (p0 - last) << "  "
+            << "Physics = " << std::setw(5) << (p1 - p0) << "  "
+            << "Resubmit = " << std::setw(5) << (p2 - p1) << "  "
+            << "Render = " << std::setw(5) << (p3 - p2) << "  "
+            << "Frame time = " << std::setw(5) << frame_time << "  "
+            << "FPS = " << std::setw(5) << fps << "  "
+            << "Features = " << features << '\n';
+        last = p3;
+    }
+
+    void render_nodes() const noexcept {
+        glDrawArrays(GL_POINTS, 0, nodes_size);
+    }
+
+    void do_physics(float dt, const Vec<2>& cursor) noexcept {
+        (this->*kernel_for(features))(dt, cursor);
+    }
+
+    static Kernel kernel_for(unsigned int features) noexcept {
+        static constexpr auto kernels = []<std::size_t... I>(std::index_sequence<I...>) {
+            return std::array<Kernel, FEATURE_COMBINATIONS>{ &World::advect<I>... };
+        }(std::make_index_sequence<FEATURE_COMBINATIONS>{});
+        return kernels[features];
+    }
+
+    // nodes_size is a multiple of 8, so there is no remainder
+    template<unsigned int FEATURES>
+    void advect(float dt, const Vec<2>& cursor) noexcept {
+        float* const xs = this->xs();
+        float* const ys = this->ys();
+        float* const rs = this->rs();
+        float* const bs = this->bs();
+
+        const __m256 attr_x                                = _mm256_set1_ps((world_size * 0.5f)[0]);
+        const __m256 attr_y                                = _mm256_set1_ps((world_size * 0.5f)[1]);
+        const __m256 one_over_max_attractor                = _mm256_set1_ps(1.0f / world_size.length());
+        const __m256 speed_scaler_mul_max_magnitude_mul_dt = _mm256_set1_ps(speed_scaler * MAX_MAGNITUDE * dt);
+        [[maybe_unused]] const __m256 cursor_x             = _mm256_set1_ps(cursor[0]);
+        [[maybe_unused]] const __m256 cursor_y             = _mm256_set1_ps(cursor[1]);
+        [[maybe_unused]] const __m256 attraction_mul_dt    = _mm256_set1_ps(cursor_attraction * dt);
+        [[maybe_unused]] const __m256 attraction_softening = _mm256_set1_ps(1.0f);
+        [[maybe_unused]] const __m256 low_x                = _mm256_set1_ps(border);
+        [[maybe_unused]] const __m256 low_y                = _mm256_set1_ps(border);
+        [[maybe_unused]] const __m256 high_x               = _mm256_set1_ps(world_size[0] - border);
+        [[maybe_unused]] const __m256 high_y               = _mm256_set1_ps(world_size[1] - border);
+        [[maybe_unused]] const __m256 sign_mask            = _mm256_set1_ps(-0.0f);
+        [[maybe_unused]] const __m256 core_radius_sqr      = _mm256_set1_ps(core_radius * core_radius);
+        [[maybe_unused]] const __m256 speed_to_red_div_dt  = _mm256_set1_ps(speed_to_red / dt);
+        [[maybe_unused]] const __m256 one                  = _mm256_set1_ps(1.0f);
+
+        for (unsigned int i = 0; i < nodes_size; i += 8) {
+            const __m256 old_x = _mm256_load_ps(&xs[i]);
+            const __m256 old_y = _mm256_load_ps(&ys[i]);
+            const __m256 x = _mm256_sub_ps(old_x, attr_x);
+            const __m256 y = _mm256_sub_ps(old_y, attr_y);
+            const __m256 xx_plus_yy = _mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y));
+            const __m256 one_over_length = _mm256_rsqrt_ps(xx_plus_yy);
+
+            __m256 mul = _mm256_mul_ps(_mm256_sub_ps(one_over_length, one_over_max_attractor), speed_scaler_mul_max_magnitude_mul_dt);
+            if constexpr (FEATURES & CoreDamping) {
+                // r^2 / (r^2 + core^2): 1 far away, 0 at the attractor
+                mul = _mm256_mul_ps(mul, _mm256_mul_ps(xx_plus_yy, _mm256_rcp_ps(_mm256_add_ps(xx_plus_yy, core_radius_sqr))));
+            }
+
+            __m256 pos_x = _mm256_add_ps(old_x, _mm256_mul_ps(y, mul));
+            __m256 pos_y = _mm256_sub_ps(old_y, _mm256_mul_ps(x, mul));
+
+            if constexpr (FEATURES & CursorAttraction) {
+                // Constant speed towards the cursor, slowing down right next to it
+                const __m256 to_cursor_x = _mm256_sub_ps(cursor_x, pos_x);
+                const __m256 to_cursor_y = _mm256_sub_ps(cursor_y, pos_y);
+                const __m256 distance_sqr = _mm256_add_ps(_mm256_mul_ps(to_cursor_x, to_cursor_x), _mm256_mul_ps(to_cursor_y, to_cursor_y));
+                const __m256 pull = _mm256_mul_ps(attraction_mul_dt, _mm256_rsqrt_ps(_mm256_add_ps(distance_sqr, attraction_softening)));
+                pos_x = _mm256_add_ps(pos_x, _mm256_mul_ps(to_cursor_x, pull));
+                pos_y = _mm256_add_ps(pos_y, _mm256_mul_ps(to_cursor_y, pull));
+            }
+
+            if constexpr (FEATURES & BoundaryBounce) {
+                // low + |p - low|, then high - |high - p|: mirrored at both borders
+                pos_x = _mm256_add_ps(low_x, _mm256_andnot_ps(sign_mask, _mm256_sub_ps(pos_x, low_x)));
+                pos_y = _mm256_add_ps(low_y, _mm256_andnot_ps(sign_mask, _mm256_sub_ps(pos_y, low_y)));
+                pos_x = _mm256_sub_ps(high_x, _mm256_andnot_ps(sign_mask, _mm256_sub_ps(high_x, pos_x)));
+                pos_y = _mm256_sub_ps(high_y, _mm256_andnot_ps(sign_mask, _mm256_sub_ps(high_y, pos_y)));
+            }
+
+            if constexpr (FEATURES & ColorOutput) {
+                const __m256 dx = _mm256_sub_ps(pos_x, old_x);
+                const __m256 dy = _mm256_sub_ps(pos_y, old_y);
+                const __m256 moved_sqr = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+                // sqrt as x * rsqrt(x), with the 0 guarded
+                const __m256 moved = _mm256_mul_ps(moved_sqr, _mm256_rsqrt_ps(_mm256_max_ps(moved_sqr, _mm256_set1_ps(1e-30f))));
+                const __m256 red = _mm256_min_ps(_mm256_mul_ps(moved, speed_to_red_div_dt), one);
+                _mm256_store_ps(&rs[i], red);
+                _mm256_store_ps(&bs[i], _mm256_sub_ps(one, red));
+            }
+
+            _mm256_store_ps(&xs[i], pos_x);
+            _mm256_store_ps(&ys[i], pos_y);
+        }
+    }
+
+    void flip_feature(unsigned int index) noexcept {
+        if (index >= FEATURES_COUNT) return;
+        const auto feature = static_cast<Feature>(1 << index);
+        features ^= feature;
+        std::cout << to_string(feature) << ((features & feature) ? " on\n" : " off\n");
+        if ((feature == ColorOutput) && !(features & ColorOutput)) {
+            std::copy(nodes_initial_color_rs_bs, nodes_initial_color_rs_bs + nodes_size, rs());
+            std::copy(nodes_initial_color_rs_bs + nodes_size, nodes_initial_color_rs_bs + 2 * nodes_size, bs());
+            resubmit_nodes_colors();
+        }
+    }
+
+    void resubmit_nodes_vertices() const noexcept {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes);
+        const auto actual_size_bytes = 2 * nodes_size * sizeof(float);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, actual_size_bytes, xs());
+        if (features & ColorOutput) resubmit_nodes_colors();
+    }
+
+    // Only the streams that ColorOutput writes
+    void resubmit_nodes_colors() const noexcept {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes);
+        const auto stream_size_bytes = nodes_size * sizeof(float);
+        glBufferSubData(GL_ARRAY_BUFFER, 2 * stream_size_bytes, stream_size_bytes, rs());
+        glBufferSubData(GL_ARRAY_BUFFER, 4 * stream_size_bytes, stream_size_bytes, bs());
+    }
+
+    void set_mvp(const Matrix4f& mvp) noexcept {
+        shader_node.bind();
+        shader_node.setUniformMat4f("u_mvp", mvp);
+    }
+
+    void set_size(const Vec<2>& size) noexcept {
+        world_size = size;
+    }
+
+    void flip_physics() noexcept {
+        physics_on = !physics_on;
+    }
+};
+
+#endif
@@ -0,0 +1,331 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include "Shader.h"
+#include "Texture.h"
+#include "Vec.h"
+#include "util.h"
+
+#include <cmath>
+#include <algorithm>
+#include <optional>
+#include <random>
+#include <limits>
+#include <chrono>
+
+#include <immintrin.h>
+
+#include <GLFW/glfw3.h>
+
+
+// float, double, long double
+// [low, high)
+template<typename T = float>
+T getRandomUniformFloat(T low, T high) {
+    static std::random_device rd;
+    static std::seed_seq seed{1, 2, 3, 300};
+    static std::mt19937 e2(seed);
+    // static std::mt19937 e2(rd());
+    std::uniform_real_distribution<T> dist(low, high);
+
+    return dist(e2);
+}
+
+
+// NOTE The rendered node size is actually set with point size
+static constexpr float NODE_SIZE = 0.2f;
+
+
+struct World {
+    bool physics_on = true;
+
+    Vec<2> world_size;
+
+    unsigned int nodes_size;
+
+    // AoSoA: blocks of 8 nodes, each block is 8 xs, 8 ys, 8 rs, 8 gs, 8 bs.
+    // A block is 160 bytes, so a node never spans more than 3 cache lines
+    // and every field of a block is one aligned AVX load.
+    static constexpr unsigned int block_size = 8;
+    static constexpr unsigned int node_vertex_components = 2 + 3; // x,y + color3
+    static constexpr unsigned int block_floats = block_size * node_vertex_components;
+    static constexpr unsigned int offset_x = 0 * block_size;
+    static constexpr unsigned int offset_y = 1 * block_size;
+    static constexpr unsigned int offset_r = 2 * block_size;
+    static constexpr unsigned int offset_g = 3 * block_size;
+    static constexpr unsigned int offset_b = 4 * block_size;
+    unsigned int blocks_size;
+    float* nodes_blocks;
+
+    // The GPU reads the very same layout through a buffer texture
+    unsigned int vao_nodes;
+    unsigned int vbo_nodes;
+    unsigned int tbo_nodes;
+
+    static constexpr float speed_scaler = 5.0f * 0.0000025f;
+    static constexpr float MAX_MAGNITUDE = 2.0f;
+
+    Shader shader_node{"node_point_aosoa.vert", "node_point.frag"};
+
+
+    World(const Vec<2>& world_size) : world_size(world_size) {
+        prepare_nodes(4 * 500000);
+        glPointSize(0.1f);
+        benchmark_layouts();
+    }
+
+    ~World() {
+        ::operator delete[] (nodes_blocks, std::align_val_t(32));
+        glDeleteTextures(1, &tbo_nodes);
+        glDeleteBuffers(1, &vbo_nodes);
+        glDeleteVertexArrays(1, &vao_nodes);
+    }
+
+    void prepare_nodes(unsigned int count) noexcept {
+        // Whole blocks only
+        blocks_size = (count + block_size - 1) / block_size;
+        nodes_size = blocks_size * block_size;
+        nodes_blocks = new (std::align_val_t(32)) float[blocks_size * block_floats];
+
+        const auto border = 10.5f * NODE_SIZE;
+        for (unsigned int i = 0; i < nodes_size; i++) {
+            const auto x = getRandomUniformFloat(border, world_size[0] - border);
+            const auto y = getRandomUniformFloat(border, world_size[1] - border);
+            float* block = &nodes_blocks[(i / block_size) * block_floats];
+            const unsigned int lane = i % block_size;
+            block[offset_x + lane] = x;
+            block[offset_y + lane] = y;
+            block[offset_r + lane] = x / world_size[0];
+            block[offset_g + lane] = y / world_size[1];
+            block[offset_b + lane] = 0.7f;
+        }
+
+        // No attributes: the vertex shader fetches by gl_VertexID
+        glGenVertexArrays(1, &vao_nodes);
+        glBindVertexArray(vao_nodes);
+
+        glGenBuffers(1, &vbo_nodes);
+        glBindBuffer(GL_TEXTURE_BUFFER, vbo_nodes);
+        const unsigned int size_bytes = blocks_size * block_floats * sizeof(float);
+        glBufferData(GL_TEXTURE_BUFFER, size_bytes, nodes_blocks, GL_DYNAMIC_DRAW);
+
+        int max_texels = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+        if (static_cast<unsigned int>(max_texels) < blocks_size * block_floats) {
+            std::cout << ":> World: " << (blocks_size * block_floats) << " floats do not fit into a buffer texture of "
+                << max_texels << ", only part of the nodes will be drawn\n";
+        }
+
+        glGenTextures(1, &tbo_nodes);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_BUFFER, tbo_nodes);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32F, vbo_nodes);
+
+        shader_node.bind();
+        shader_node.setUniform1i("nodes", 0);
+    }
+
+    void update_and_render(float dt, const Vec<2>& cursor) noexcept {
+        static auto last = get_time_micros();
+        const auto p0 = get_time_micros();
+        if (physics_on) do_physics(dt, cursor);
+        const auto p1 = get_time_micros();
+        resubmit_nodes_vertices();
+        const auto p2 = get_time_micros();
+        render_nodes();
+        const auto p3 = get_time_micros();
+        const auto frame_time = p3 - last;
+        const auto fps = 1'000'000.0f / frame_time;
+        std::cout
+            << "Idle = " << std::setw(5) << (p0 - last) << "  "
+            << "Physics = " << std::setw(5) << (p1 - p0) << "  "
+            << "Resubmit = " << std::setw(5) << (p2 - p1) << "  "
+            << "Render = " << std::setw(5) << (p3 - p2) << "  "
+            << "Frame time = " << std::setw(5) << frame_time << "  "
+            << "FPS = " << std::setw(5) << fps << '\n';
+        last = p3;
+    }
+
+    void render_nodes() const noexcept {
+        glDrawArrays(GL_POINTS, 0, nodes_size);
+    }
+
+    void do_physics(float dt, const Vec<2>& cursor) noexcept {
+        advect_aosoa(nodes_blocks, blocks_size, dt);
+    }
+
+    void advect_aosoa(float* blocks, unsigned int blocks_count, float dt) const noexcept {
+        const __m256 attr_x                                = _mm256_set1_ps((world_size * 0.5f)[0]);
+        const __m256 attr_y                                = _mm256_set1_ps((world_size * 0.5f)[1]);
+        const __m256 one_over_max_attractor                = _mm256_set1_ps(1.0f / world_size.length());
+        const __m256 speed_scaler_mul_max_magnitude_mul_dt = _mm256_set1_ps(speed_scaler * MAX_MAGNITUDE * dt);
+        for (unsigned int b = 0; b < blocks_count; b++) {
+            float* block = &blocks[b * block_floats];
+            __m256 pos_x = _mm256_load_ps(&block[offset_x]);
+            const __m256 x = _mm256_sub_ps(pos_x, attr_x);
+            const __m256 xx = _mm256_mul_ps(x, x);
+
+            __m256 pos_y = _mm256_load_ps(&block[offset_y]);
+            const __m256 y = _mm256_sub_ps(pos_y, attr_y);
+            const __m256 yy = _mm256_mul_ps(y, y);
+
+            const __m256 xx_plus_yy = _mm256_add_ps(xx, yy);
+            const __m256 one_over_length = _mm256_rsqrt_ps(xx_plus_yy);
+
+            const __m256 mul = _mm256_mul_ps(_mm256_sub_ps(one_over_length, one_over_max_attractor), speed_scaler_mul_max_magnitude_mul_dt);
+
+            pos_x = _mm256_add_ps(pos_x, _mm256_mul_ps(y, mul));
+            pos_y = _mm256_sub_ps(pos_y, _mm256_mul_ps(x, mul));
+
+            _mm256_store_ps(&block[offset_x], pos_x);
+            _mm256_store_ps(&block[offset_y], pos_y);
+        }
+    }
+
+    // The loop of World7: xs, then ys
+    void advect_soa(float* xs_ys, unsigned int count, float dt) const noexcept {
+        float* xs = xs_ys;
+        float* ys = xs_ys + count;
+        const __m256 attr_x                                = _mm256_set1_ps((world_size * 0.5f)[0]);
+        const __m256 attr_y                                = _mm256_set1_ps((world_size * 0.5f)[1]);
+        const __m256 one_over_max_attractor                = _mm256_set1_ps(1.0f / world_size.length());
+        const __m256 speed_scaler_mul_max_magnitude_mul_dt = _mm256_set1_ps(speed_scaler * MAX_MAGNITUDE * dt);
+        for (unsigned int i = 0; i < count; i += 8) {
+            __m256 pos_x = _mm256_load_ps(&xs[i]);
+            const __m256 x = _mm256_sub_ps(pos_x, attr_x);
+            const __m256 xx = _mm256_mul_ps(x, x);
+
+            __m256 pos_y = _mm256_load_ps(&ys[i]);
+            const __m256 y = _mm256_sub_ps(pos_y, attr_y);
+            const __m256 yy = _mm256_mul_ps(y, y);
+
+            const __m256 xx_plus_yy = _mm256_add_ps(xx, yy);
+            const __m256 one_over_length = _mm256_rsqrt_ps(xx_plus_yy);
+
+            const __m256 mul = _mm256_mul_ps(_mm256_sub_ps(one_over_length, one_over_max_attractor), speed_scaler_mul_max_magnitude_mul_dt);
+
+            pos_x = _mm256_add_ps(pos_x, _mm256_mul_ps(y, mul));
+            pos_y = _mm256_sub_ps(pos_y, _mm256_mul_ps(x, mul));
+
+            _mm256_store_ps(&xs[i], pos_x);
+            _mm256_store_ps(&ys[i], pos_y);
+        }
+    }
+
+    // The layout of World8: x y r g b per node. The positions of 8 nodes
+    // are transposed into registers and back, the colors are only stepped over.
+    void advect_aos(float* nodes, unsigned int count, float dt) const noexcept {
+        const __m256 attr_x                                = _mm256_set1_ps((world_size * 0.5f)[0]);
+        const __m256 attr_y                                = _mm256_set1_ps((world_size * 0.5f)[1]);
+        const __m256 one_over_max_attractor                = _mm256_set1_ps(1.0f / world_size.length());
+        const __m256 speed_scaler_mul_max_magnitude_mul_dt = _mm256_set1_ps(speed_scaler * MAX_MAGNITUDE * dt);
+        alignas(32) float xs[8];
+        alignas(32) float ys[8];
+        for (unsigned int i = 0; i < count; i += 8) {
+            float* node = &nodes[i * node_vertex_components];
+            for (unsigned int j = 0; j < 8; j++) {
+                xs[j] = node[j * node_vertex_components + 0];
+                ys[j] = node[j * node_vertex_components + 1];
+            }
+            __m256 pos_x = _mm256_load_ps(xs);
+            const __m256 x = _mm256_sub_ps(pos_x, attr_x);
+            const __m256 xx = _mm256_mul_ps(x, x);
+
+            __m256 pos_y = _mm256_load_ps(ys);
+            const __m256 y = _mm256_sub_ps(pos_y, attr_y);
+            const __m256 yy = _mm256_mul_ps(y, y);
+
+            const __m256 xx_plus_yy = _mm256_add_ps(xx, yy);
+            const __m256 one_over_length = _mm256_rsqrt_ps(xx_plus_yy);
+
+            const __m256 mul = _mm256_mul_ps(_mm256_sub_ps(one_over_length, one_over_max_attractor), speed_scaler_mul_max_magnitude_mul_dt);
+
+            pos_x = _mm256_add_ps(pos_x, _mm256_mul_ps(y, mul));
+            pos_y = _mm256_sub_ps(pos_y, _mm256_mul_ps(x, mul));
+
+            _mm256_store_ps(xs, pos_x);
+            _mm256_store_ps(ys, pos_y);
+            for (unsigned int j = 0; j < 8; j++) {
+                node[j * node_vertex_components + 0] = xs[j];
+                node[j * node_vertex_components + 1] = ys[j];
+            }
+        }
+    }
+
+    // The three layouts of the same nodes, with colors, interleaved runs and
+    // the fastest run of each kept, since the machine is busy with other things
+    void benchmark_layouts() const noexcept {
+        constexpr unsigned int runs = 30;
+        constexpr float dt = 16'000.0f;
+        const unsigned int floats = nodes_size * node_vertex_components;
+        float* aosoa = new (std::align_val_t(32)) float[floats];
+        float* soa = new (std::align_val_t(32)) float[floats];
+        float* aos = new (std::align_val_t(32)) float[floats];
+        std::copy(nodes_blocks, nodes_blocks + floats, aosoa);
+        for (unsigned int i = 0; i < nodes_size; i++) {
+            const float* block = &nodes_blocks[(i / block_size) * block_floats];
+            const unsigned int lane = i % block_size;
+            const float fields[node_vertex_components] = {
+                block[offset_x + lane], block[offset_y + lane],
+                block[offset_r + lane], block[offset_g + lane], block[offset_b + lane]
+            };
+            for (unsigned int f = 0; f < node_vertex_components; f++) {
+                soa[f * nodes_size + i] = fields[f];
+                aos[i * node_vertex_components + f] = fields[f];
+            }
+        }
+
+        // get_time_micros() is a float and too coarse for a single run
+        using clock = std::chrono::steady_clock;
+        auto best_aosoa = clock::duration::max();
+        auto best_soa = clock::duration::max();
+        auto best_aos = clock::duration::max();
+        for (unsigned int i = 0; i < runs; i++) {
+            const auto t0 = clock::now();
+            advect_aosoa(aosoa, blocks_size, dt);
+            const auto t1 = clock::now();
+            advect_soa(soa, nodes_size, dt);
+            const auto t2 = clock::now();
+            advect_aos(aos, nodes_size, dt);
+            const auto t3 = clock::now();
+            best_aosoa = std::min(best_aosoa, t1 - t0);
+            best_soa = std::min(best_soa, t2 - t1);
+            best_aos = std::min(best_aos, t3 - t2);
+        }
+
+        const auto ns_per_node = [this](clock::duration d) {
+            return std::chrono::duration<float, std::nano>(d).count() / nodes_size;
+        };
+        std::cout << "Layouts on " << nodes_size << " nodes: "
+            << "AoSoA = " << ns_per_node(best_aosoa) << " ns/node  "
+            << "SoA = " << ns_per_node(best_soa) << " ns/node  "
+            << "AoS = " << ns_per_node(best_aos) << " ns/node\n";
+
+        ::operator delete[] (aosoa, std::align_val_t(32));
+        ::operator delete[] (soa, std::align_val_t(32));
+        ::operator delete[] (aos, std::align_val_t(32));
+    }
+
+    // The colors go along: the positions of a block are not contiguous
+    // across blocks, and one upload is cheaper than one per block
+    void resubmit_nodes_vertices() const noexcept {
+        glBindBuffer(GL_TEXTURE_BUFFER, vbo_nodes);
+        const auto actual_size_bytes = blocks_size * block_floats * sizeof(float);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, actual_size_bytes, nodes_blocks);
+    }
+
+    void set_mvp(const Matrix4f& mvp) noexcept {
+        shader_node.bind();
+        shader_node.setUniformMat4f("u_mvp", mvp);
+    }
+
+    void set_size(const Vec<2>& size) noexcept {
+        world_size = size;
+    }
+
+    void flip_physics() noexcept {
+        physics_on = !physics_on;
+    }
+};
+
+#endif
@@ -0,0 +1,362 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include "Shader.h"
+#include "Texture.h"
+#include "Vec.h"
+#include "VortexKernel.h"
+#include "util.h"
+
+#include <cmath>
+#include <algorithm>
+#include <optional>
+#include <random>
+#include <limits>
+#include <vector>
+#include <array>
+
+#include <GLFW/glfw3.h>
+
+
+// float, double, long double
+// [low, high)
+template<typename T = float>
+T getRandomUniformFloat(T low, T high) {
+    static std::random_device rd;
+    static std::seed_seq seed{1, 2, 3, 300};
+    static std::mt19937 e2(seed);
+    // static std::mt19937 e2(rd());
+    std::uniform_real_distribution<T> dist(low, high);
+
+    return dist(e2);
+}
+
+
+// NOTE The rendered node size is actually set in geometry shader
+static constexpr float NODE_SIZE = 0.2f;
+
+
+struct World {
+    bool physics_on = true;
+
+    Vec<2> world_size;
+
+    unsigned int nodes_size;
+
+    float* nodes_pos_xs_ys;
+    Vec<3>* nodes_color;
+
+    unsigned int vao_nodes;
+    unsigned int vbo_nodes;
+
+    static constexpr unsigned int node_vertex_components = 2 + 3; // x,y + color3
+
+    static constexpr float speed_scaler = 5.0f * 0.0000025f;
+    static constexpr float MAX_MAGNITUDE = 2.0f;
+
+    // The slow nodes are advected every period-th frame with the time of all
+    // those frames. Within a tier the nodes are split into period groups that
+    // take turns, so every frame costs the same. The nodes are kept sorted by
+    // tier, fastest first, and the groups start at multiples of simd::width.
+    struct Tier {
+        unsigned int period;
+        unsigned int begin;
+        unsigned int end;
+        std::vector<unsigned int> group_begins; // period + 1 of them
+        std::vector<float> group_pending_dt;    // time since the group moved
+    };
+    static constexpr unsigned int tier_periods[] = { 1, 2, 4, 8 };
+    static constexpr unsigned int tiers_count = sizeof(tier_periods) / sizeof(tier_periods[0]);
+    Tier tiers[tiers_count];
+    bool scheduler_on = true;
+    unsigned int frame = 0;
+    static constexpr unsigned int retier_interval_frames = 60;
+    // How far (world units) a node may lag behind where it would be if it
+    // were advected every frame; about a pixel at the default zoom
+    static constexpr float max_lag = 0.1f;
+    float reference_dt = 0.0f;
+
+    Shader shader_node{"node_geo_sep.vert", "node.geom", "node.frag"};
+
+
+    World(const Vec<2>& world_size) : world_size(world_size) {
+        prepare_nodes(4 * 500000);
+        for (unsigned int t = 0; t < tiers_count; t++) tiers[t].period = tier_periods[t];
+        // Everything in the fastest tier until the first retier()
+        assign_tier_ranges({ nodes_size, 0, 0, 0 });
+    }
+
+    ~World() {
+        ::operator delete[] (nodes_pos_xs_ys, std::align_val_t(simd::alignment));
+        delete[] nodes_color;
+        glDeleteBuffers(1, &vbo_nodes);
+        glDeleteVertexArrays(1, &vao_nodes);
+    }
+
+    float blend_unchecked(float x, float y, float t) const noexcept {
+        return x * (1.0f - t) + y * t;
+    }
+
+    // Vec<2> cw_dir_perp_to(const Vec<2>& dir) const noexcept {
+    //     Vec<2> v{ dir[1], -dir[0] };
+    //     v.normalize();
+    //     return v;
+    // }
+
+    // Vec<2> speed_at(const Vec<2>& pos, const Vec<2>& attractor) const noexcept {
+    //     const auto max_attractor = world_size;
+    //     constexpr auto MAX_MAGNITUDE = 2.0f;
+    //     const auto t = 1.0f - ((pos - attractor).length_sqr()) / (max_attractor.length_sqr());
+    //     const auto magnitude = MAX_MAGNITUDE * t;
+    //     const auto dir = pos - attractor;
+    //     return cw_dir_perp_to(dir) * magnitude;
+    // }
+
+    void prepare_nodes(unsigned int count) noexcept {
+        nodes_size = count;
+        nodes_pos_xs_ys = new (std::align_val_t(simd::alignment)) float[2 * count];
+        nodes_color = new Vec<3>[count];
+
+        const auto border = 10.5f * NODE_SIZE;
+        for (unsigned int i = 0; i < count; i++) {
+            const auto x = getRandomUniformFloat(border, world_size[0] - border);
+            const auto y = getRandomUniformFloat(border, world_size[1] - border);
+            const auto pos = Vec<2>{ x, y };
+            const auto color = Vec<3>{ x / world_size[0], y / world_size[1], 0.7f };
+            nodes_pos_xs_ys[i]         = pos[0];
+            nodes_pos_xs_ys[count + i] = pos[1];
+            nodes_color[i] = color;
+        }
+
+        glGenVertexArrays(1, &vao_nodes);
+        glBindVertexArray(vao_nodes);
+        {
+            glGenBuffers(1, &vbo_nodes);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes);
+            const unsigned int size_bytes = nodes_size * node_vertex_components * sizeof(float);
+            const float* nodes_data = allocate_and_init_all_nodes_data();
+            glBufferData(GL_ARRAY_BUFFER, size_bytes, nodes_data, GL_DYNAMIC_DRAW);
+            delete[] nodes_data;
+
+            specify_attribs_for_nodes(); // proper GL_ARRAY_BUFFER must be bound!
+        }
+
+        // glBindVertexArray(0);
+        shader_node.bind();
+    }
+
+    void specify_attribs_for_nodes() const noexcept {
+        {
+            const auto index = 0;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 1; // x
+            const auto stride_bytes = 0;
+            const auto offset_bytes = 0;
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+        {
+            const auto index = 1;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 1; // y
+            const auto stride_bytes = 0;
+            const auto offset_bytes = nodes_size * sizeof(float); // skip xs
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+        {
+            const auto index = 2;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 3; // color3
+            const auto stride_bytes = 0;
+            const auto offset_bytes = 2 * nodes_size * sizeof(float); // skip xs and ys
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+    }
+
+    void update_and_render(float dt, const Vec<2>& cursor) noexcept {
+        static auto last = get_time_micros();
+        const auto p0 = get_time_micros();
+        if (physics_on) do_physics(dt, cursor);
+        const auto p1 = get_time_micros();
+        resubmit_nodes_vertices_pos();
+        const auto p2 = get_time_micros();
+        render_nodes();
+        const auto p3 = get_time_micros();
+        const auto frame_time = p3 - last;
+        const auto fps = 1'000'000.0f / frame_time;
+        std::cout
+            << "Idle = " << std::setw(5) << (p0 - last) << "  "
+            << "Physics = " << std::setw(5) << (p1 - p0) << "  "
+            << "Resubmit = " << std::setw(5) << (p2 - p1) << "  "
+            << "Render = " << std::setw(5) << (p3 - p2) << "  "
+            << "Frame time = " << std::setw(5) << frame_time << "  "
+            << "FPS = " << std::setw(5) << fps << "  "
+            << "Updates = " << std::setw(5) << (100.0f * updates_per_frame() / nodes_size) << "%\n";
+        last = p3;
+    }
+
+    void render_nodes() const noexcept {
+        // shader_node.bind();
+        // glBindVertexArray(vao_nodes);
+        glDrawArrays(GL_POINTS, 0, nodes_size);
+        // glBindVertexArray(0);
+    }
+
+    void do_physics(float dt, const Vec<2>& cursor) noexcept {
+        reference_dt = (reference_dt == 0.0f) ? dt : blend_unchecked(reference_dt, dt, 0.1f);
+        if (!scheduler_on) {
+            advect(0, nodes_size, dt);
+            return;
+        }
+        for (auto& tier : tiers) {
+            for (auto& pending : tier.group_pending_dt) pending += dt;
+            const unsigned int group = frame % tier.period;
+            advect(tier.group_begins[group], tier.group_begins[group + 1], tier.group_pending_dt[group]);
+            tier.group_pending_dt[group] = 0.0f;
+        }
+        if (++frame % retier_interval_frames == 0) retier();
+    }
+
+    void advect(unsigned int begin, unsigned int end, float dt) noexcept {
+        advect_vortex(nodes_pos_xs_ys, nodes_size, begin, end, world_size * 0.5f, 1.0f / world_size.length(), speed_scaler * MAX_MAGNITUDE * dt);
+    }
+
+    // Every group catches up with the time it has missed
+    void flush_pending() noexcept {
+        for (auto& tier : tiers) {
+            for (unsigned int group = 0; group < tier.period; group++) {
+                if (tier.group_pending_dt[group] > 0.0f) advect(tier.group_begins[group], tier.group_begins[group + 1], tier.group_pending_dt[group]);
+                tier.group_pending_dt[group] = 0.0f;
+            }
+        }
+    }
+
+    float updates_per_frame() const noexcept {
+        if (!scheduler_on) return nodes_size;
+        float updates = 0.0f;
+        for (const auto& tier : tiers) updates += static_cast<float>(tier.end - tier.begin) / tier.period;
+        return updates;
+    }
+
+    // A node of speed v lags at most (period - 1) * v * dt behind
+    unsigned int tier_of(float x, float y, float one_over_max_attractor, const Vec<2>& attractor, float max_step) const noexcept {
+        const float dx = x - attractor[0];
+        const float dy = y - attractor[1];
+        const float step = std::abs(1.0f - std::sqrt(dx * dx + dy * dy) * one_over_max_attractor) * max_step;
+        unsigned int tier = 0;
+        while (tier + 1 < tiers_count && (tier_periods[tier + 1] - 1) * step <= max_lag) tier++;
+        return tier;
+    }
+
+    // Sorts the nodes by tier again, the speeds change as they move
+    void retier() noexcept {
+        flush_pending();
+        const auto attractor = world_size * 0.5f;
+        const float one_over_max_attractor = 1.0f / world_size.length();
+        // A margin for the frames that take longer than usual
+        const float max_step = speed_scaler * MAX_MAGNITUDE * reference_dt * 1.25f;
+
+        std::vector<unsigned char> tier_of_node(nodes_size);
+        unsigned int counts[tiers_count] = {};
+        for (unsigned int i = 0; i < nodes_size; i++) {
+            tier_of_node[i] = tier_of(nodes_pos_xs_ys[i], nodes_pos_xs_ys[nodes_size + i], one_over_max_attractor, attractor, max_step);
+            counts[tier_of_node[i]]++;
+        }
+
+        unsigned int next[tiers_count];
+        for (unsigned int t = 0, offset = 0; t < tiers_count; offset += counts[t], t++) next[t] = offset;
+        float* sorted_xs_ys = new (std::align_val_t(simd::alignment)) float[2 * nodes_size];
+        Vec<3>* sorted_color = new Vec<3>[nodes_size];
+        for (unsigned int i = 0; i < nodes_size; i++) {
+            const unsigned int j = next[tier_of_node[i]]++;
+            sorted_xs_ys[j]              = nodes_pos_xs_ys[i];
+            sorted_xs_ys[nodes_size + j] = nodes_pos_xs_ys[nodes_size + i];
+            sorted_color[j] = nodes_color[i];
+        }
+        ::operator delete[] (nodes_pos_xs_ys, std::align_val_t(simd::alignment));
+        delete[] nodes_color;
+        nodes_pos_xs_ys = sorted_xs_ys;
+        nodes_color = sorted_color;
+
+        assign_tier_ranges({ counts[0], counts[1], counts[2], counts[3] });
+        std::cout << "Speed tiers (every 1st/2nd/4th/8th frame):";
+        for (const auto& tier : tiers) std::cout << ' ' << (tier.end - tier.begin);
+        std::cout << "  updates per frame = " << updates_per_frame() << '\n';
+
+        // The colors moved with the nodes
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes);
+        const unsigned int size_bytes = nodes_size * node_vertex_components * sizeof(float);
+        const float* nodes_data = allocate_and_init_all_nodes_data();
+        glBufferSubData(GL_ARRAY_BUFFER, 0, size_bytes, nodes_data);
+        delete[] nodes_data;
+    }
+
+    // Boundaries are rounded up to simd::width, which only moves nodes into
+    // a faster tier than they need
+    void assign_tier_ranges(const std::array<unsigned int, tiers_count>& counts) noexcept {
+        const auto round_up = [this](unsigned int i) {
+            return std::min(nodes_size, (i + simd::width - 1) / simd::width * simd::width);
+        };
+        unsigned int sorted_end = 0;
+        unsigned int begin = 0;
+        for (unsigned int t = 0; t < tiers_count; t++) {
+            auto& tier = tiers[t];
+            sorted_end += counts[t];
+            tier.begin = begin;
+            tier.end = std::max(begin, round_up(sorted_end));
+            tier.group_begins.resize(tier.period + 1);
+            tier.group_pending_dt.assign(tier.period, 0.0f);
+            const unsigned int size = tier.end - tier.begin;
+            for (unsigned int group = 0; group < tier.period; group++) {
+                tier.group_begins[group] = std::min(tier.end, tier.begin + round_up(static_cast<unsigned int>(static_cast<unsigned long>(size) * group / tier.period)));
+            }
+            tier.group_begins[tier.period] = tier.end;
+            begin = tier.end;
+        }
+    }
+
+    void flip_scheduler() noexcept {
+        flush_pending();
+        scheduler_on = !scheduler_on;
+        std::cout << "Speed tiers " << (scheduler_on ? "on" : "off") << '\n';
+    }
+
+    float* allocate_and_init_all_nodes_data() const noexcept {
+        const auto count = nodes_size * node_vertex_components;
+        float* nodes_data = new float[count];
+        unsigned int i = 0;
+
+        for (; i < 2 * nodes_size; i++) { // xy
+            nodes_data[i] = nodes_pos_xs_ys[i];
+        }
+
+        for (unsigned int j = 0; j < nodes_size; j++, i += 3) { // color3
+            nodes_data[i + 0] = nodes_color[j][0];
+            nodes_data[i + 1] = nodes_color[j][1];
+            nodes_data[i + 2] = nodes_color[j][2];
+        }
+
+        return nodes_data;
+    }
+
+    void resubmit_nodes_vertices_pos() const noexcept {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes);
+        const auto count = nodes_size * 2;
+        const auto actual_size_bytes = count * sizeof(float);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, actual_size_bytes, nodes_pos_xs_ys);
+    }
+
+    void set_mvp(const Matrix4f& mvp) noexcept {
+        shader_node.bind();
+        shader_node.setUniformMat4f("u_mvp", mvp);
+    }
+
+    void set_size(const Vec<2>& size) noexcept {
+        world_size = size;
+    }
+
+    void flip_physics() noexcept {
+        physics_on = !physics_on;
+    }
+};
+
+#endif
@@ -0,0 +1,390 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include "Shader.h"
+#include "Texture.h"
+#include "Vec.h"
+#include "VortexKernel.h"
+#include "ThreadPool.h"
+#include "AutoTuner.h"
+#include "util.h"
+
+#include <cmath>
+#include <algorithm>
+#include <optional>
+#include <random>
+#include <limits>
+#include <vector>
+#include <chrono>
+
+#include <GLFW/glfw3.h>
+
+
+// float, double, long double
+// [low, high)
+template<typename T = float>
+T getRandomUniformFloat(T low, T high) {
+    static std::random_device rd;
+    static std::seed_seq seed{1, 2, 3, 300};
+    static std::mt19937 e2(seed);
+    // static std::mt19937 e2(rd());
+    std::uniform_real_distribution<T> dist(low, high);
+
+    return dist(e2);
+}
+
+
+// NOTE The rendered node size is actually set in geometry shader
+static constexpr float NODE_SIZE = 0.2f;
+
+
+struct World {
+    bool physics_on = true;
+
+    Vec<2> world_size;
+
+    unsigned int nodes_size;
+
+    float* nodes_pos_xs_ys;
+    Vec<3>* nodes_color;
+
+    unsigned int vao_nodes;
+    unsigned int vbo_nodes;
+
+    static constexpr unsigned int node_vertex_components = 2 + 3; // x,y + color3
+
+    Shader shader_node{"node_geo_sep.vert", "node.geom", "node.frag"};
+
+    // Both picked by tune(), once per machine
+    std::optional<ThreadPool> pool;
+    unsigned int nodes_per_task = 1 << 15; // at most 1 << 16, for the float sums of a lane to stay short
+
+    // Gathered by the advection loop itself, one per thread, merged after it,
+    // every statistics_every frames: as often as fits in statistics_budget
+    // of the physics time, see benchmark_statistics()
+    bool statistics_on = true;
+    static constexpr float statistics_budget = 0.05f;
+    unsigned int statistics_every = 1;
+    unsigned int frames_since_statistics = 0;
+    std::vector<VortexStatistics> thread_statistics;
+    std::optional<VortexStatistics> statistics; // of the last step that gathered them
+
+
+    World(const Vec<2>& world_size) : world_size(world_size) {
+        prepare_nodes(4 * 500000);
+        tune();
+        benchmark_statistics();
+    }
+
+    ~World() {
+        ::operator delete[] (nodes_pos_xs_ys, std::align_val_t(simd::alignment));
+        delete[] nodes_color;
+        glDeleteBuffers(1, &vbo_nodes);
+        glDeleteVertexArrays(1, &vao_nodes);
+    }
+
+    float blend_unchecked(float x, float y, float t) const noexcept {
+        return x * (1.0f - t) + y * t;
+    }
+
+    // Vec<2> cw_dir_perp_to(const Vec<2>& dir) const noexcept {
+    //     Vec<2> v{ dir[1], -dir[0] };
+    //     v.normalize();
+    //     return v;
+    // }
+
+    // Vec<2> speed_at(const Vec<2>& pos, const Vec<2>& attractor) const noexcept {
+    //     const auto max_attractor = world_size;
+    //     constexpr auto MAX_MAGNITUDE = 2.0f;
+    //     const auto t = 1.0f - ((pos - attractor).length_sqr()) / (max_attractor.length_sqr());
+    //     const auto magnitude = MAX_MAGNITUDE * t;
+    //     const auto dir = pos - attractor;
+    //     return cw_dir_perp_to(dir) * magnitude;
+    // }
+
+    void prepare_nodes(unsigned int count) noexcept {
+        nodes_size = count;
+        nodes_pos_xs_ys = new (std::align_val_t(simd::alignment)) float[2 * count];
+        nodes_color = new Vec<3>[count];
+
+        const auto border = 10.5f * NODE_SIZE;
+        for (unsigned int i = 0; i < count; i++) {
+            const auto x = getRandomUniformFloat(border, world_size[0] - border);
+            const auto y = getRandomUniformFloat(border, world_size[1] - border);
+            const auto pos = Vec<2>{ x, y };
+            const auto color = Vec<3>{ x / world_size[0], y / world_size[1], 0.7f };
+            nodes_pos_xs_ys[i]         = pos[0];
+            nodes_pos_xs_ys[count + i] = pos[1];
+            nodes_color[i] = color;
+        }
+
+        glGenVertexArrays(1, &vao_nodes);
+        glBindVertexArray(vao_nodes);
+        {
+            glGenBuffers(1, &vbo_nodes);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes);
+            const unsigned int size_bytes = nodes_size * node_vertex_components * sizeof(float);
+            const float* nodes_data = allocate_and_init_all_nodes_data();
+            glBufferData(GL_ARRAY_BUFFER, size_bytes, nodes_data, GL_DYNAMIC_DRAW);
+            delete[] nodes_data;
+
+            specify_attribs_for_nodes(); // proper GL_ARRAY_BUFFER must be bound!
+        }
+
+        // glBindVertexArray(0);
+        shader_node.bind();
+    }
+
+    void specify_attribs_for_nodes() const noexcept {
+        {
+            const auto index = 0;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 1; // x
+            const auto stride_bytes = 0;
+            const auto offset_bytes = 0;
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+        {
+            const auto index = 1;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 1; // y
+            const auto stride_bytes = 0;
+            const auto offset_bytes = nodes_size * sizeof(float); // skip xs
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+        {
+            const auto index = 2;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 3; // color3
+            const auto stride_bytes = 0;
+            const auto offset_bytes = 2 * nodes_size * sizeof(float); // skip xs and ys
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+    }
+
+    void update_and_render(float dt, const Vec<2>& cursor) noexcept {
+        static auto last = get_time_micros();
+        const auto p0 = get_time_micros();
+        if (physics_on) do_physics(dt, cursor);
+        const auto p1 = get_time_micros();
+        resubmit_nodes_vertices_pos();
+        const auto p2 = get_time_micros();
+        render_nodes();
+        const auto p3 = get_time_micros();
+        const auto frame_time = p3 - last;
+        const auto fps = 1'000'000.0f / frame_time;
+        std::cout
+            << "Idle = " << std::setw(5) << (p0 - last) << "  "
+            << "Physics = " << std::setw(5) << (p1 - p0) << "  "
+            << "Resubmit = " << std::setw(5) << (p2 - p1) << "  "
+            << "Render = " << std::setw(5) << (p3 - p2) << "  "
+            << "Frame time = " << std::setw(5) << frame_time << "  "
+            << "FPS = " << std::setw(5) << fps;
+        if (statistics_on && statistics) {
+            std::cout << "  "
+                << "Radius = " << std::setw(5) << statistics->mean_radius()
+                << " +- " << std::setw(5) << std::sqrt(statistics->radius_variance()) << "  "
+                << "L = " << std::setw(5) << statistics->angular_momentum(1.0f / world_size.length(), speed_scaler * MAX_MAGNITUDE) << "  "
+                << "Box = [" << statistics->min[0] << ", " << statistics->min[1] << "]-["
+                             << statistics->max[0] << ", " << statistics->max[1] << "]  "
+                << "Escaped = " << static_cast<unsigned long>(statistics->escaped);
+        }
+        std::cout << '\n';
+        last = p3;
+    }
+
+    void render_nodes() const noexcept {
+        // shader_node.bind();
+        // glBindVertexArray(vao_nodes);
+        glDrawArrays(GL_POINTS, 0, nodes_size);
+        // glBindVertexArray(0);
+    }
+
+    static constexpr float speed_scaler = 5.0f * 0.0000025f;
+    static constexpr auto MAX_MAGNITUDE = 2.0f;
+
+    void do_physics(float dt, const Vec<2>& cursor) noexcept {
+        const bool gather = statistics_on && (++frames_since_statistics >= statistics_every);
+        if (gather) frames_since_statistics = 0;
+        step(dt, gather);
+    }
+
+    void step(float dt, bool gather_statistics) noexcept {
+        const auto attractor = world_size * 0.5f;
+        const float one_over_max_attractor = 1.0f / world_size.length();
+        const float k = speed_scaler * MAX_MAGNITUDE * dt;
+        if (!gather_statistics) {
+            pool->parallel_for(nodes_size, nodes_per_task, [&](std::size_t begin, std::size_t end, unsigned int) {
+                advect_vortex(nodes_pos_xs_ys, nodes_size, begin, end, attractor, one_over_max_attractor, k);
+            });
+            return;
+        }
+
+        thread_statistics.assign(pool->size, VortexStatistics{ world_size });
+        pool->parallel_for(nodes_size, nodes_per_task, [&](std::size_t begin, std::size_t end, unsigned int thread_index) {
+            advect_vortex(nodes_pos_xs_ys, nodes_size, begin, end, attractor, one_over_max_attractor, k, thread_statistics[thread_index]);
+        });
+        statistics.emplace(world_size);
+        for (const auto& s : thread_statistics) statistics->merge(s);
+    }
+
+    // The thread count and the task size, timed on the real step on a copy of
+    // the nodes; more threads than cores and smaller tasks than the cache can
+    // hold both lose, but where exactly differs between the machines
+    void tune() noexcept {
+        struct Candidate {
+            unsigned int threads;
+            unsigned int nodes_per_task;
+        };
+        const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<Candidate> candidates;
+        std::vector<std::string> names;
+        for (unsigned int threads = 1; ; threads = std::min(2 * threads, cores)) {
+            for (unsigned int task : { 1u << 13, 1u << 14, 1u << 15, 1u << 16 }) {
+                candidates.push_back(Candidate{ threads, task });
+                names.push_back("threads=" + std::to_string(threads) + ",nodes_per_task=" + std::to_string(task));
+            }
+            if (threads == cores) break;
+        }
+
+        float* saved = new (std::align_val_t(simd::alignment)) float[2 * nodes_size];
+        std::copy(nodes_pos_xs_ys, nodes_pos_xs_ys + 2 * nodes_size, saved);
+        const auto use = [&](const Candidate& candidate) {
+            if (!pool || pool->size != candidate.threads) {
+                pool.reset(); // joins the old workers first
+                pool.emplace(candidate.threads);
+            }
+            nodes_per_task = candidate.nodes_per_task;
+        };
+
+        const AutoTuner tuner("fluid_tuning.txt", "World21-" + std::to_string(nodes_size) + "-nodes-" + simd::backend);
+        const unsigned int picked = tuner.pick(names, [&](unsigned int i) {
+            use(candidates[i]);
+            const auto t0 = std::chrono::steady_clock::now();
+            step(16'000.0f, false);
+            const auto t1 = std::chrono::steady_clock::now();
+            return std::chrono::duration<float, std::milli>(t1 - t0).count(); // ms
+        });
+        use(candidates[picked]);
+        statistics.reset();
+
+        std::copy(saved, saved + 2 * nodes_size, nodes_pos_xs_ys);
+        ::operator delete[] (saved, std::align_val_t(simd::alignment));
+    }
+
+    // What the fused loop replaces: the same summary in a pass of its own
+    VortexStatistics statistics_pass(const Vec<2>& attractor) const noexcept {
+        VortexStatistics s{ world_size };
+        const float* xs = nodes_pos_xs_ys;
+        const float* ys = nodes_pos_xs_ys + nodes_size;
+        for (unsigned int i = 0; i < nodes_size; i++) {
+            const float x = xs[i] - attractor[0];
+            const float y = ys[i] - attractor[1];
+            const float r2 = x * x + y * y;
+            s.count += 1.0;
+            s.sum_radius += std::sqrt(r2);
+            s.sum_radius_sqr += r2;
+            s.min[0] = std::min(s.min[0], xs[i]);
+            s.min[1] = std::min(s.min[1], ys[i]);
+            s.max[0] = std::max(s.max[0], xs[i]);
+            s.max[1] = std::max(s.max[1], ys[i]);
+            if (xs[i] < 0.0f || ys[i] < 0.0f || xs[i] > world_size[0] || ys[i] > world_size[1]) s.escaped += 1.0;
+        }
+        return s;
+    }
+
+    // The parallel step without the statistics, with them fused and with
+    // them in a separate scalar pass, on a copy of the nodes, interleaved and
+    // the fastest run of each kept. The fused loop alone may cost more than
+    // statistics_budget (its 6 operations per 8 nodes show as soon as the
+    // step is not bound by memory), so statistics_every is set from what it
+    // costs here, for the average over the frames to stay within the budget.
+    void benchmark_statistics() noexcept {
+        constexpr unsigned int runs = 30;
+        constexpr float dt = 16'000.0f;
+        float* saved = new (std::align_val_t(simd::alignment)) float[2 * nodes_size];
+        std::copy(nodes_pos_xs_ys, nodes_pos_xs_ys + 2 * nodes_size, saved);
+
+        using clock = std::chrono::steady_clock;
+        auto best_plain = clock::duration::max();
+        auto best_fused = clock::duration::max();
+        auto best_separate = clock::duration::max();
+        for (unsigned int i = 0; i < runs; i++) {
+            const auto t0 = clock::now();
+            step(dt, false);
+            const auto t1 = clock::now();
+            step(dt, true);
+            const auto t2 = clock::now();
+            step(dt, false);
+            statistics.emplace(statistics_pass(world_size * 0.5f));
+            const auto t3 = clock::now();
+            best_plain = std::min(best_plain, t1 - t0);
+            best_fused = std::min(best_fused, t2 - t1);
+            best_separate = std::min(best_separate, t3 - t2);
+        }
+        statistics.reset();
+
+        const float ms_plain = std::chrono::duration<float, std::milli>(best_plain).count();
+        const float ms_fused = std::chrono::duration<float, std::milli>(best_fused).count();
+        const float ms_separate = std::chrono::duration<float, std::milli>(best_separate).count();
+        const float fused_cost = ms_fused / ms_plain - 1.0f;
+        constexpr unsigned int max_every = 60; // still once a second at 60 FPS
+        statistics_every = std::clamp(static_cast<unsigned int>(std::ceil(fused_cost / statistics_budget)), 1u, max_every);
+        frames_since_statistics = 0;
+        std::cout << "Physics on " << nodes_size << " nodes, " << pool->size << " threads: "
+            << "plain = " << ms_plain << " ms  "
+            << "fused statistics = " << ms_fused << " ms (+" << (100.0f * fused_cost) << "%)  "
+            << "separate pass = " << ms_separate << " ms (+" << (100.0f * (ms_separate / ms_plain - 1.0f)) << "%)\n"
+            << "Statistics every " << statistics_every << " frames: +" << (100.0f * fused_cost / statistics_every)
+            << "% of the physics time on average (budget " << (100.0f * statistics_budget) << "%)\n";
+
+        std::copy(saved, saved + 2 * nodes_size, nodes_pos_xs_ys);
+        ::operator delete[] (saved, std::align_val_t(simd::alignment));
+    }
+
+    float* allocate_and_init_all_nodes_data() const noexcept {
+        const auto count = nodes_size * node_vertex_components;
+        float* nodes_data = new float[count];
+        unsigned int i = 0;
+
+        for (; i < 2 * nodes_size; i++) { // xy
+            nodes_data[i] = nodes_pos_xs_ys[i];
+        }
+
+        for (unsigned int j = 0; j < nodes_size; j++, i += 3) { // color3
+            nodes_data[i + 0] = nodes_color[j][0];
+            nodes_data[i + 1] = nodes_color[j][1];
+            nodes_data[i + 2] = nodes_color[j][2];
+        }
+
+        return nodes_data;
+    }
+
+    void resubmit_nodes_vertices_pos() const noexcept {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes);
+        const auto count = nodes_size * 2;
+        const auto actual_size_bytes = count * sizeof(float);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, actual_size_bytes, nodes_pos_xs_ys);
+    }
+
+    void set_mvp(const Matrix4f& mvp) noexcept {
+        shader_node.bind();
+        shader_node.setUniformMat4f("u_mvp", mvp);
+    }
+
+    void set_size(const Vec<2>& size) noexcept {
+        world_size = size;
+    }
+
+    void flip_physics() noexcept {
+        physics_on = !physics_on;
+    }
+
+    void flip_statistics() noexcept {
+        statistics_on = !statistics_on;
+        statistics.reset();
+        std::cout << "Statistics " << (statistics_on ? "on" : "off") << '\n';
+    }
+};
+
+#endif
@@ -0,0 +1,590 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include "Shader.h"
+#include "Texture.h"
+#include "Vec.h"
+#include "VortexKernel.h"
+#include "ThreadPool.h"
+#include "AutoTuner.h"
+#include "util.h"
+
+#include <cmath>
+#include <algorithm>
+#include <optional>
+#include <random>
+#include <limits>
+#include <vector>
+#include <chrono>
+#include <string>
+
+#include <GLFW/glfw3.h>
+
+
+// float, double, long double
+// [low, high)
+template<typename T = float>
+T getRandomUniformFloat(T low, T high) {
+    static std::random_device rd;
+    static std::seed_seq seed{1, 2, 3, 300};
+    static std::mt19937 e2(seed);
+    // static std::mt19937 e2(rd());
+    std::uniform_real_distribution<T> dist(low, high);
+
+    return dist(e2);
+}
+
+
+// NOTE The rendered node size is actually set with point size
+static constexpr float NODE_SIZE = 0.2f;
+
+
+struct World {
+    bool physics_on = true;
+
+    Vec<2> world_size;
+
+    unsigned int nodes_size;
+
+    // Nodes [0, split) are advected on the CPU (the loop of World21 on the
+    // ThreadPool), nodes [split, nodes_size) in the vertex shader with the
+    // transform feedback of World8, as in World13. Picked by tune() and kept:
+    // nodes_size is all on the CPU, 0 all on the GPU.
+    unsigned int split;
+
+    // Has room for all nodes, but only [0, split) is up to date
+    float* nodes_pos_xs_ys;
+    Vec<3>* nodes_color;
+
+    // CPU part: xs, ys, colors
+    unsigned int vao_cpu_nodes;
+    unsigned int vbo_cpu_nodes;
+
+    // GPU part: interleaved, ping-pong through transform feedback
+    unsigned int vao_nodes[2];
+    unsigned int vbo_nodes[2];
+    unsigned int tfo_nodes[2];
+    unsigned int swap_index = 0;
+
+    static constexpr unsigned int node_vertex_components = 2 + 3; // x,y + color3
+
+    static constexpr float speed_scaler = 5.0f * 0.0000025f;
+    static constexpr float MAX_MAGNITUDE = 2.0f;
+
+    static constexpr const char* const transform_variables[] = { "DataBlock.new_pos", "DataBlock.color" };
+    Shader shader_node = Shader("node_sep_calc.vert", "node_point.frag", transform_variables, 2);
+    Shader shader_cpu_node{"node_point_sep.vert", "node_point.frag"};
+
+    // Both draws of a frame, read a few frames late, so that asking never stalls
+    static constexpr unsigned int query_ring_size = 4;
+    unsigned int queries[query_ring_size];
+    bool query_issued[query_ring_size] = {};
+    unsigned int query_index = 0;
+    float gpu_micros = 0.0f;
+
+    // Picked by tune(), once per machine, with split
+    std::optional<ThreadPool> pool;
+    unsigned int nodes_per_task = 1 << 15; // at most 1 << 16, for the float sums of a lane to stay short
+
+    // Gathered by the CPU loop itself, so of the CPU part only (none when all
+    // is on the GPU); otherwise as in World21
+    bool statistics_on = true;
+    static constexpr float statistics_budget = 0.05f;
+    unsigned int statistics_every = 1;
+    unsigned int frames_since_statistics = 0;
+    std::vector<VortexStatistics> thread_statistics;
+    std::optional<VortexStatistics> statistics; // of the last step that gathered them
+
+
+    World(const Vec<2>& world_size) : world_size(world_size) {
+        prepare_nodes(4 * 500000);
+        glPointSize(0.1f);
+        tune();
+        benchmark_statistics();
+    }
+
+    ~World() {
+        ::operator delete[] (nodes_pos_xs_ys, std::align_val_t(simd::alignment));
+        delete[] nodes_color;
+        glDeleteQueries(query_ring_size, queries);
+        glDeleteTransformFeedbacks(2, tfo_nodes);
+        glDeleteBuffers(2, vbo_nodes);
+        glDeleteVertexArrays(2, vao_nodes);
+        glDeleteBuffers(1, &vbo_cpu_nodes);
+        glDeleteVertexArrays(1, &vao_cpu_nodes);
+    }
+
+    float blend_unchecked(float x, float y, float t) const noexcept {
+        return x * (1.0f - t) + y * t;
+    }
+
+    void prepare_nodes(unsigned int count) noexcept {
+        nodes_size = count;
+        nodes_pos_xs_ys = new (std::align_val_t(simd::alignment)) float[2 * count];
+        nodes_color = new Vec<3>[count];
+
+        const auto border = 10.5f * NODE_SIZE;
+        for (unsigned int i = 0; i < count; i++) {
+            const auto x = getRandomUniformFloat(border, world_size[0] - border);
+            const auto y = getRandomUniformFloat(border, world_size[1] - border);
+            const auto color = Vec<3>{ x / world_size[0], y / world_size[1], 0.7f };
+            nodes_pos_xs_ys[i]         = x;
+            nodes_pos_xs_ys[count + i] = y;
+            nodes_color[i] = color;
+        }
+
+        // Until tune() has picked
+        split = nodes_size;
+
+        glGenVertexArrays(1, &vao_cpu_nodes);
+        glBindVertexArray(vao_cpu_nodes);
+        {
+            glGenBuffers(1, &vbo_cpu_nodes);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_cpu_nodes);
+            const unsigned int size_bytes = nodes_size * node_vertex_components * sizeof(float);
+            const float* nodes_data = allocate_and_init_cpu_nodes_data();
+            // Room for all nodes, so that any split fits
+            glBufferData(GL_ARRAY_BUFFER, size_bytes, nodes_data, GL_DYNAMIC_DRAW);
+            delete[] nodes_data;
+
+            specify_attribs_for_cpu_nodes(); // proper GL_ARRAY_BUFFER must be bound!
+        }
+
+        for (unsigned int i = 0; i < 2; i++) {
+            glGenVertexArrays(1, &vao_nodes[i]);
+            glBindVertexArray(vao_nodes[i]);
+            {
+                glGenBuffers(1, &vbo_nodes[i]);
+                glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes[i]);
+                const unsigned int size_bytes = nodes_size * node_vertex_components * sizeof(float);
+                // Both, since tune() moves the split back and forth
+                const float* nodes_data = allocate_and_init_all_nodes_data();
+                glBufferData(GL_ARRAY_BUFFER, size_bytes, nodes_data, GL_DYNAMIC_COPY);
+                delete[] nodes_data;
+
+                specify_attribs_for_nodes(); // proper GL_ARRAY_BUFFER must be bound!
+            }
+        }
+
+        glBindVertexArray(0);
+
+        glGenTransformFeedbacks(2, tfo_nodes);
+        glGenQueries(query_ring_size, queries);
+
+        shader_node.bind();
+        set_field_uniforms();
+    }
+
+    void specify_attribs_for_nodes() const noexcept {
+        {
+            const auto index = 0;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 2; // xy
+            const auto stride_bytes = 5 * sizeof(float);
+            const auto offset_bytes = 0;
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+        {
+            const auto index = 1;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 3; // color3
+            const auto stride_bytes = 5 * sizeof(float);
+            const auto offset_bytes = 2 * sizeof(float); // skip all xy
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+    }
+
+    void specify_attribs_for_cpu_nodes() const noexcept {
+        {
+            const auto index = 0;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 1; // x
+            const auto stride_bytes = 0;
+            const auto offset_bytes = 0;
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+        {
+            const auto index = 1;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 1; // y
+            const auto stride_bytes = 0;
+            const auto offset_bytes = nodes_size * sizeof(float); // skip xs
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+        {
+            const auto index = 2;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 3; // color3
+            const auto stride_bytes = 0;
+            const auto offset_bytes = 2 * nodes_size * sizeof(float); // skip xs and ys
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+    }
+
+    // The GPU part is written at its own place in the buffers, as in World13.
+    // GL does not take an empty range, and without a GPU part none is needed.
+    void bind_transform_feedback_ranges() const noexcept {
+        if (split == nodes_size) return;
+        const unsigned int stride_bytes = node_vertex_components * sizeof(float);
+        for (unsigned int i = 0; i < 2; i++) {
+            glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tfo_nodes[i]);
+            glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, vbo_nodes[i], split * stride_bytes, (nodes_size - split) * stride_bytes);
+        }
+        glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+    }
+
+    // The GPU part from nodes_pos_xs_ys, into the buffer the next frame reads;
+    // once split is picked, so nothing has to move between the sides after that
+    void upload_gpu_part() const noexcept {
+        const unsigned int stride_bytes = node_vertex_components * sizeof(float);
+        float* nodes_data = new float[(nodes_size - split) * node_vertex_components];
+        for (unsigned int j = split, i = 0; j < nodes_size; j++, i += 5) {
+            nodes_data[i + 0] = nodes_pos_xs_ys[j];
+            nodes_data[i + 1] = nodes_pos_xs_ys[nodes_size + j];
+            nodes_data[i + 2] = nodes_color[j][0];
+            nodes_data[i + 3] = nodes_color[j][1];
+            nodes_data[i + 4] = nodes_color[j][2];
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes[swap_index]);
+        glBufferSubData(GL_ARRAY_BUFFER, split * stride_bytes, (nodes_size - split) * stride_bytes, nodes_data);
+        delete[] nodes_data;
+    }
+
+    void update_and_render(float dt, const Vec<2>& cursor) noexcept {
+        static auto last = get_time_micros();
+        const auto p0 = get_time_micros();
+        if (physics_on) do_physics(dt, cursor);
+        const auto p1 = get_time_micros();
+        resubmit_nodes_vertices_pos();
+        const auto p2 = get_time_micros();
+        render_nodes();
+        const auto p3 = get_time_micros();
+        collect_gpu_time();
+        const auto frame_time = p3 - last;
+        const auto fps = 1'000'000.0f / frame_time;
+        std::cout
+            << "Idle = " << std::setw(5) << (p0 - last) << "  "
+            << "Physics = " << std::setw(5) << (p1 - p0) << "  "
+            << "Resubmit = " << std::setw(5) << (p2 - p1) << "  "
+            << "Render = " << std::setw(5) << (p3 - p2) << "  "
+            << "GPU = " << std::setw(5) << gpu_micros << "  "
+            << "Frame time = " << std::setw(5) << frame_time << "  "
+            << "FPS = " << std::setw(5) << fps << "  "
+            << "CPU share = " << std::setw(5) << (100.0f * split / nodes_size) << "%";
+        if (statistics_on && statistics) {
+            std::cout << "  "
+                << "Radius = " << std::setw(5) << statistics->mean_radius()
+                << " +- " << std::setw(5) << std::sqrt(statistics->radius_variance()) << "  "
+                << "L = " << std::setw(5) << statistics->angular_momentum(1.0f / world_size.length(), speed_scaler * MAX_MAGNITUDE) << "  "
+                << "Box = [" << statistics->min[0] << ", " << statistics->min[1] << "]-["
+                             << statistics->max[0] << ", " << statistics->max[1] << "]  "
+                << "Escaped = " << static_cast<unsigned long>(statistics->escaped);
+        }
+        std::cout << '\n';
+        last = p3;
+    }
+
+    void render_nodes() noexcept {
+        const auto query = query_index % query_ring_size;
+        glBeginQuery(GL_TIME_ELAPSED, queries[query]);
+
+        if (split > 0) {
+            shader_cpu_node.bind();
+            glBindVertexArray(vao_cpu_nodes);
+            glDrawArrays(GL_POINTS, 0, split);
+        }
+
+        if (split < nodes_size) {
+            shader_node.bind();
+            glBindVertexArray(vao_nodes[swap_index]);
+            // Transform feedback goes into the other VBO, at the same offset
+            glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, tfo_nodes[1 - swap_index]);
+            glBeginTransformFeedback(GL_POINTS);
+            glDrawArrays(GL_POINTS, split, nodes_size - split);
+            glEndTransformFeedback();
+            glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+            swap_index = 1 - swap_index;
+        }
+
+        glEndQuery(GL_TIME_ELAPSED);
+        query_issued[query] = true;
+        query_index++;
+
+        glFlush();
+    }
+
+    // Takes the result of the oldest query, if it is there already
+    void collect_gpu_time() noexcept {
+        const auto query = query_index % query_ring_size;
+        if (!query_issued[query]) return;
+        int available = 0;
+        glGetQueryObjectiv(queries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) return;
+        query_issued[query] = false;
+        GLuint64 nanos = 0;
+        glGetQueryObjectui64v(queries[query], GL_QUERY_RESULT, &nanos);
+        gpu_micros = nanos / 1000.0f;
+    }
+
+    // Of the frame just rendered; waits for the GPU, so for tune() only
+    float wait_for_gpu_micros() noexcept {
+        const auto query = (query_index - 1) % query_ring_size;
+        query_issued[query] = false;
+        GLuint64 nanos = 0;
+        glGetQueryObjectui64v(queries[query], GL_QUERY_RESULT, &nanos);
+        return nanos / 1000.0f;
+    }
+
+    void do_physics(float dt, const Vec<2>& cursor) noexcept {
+        const bool gather = statistics_on && (split > 0) && (++frames_since_statistics >= statistics_every);
+        if (gather) frames_since_statistics = 0;
+        step(dt, gather);
+    }
+
+    // The CPU part; the GPU part goes with the next render_nodes()
+    void step(float dt, bool gather_statistics) noexcept {
+        shader_node.bind();
+        shader_node.setUniform1f("speed_scaler_mul_max_magnitude_mul_dt", speed_scaler * MAX_MAGNITUDE * dt);
+        if (split == 0) return;
+
+        const auto attractor = world_size * 0.5f;
+        const float one_over_max_attractor = 1.0f / world_size.length();
+        const float k = speed_scaler * MAX_MAGNITUDE * dt;
+        if (!gather_statistics) {
+            pool->parallel_for(split, nodes_per_task, [&](std::size_t begin, std::size_t end, unsigned int) {
+                advect_vortex(nodes_pos_xs_ys, nodes_size, begin, end, attractor, one_over_max_attractor, k);
+            });
+            return;
+        }
+
+        thread_statistics.assign(pool->size, VortexStatistics{ world_size });
+        pool->parallel_for(split, nodes_per_task, [&](std::size_t begin, std::size_t end, unsigned int thread_index) {
+            advect_vortex(nodes_pos_xs_ys, nodes_size, begin, end, attractor, one_over_max_attractor, k, thread_statistics[thread_index]);
+        });
+        statistics.emplace(world_size);
+        for (const auto& s : thread_statistics) statistics->merge(s);
+    }
+
+    // Where the nodes go (all on the CPU, all on the GPU with transform
+    // feedback, or split between them), and for the CPU the thread count and
+    // the task size. A candidate is timed on a whole frame: the CPU side (step
+    // and upload) with the CPU clock and both draws with a GL_TIME_ELAPSED
+    // query. The CPU prepares a frame while the GPU draws the one before, so
+    // the slower of the two is what the frame takes, as in World13.
+    void tune() noexcept {
+        struct Candidate {
+            unsigned int split;
+            unsigned int threads;
+            unsigned int nodes_per_task;
+        };
+        const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<Candidate> candidates;
+        std::vector<std::string> names;
+        // CPU shares of 100%, 75%, 50%, 25%; a multiple of 8 keeps the CPU part whole for the SIMD loop
+        for (unsigned int quarters = 4; quarters >= 1; quarters--) {
+            const unsigned int cpu_nodes = (nodes_size / 4 * quarters) & ~0b111u;
+            const std::string strategy = (quarters == 4) ? "cpu" : "split-" + std::to_string(25 * quarters) + "%";
+            for (unsigned int threads = 1; ; threads = std::min(2 * threads, cores)) {
+                for (unsigned int task : { 1u << 13, 1u << 14, 1u << 15, 1u << 16 }) {
+                    candidates.push_back(Candidate{ cpu_nodes, threads, task });
+                    names.push_back("strategy=" + strategy + ",threads=" + std::to_string(threads) + ",nodes_per_task=" + std::to_string(task));
+                }
+                if (threads == cores) break;
+            }
+        }
+        // The threads do not matter then, so one is enough
+        candidates.push_back(Candidate{ 0, 1, 1u << 15 });
+        names.push_back("strategy=tf");
+
+        float* saved = new (std::align_val_t(simd::alignment)) float[2 * nodes_size];
+        std::copy(nodes_pos_xs_ys, nodes_pos_xs_ys + 2 * nodes_size, saved);
+        const auto use = [&](const Candidate& candidate) {
+            if (!pool || pool->size != candidate.threads) {
+                pool.reset(); // joins the old workers first
+                pool.emplace(candidate.threads);
+            }
+            nodes_per_task = candidate.nodes_per_task;
+            if (split != candidate.split) {
+                split = candidate.split;
+                bind_transform_feedback_ranges();
+            }
+        };
+
+        // The GPU decides as much as the CPU here
+        const char* renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+        std::string gpu = renderer ? renderer : "unknown-gpu";
+        std::replace(gpu.begin(), gpu.end(), ' ', '_'); // the cache file is split at spaces
+        const AutoTuner tuner("fluid_tuning.txt", "World22-" + std::to_string(nodes_size) + "-nodes-" + simd::backend + "-" + gpu);
+        const unsigned int picked = tuner.pick(names, [&](unsigned int i) {
+            use(candidates[i]);
+            const auto t0 = std::chrono::steady_clock::now();
+            step(16'000.0f, false);
+            resubmit_nodes_vertices_pos();
+            const auto t1 = std::chrono::steady_clock::now();
+            render_nodes();
+            const float gpu_ms = wait_for_gpu_micros() / 1000.0f;
+            const float cpu_ms = std::chrono::duration<float, std::milli>(t1 - t0).count();
+            return std::max(cpu_ms, gpu_ms);
+        });
+        use(candidates[picked]);
+        statistics.reset();
+
+        // Every node back at its start, on the side it now belongs to
+        std::copy(saved, saved + 2 * nodes_size, nodes_pos_xs_ys);
+        ::operator delete[] (saved, std::align_val_t(simd::alignment));
+        resubmit_nodes_vertices_pos();
+        if (split < nodes_size) upload_gpu_part();
+        std::cout << "Strategy: " << names[picked] << ", CPU share = " << (100.0f * split / nodes_size) << "%\n";
+    }
+
+    // What the fused loop replaces: the same summary in a pass of its own
+    VortexStatistics statistics_pass(const Vec<2>& attractor) const noexcept {
+        VortexStatistics s{ world_size };
+        const float* xs = nodes_pos_xs_ys;
+        const float* ys = nodes_pos_xs_ys + nodes_size;
+        for (unsigned int i = 0; i < split; i++) {
+            const float x = xs[i] - attractor[0];
+            const float y = ys[i] - attractor[1];
+            const float r2 = x * x + y * y;
+            s.count += 1.0;
+            s.sum_radius += std::sqrt(r2);
+            s.sum_radius_sqr += r2;
+            s.min[0] = std::min(s.min[0], xs[i]);
+            s.min[1] = std::min(s.min[1], ys[i]);
+            s.max[0] = std::max(s.max[0], xs[i]);
+            s.max[1] = std::max(s.max[1], ys[i]);
+            if (xs[i] < 0.0f || ys[i] < 0.0f || xs[i] > world_size[0] || ys[i] > world_size[1]) s.escaped += 1.0;
+        }
+        return s;
+    }
+
+    // As in World21, on the CPU part
+    void benchmark_statistics() noexcept {
+        if (split == 0) {
+            std::cout << "No statistics: all nodes are on the GPU\n";
+            return;
+        }
+        constexpr unsigned int runs = 30;
+        constexpr float dt = 16'000.0f;
+        float* saved = new (std::align_val_t(simd::alignment)) float[2 * nodes_size];
+        std::copy(nodes_pos_xs_ys, nodes_pos_xs_ys + 2 * nodes_size, saved);
+
+        using clock = std::chrono::steady_clock;
+        auto best_plain = clock::duration::max();
+        auto best_fused = clock::duration::max();
+        auto best_separate = clock::duration::max();
+        for (unsigned int i = 0; i < runs; i++) {
+            const auto t0 = clock::now();
+            step(dt, false);
+            const auto t1 = clock::now();
+            step(dt, true);
+            const auto t2 = clock::now();
+            step(dt, false);
+            statistics.emplace(statistics_pass(world_size * 0.5f));
+            const auto t3 = clock::now();
+            best_plain = std::min(best_plain, t1 - t0);
+            best_fused = std::min(best_fused, t2 - t1);
+            best_separate = std::min(best_separate, t3 - t2);
+        }
+        statistics.reset();
+
+        const float ms_plain = std::chrono::duration<float, std::milli>(best_plain).count();
+        const float ms_fused = std::chrono::duration<float, std::milli>(best_fused).count();
+        const float ms_separate = std::chrono::duration<float, std::milli>(best_separate).count();
+        const float fused_cost = ms_fused / ms_plain - 1.0f;
+        constexpr unsigned int max_every = 60; // still once a second at 60 FPS
+        statistics_every = std::clamp(static_cast<unsigned int>(std::ceil(fused_cost / statistics_budget)), 1u, max_every);
+        frames_since_statistics = 0;
+        std::cout << "Physics on " << split << " CPU nodes, " << pool->size << " threads: "
+            << "plain = " << ms_plain << " ms  "
+            << "fused statistics = " << ms_fused << " ms (+" << (100.0f * fused_cost) << "%)  "
+            << "separate pass = " << ms_separate << " ms (+" << (100.0f * (ms_separate / ms_plain - 1.0f)) << "%)\n"
+            << "Statistics every " << statistics_every << " frames: +" << (100.0f * fused_cost / statistics_every)
+            << "% of the physics time on average (budget " << (100.0f * statistics_budget) << "%)\n";
+
+        std::copy(saved, saved + 2 * nodes_size, nodes_pos_xs_ys);
+        ::operator delete[] (saved, std::align_val_t(simd::alignment));
+        resubmit_nodes_vertices_pos();
+    }
+
+    // Interleaved, for the GPU part
+    float* allocate_and_init_all_nodes_data() const noexcept {
+        const auto count = nodes_size * node_vertex_components;
+        float* nodes_data = new float[count];
+        unsigned int i = 0;
+
+        for (unsigned int j = 0; j < nodes_size; j++, i += 5) {
+            nodes_data[i + 0] = nodes_pos_xs_ys[j];
+            nodes_data[i + 1] = nodes_pos_xs_ys[nodes_size + j];
+            nodes_data[i + 2] = nodes_color[j][0];
+            nodes_data[i + 3] = nodes_color[j][1];
+            nodes_data[i + 4] = nodes_color[j][2];
+        }
+
+        return nodes_data;
+    }
+
+    // xs, ys, colors, for the CPU part
+    float* allocate_and_init_cpu_nodes_data() const noexcept {
+        const auto count = nodes_size * node_vertex_components;
+        float* nodes_data = new float[count];
+        unsigned int i = 0;
+
+        for (; i < 2 * nodes_size; i++) { // xy
+            nodes_data[i] = nodes_pos_xs_ys[i];
+        }
+
+        for (unsigned int j = 0; j < nodes_size; j++, i += 3) { // color3
+            nodes_data[i + 0] = nodes_color[j][0];
+            nodes_data[i + 1] = nodes_color[j][1];
+            nodes_data[i + 2] = nodes_color[j][2];
+        }
+
+        return nodes_data;
+    }
+
+    void resubmit_nodes_vertices_pos() const noexcept {
+        if (split == 0) return;
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_cpu_nodes);
+        const auto actual_size_bytes = split * sizeof(float);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, actual_size_bytes, nodes_pos_xs_ys);
+        glBufferSubData(GL_ARRAY_BUFFER, nodes_size * sizeof(float), actual_size_bytes, nodes_pos_xs_ys + nodes_size);
+    }
+
+    void set_field_uniforms() noexcept {
+        const auto attractor = world_size * 0.5f;
+        const auto one_over_max_attractor = 1.0f / world_size.length();
+        shader_node.setUniform1f("one_over_max_attractor", one_over_max_attractor);
+        shader_node.setUniform2f("attractor", attractor[0], attractor[1]);
+    }
+
+    void set_mvp(const Matrix4f& mvp) noexcept {
+        shader_cpu_node.bind();
+        shader_cpu_node.setUniformMat4f("u_mvp", mvp);
+        shader_node.bind();
+        shader_node.setUniformMat4f("u_mvp", mvp);
+    }
+
+    void set_size(const Vec<2>& size) noexcept {
+        world_size = size;
+        shader_node.bind();
+        set_field_uniforms();
+    }
+
+    void flip_physics() noexcept {
+        physics_on = !physics_on;
+        // Otherwise the GPU part would go on with the last dt
+        if (!physics_on) {
+            shader_node.bind();
+            shader_node.setUniform1f("speed_scaler_mul_max_magnitude_mul_dt", 0.0f);
+        }
+    }
+
+    void flip_statistics() noexcept {
+        statistics_on = !statistics_on;
+        statistics.reset();
+        std::cout << "Statistics " << (statistics_on ? "on" : "off") << '\n';
+    }
+};
+
+#endif
@@ -0,0 +1,351 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include "Shader.h"
+#include "Texture.h"
+#include "Vec.h"
+#include "util.h"
+
+#include <cmath>
+#include <algorithm>
+#include <optional>
+#include <random>
+#include <limits>
+#include <numbers>
+
+#include <GLFW/glfw3.h>
+
+
+// float, double, long double
+// [low, high)
+template<typename T = float>
+T getRandomUniformFloat(T low, T high) {
+    static std::random_device rd;
+    static std::seed_seq seed{1, 2, 3, 300};
+    static std::mt19937 e2(seed);
+    // static std::mt19937 e2(rd());
+    std::uniform_real_distribution<T> dist(low, high);
+
+    return dist(e2);
+}
+
+
+// NOTE The rendered node size is actually set with point size
+static constexpr float NODE_SIZE = 0.2f;
+
+
+struct World {
+    bool physics_on = true;
+
+    Vec<2> world_size;
+
+    unsigned int nodes_size;
+
+    // The state at sim_time == 0; never changes until rebase()
+    Vec<2>* nodes_pos;
+    Vec<3>* nodes_color;
+
+    unsigned int vao_nodes;
+    unsigned int vbo_nodes;
+
+    static constexpr unsigned int node_vertex_components = 2 + 3; // x,y + color3
+
+    static constexpr float speed_scaler = 5.0f * 0.0000025f;
+    static constexpr float MAX_MAGNITUDE = 2.0f;
+
+    // In micros, relative to nodes_pos. May be negative after a rewind.
+    double sim_time = 0.0;
+    float time_scale = 1.0f;
+
+    Shader shader_node{"node_closed_form.vert", "node_point.frag"};
+
+    // A small sample of particles that is also integrated frame by frame with
+    // the same Euler step as World7/World8, to report how far the closed form
+    // drifts from what the integrating Worlds would show.
+    static constexpr unsigned int euler_sample_size = 1024;
+    Vec<2> euler_pos[euler_sample_size];
+    double euler_since_time = 0.0;
+    float last_accuracy_report = 0.0f;
+
+
+    World(const Vec<2>& world_size) : world_size(world_size) {
+        prepare_nodes(4 * 500000);
+        glPointSize(0.1f);
+    }
+
+    ~World() {
+        delete[] nodes_pos;
+        delete[] nodes_color;
+        glDeleteBuffers(1, &vbo_nodes);
+        glDeleteVertexArrays(1, &vao_nodes);
+    }
+
+    void prepare_nodes(unsigned int count) noexcept {
+        nodes_size = count;
+        nodes_pos = new Vec<2>[count];
+        nodes_color = new Vec<3>[count];
+
+        const auto border = 10.5f * NODE_SIZE;
+        for (unsigned int i = 0; i < count; i++) {
+            const auto x = getRandomUniformFloat(border, world_size[0] - border);
+            const auto y = getRandomUniformFloat(border, world_size[1] - border);
+            const auto color = Vec<3>{ x / world_size[0], y / world_size[1], 0.7f };
+            nodes_pos[i] = Vec<2>{ x, y };
+            nodes_color[i] = color;
+        }
+
+        glGenVertexArrays(1, &vao_nodes);
+        glBindVertexArray(vao_nodes);
+        {
+            glGenBuffers(1, &vbo_nodes);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes);
+            const unsigned int size_bytes = nodes_size * node_vertex_components * sizeof(float);
+            const float* nodes_data = allocate_and_init_all_nodes_data();
+            // Uploaded once: every frame is computed from this data and the time alone
+            glBufferData(GL_ARRAY_BUFFER, size_bytes, nodes_data, GL_STATIC_DRAW);
+            delete[] nodes_data;
+
+            specify_attribs_for_nodes(); // proper GL_ARRAY_BUFFER must be bound!
+        }
+
+        shader_node.bind();
+        set_field_uniforms();
+        reset_euler_sample();
+    }
+
+    void specify_attribs_for_nodes() const noexcept {
+        {
+            const auto index = 0;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 2; // xy
+            const auto stride_bytes = 5 * sizeof(float);
+            const auto offset_bytes = 0;
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+        {
+            const auto index = 1;
+            glEnableVertexAttribArray(index);
+            const auto floats_per_vertex = 3; // color3
+            const auto stride_bytes = 5 * sizeof(float);
+            const auto offset_bytes = 2 * sizeof(float); // skip all xy
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+        }
+    }
+
+    void update_and_render(float dt, const Vec<2>& cursor) noexcept {
+        static auto last = get_time_micros();
+        const auto p0 = get_time_micros();
+        if (physics_on) do_physics(dt, cursor);
+        const auto p1 = get_time_micros();
+        render_nodes();
+        const auto p2 = get_time_micros();
+        const auto frame_time = p2 - last;
+        const auto fps = 1'000'000.0f / frame_time;
+        std::cout
+            << "Idle = " << std::setw(5) << (p0 - last) << "  "
+            << "Physics = " << std::setw(5) << (p1 - p0) << "  "
+            << "Render = " << std::setw(5) << (p2 - p1) << "  "
+            << "Frame time = " << std::setw(5) << frame_time << "  "
+            << "FPS = " << std::setw(5) << fps << "  "
+            << "Sim time = " << std::setw(8) << (sim_time / 1'000'000.0) << "s  "
+            << "Time scale = " << time_scale << '\n';
+        if (p2 - last_accuracy_report > 1'000'000.0f) {
+            last_accuracy_report = p2;
+            report_accuracy();
+        }
+        last = p2;
+    }
+
+    void render_nodes() const noexcept {
+        glDrawArrays(GL_POINTS, 0, nodes_size);
+    }
+
+    // Nothing is integrated: only the time moves, so a dropped frame just
+    // means a bigger jump in time and not a bigger integration error.
+    void do_physics(float dt, const Vec<2>& cursor) noexcept {
+        const float scaled_dt = dt * time_scale;
+        sim_time += scaled_dt;
+        step_euler_sample(scaled_dt);
+        set_time_uniform();
+    }
+
+    void seek(float delta_micros) noexcept {
+        sim_time += delta_micros;
+        set_time_uniform();
+        // An integrator cannot seek, so the reference restarts from here
+        reset_euler_sample();
+    }
+
+    void rewind_to_start() noexcept {
+        seek(-sim_time);
+    }
+
+    void scale_time(float factor) noexcept {
+        time_scale *= factor;
+    }
+
+    void reverse_time() noexcept {
+        time_scale = -time_scale;
+    }
+
+    Vec<2> attractor() const noexcept {
+        return world_size * 0.5f;
+    }
+
+    float one_over_max_attractor() const noexcept {
+        return 1.0f / world_size.length();
+    }
+
+    // Scalar twin of node_closed_form.vert
+    Vec<2> position_at(const Vec<2>& initial, double time) const noexcept {
+        const auto a = attractor();
+        const float x = initial[0] - a[0];
+        const float y = initial[1] - a[1];
+        const float one_over_length = 1.0f / std::sqrt(x * x + y * y);
+        const double angle = (one_over_length - one_over_max_attractor()) * (static_cast<double>(speed_scaler * MAX_MAGNITUDE) * time);
+        const float s = std::sin(angle);
+        const float c = std::cos(angle);
+        return Vec<2>{ a[0] + x * c + y * s, a[1] + y * c - x * s };
+    }
+
+    // What node_closed_form.vert computes: the angle in double, reduced to
+    // [0, 2pi) before it becomes a float. With time_in_float the product is
+    // taken in float instead, as a float uniform would have it.
+    Vec<2> shader_position_at(const Vec<2>& initial, double time, bool time_in_float = false) const noexcept {
+        const auto a = attractor();
+        const float x = initial[0] - a[0];
+        const float y = initial[1] - a[1];
+        const float one_over_length = 1.0f / std::sqrt(x * x + y * y);
+        const double k_t = static_cast<double>(speed_scaler * MAX_MAGNITUDE) * time;
+        const double full_angle = time_in_float
+            ? static_cast<double>((one_over_length - one_over_max_attractor()) * static_cast<float>(k_t))
+            : (one_over_length - one_over_max_attractor()) * k_t;
+        const float angle = full_angle - std::floor(full_angle / (2.0 * std::numbers::pi)) * (2.0 * std::numbers::pi);
+        const float s = std::sin(angle);
+        const float c = std::cos(angle);
+        return Vec<2>{ a[0] + x * c + y * s, a[1] + y * c - x * s };
+    }
+
+    void reset_euler_sample() noexcept {
+        const auto step = nodes_size / euler_sample_size;
+        for (unsigned int i = 0; i < euler_sample_size; i++) {
+            euler_pos[i] = position_at(nodes_pos[i * step], sim_time);
+        }
+        euler_since_time = sim_time;
+    }
+
+    void step_euler_sample(float dt) noexcept {
+        const auto attractor = this->attractor();
+        const auto one_over_max_attractor = this->one_over_max_attractor();
+        const auto speed_scaler_mul_max_magnitude_mul_dt = speed_scaler * MAX_MAGNITUDE * dt;
+        for (unsigned int i = 0; i < euler_sample_size; i++) {
+            const float x = euler_pos[i][0] - attractor[0];
+            const float y = euler_pos[i][1] - attractor[1];
+            const float one_over_length = 1.0f / std::sqrt(x * x + y * y);
+            const float mul = (one_over_length - one_over_max_attractor) * speed_scaler_mul_max_magnitude_mul_dt;
+            euler_pos[i][0] += y * mul;
+            euler_pos[i][1] -= x * mul;
+        }
+    }
+
+    void report_accuracy() const noexcept {
+        const auto a = attractor();
+        const auto step = nodes_size / euler_sample_size;
+        float sum_error = 0.0f;
+        float max_error = 0.0f;
+        float sum_radial_drift = 0.0f;
+        for (unsigned int i = 0; i < euler_sample_size; i++) {
+            const auto exact = position_at(nodes_pos[i * step], sim_time);
+            const auto error = (euler_pos[i] - exact).length();
+            sum_error += error;
+            max_error = std::max(max_error, error);
+            sum_radial_drift += (euler_pos[i] - a).length() - (exact - a).length();
+        }
+        std::cout
+            << "Closed form vs Euler over the last " << ((sim_time - euler_since_time) / 1'000'000.0) << "s of sim time "
+            << "(" << euler_sample_size << " particles): "
+            << "mean error = " << (sum_error / euler_sample_size) << "  "
+            << "max error = " << max_error << "  "
+            << "mean radial drift of Euler = " << (sum_radial_drift / euler_sample_size) << '\n';
+
+        // The Euler sample cannot follow a seek, so the shader's own
+        // evaluation is checked against the exact one here and a day ahead
+        constexpr double large_seek = 24.0 * 3600.0 * 1'000'000.0; // micros
+        float max_error_now = 0.0f;
+        float max_error_seek = 0.0f;
+        float max_error_seek_float = 0.0f;
+        for (unsigned int i = 0; i < euler_sample_size; i++) {
+            const auto& initial = nodes_pos[i * step];
+            const double later = sim_time + large_seek * time_scale;
+            max_error_now = std::max(max_error_now, (shader_position_at(initial, sim_time) - position_at(initial, sim_time)).length());
+            max_error_seek = std::max(max_error_seek, (shader_position_at(initial, later) - position_at(initial, later)).length());
+            max_error_seek_float = std::max(max_error_seek_float, (shader_position_at(initial, later, true) - position_at(initial, later)).length());
+        }
+        std::cout
+            << "Shader vs exact closed form: max error now = " << max_error_now << "  "
+            << "after a seek of " << (large_seek * time_scale / 1'000'000.0) << "s = " << max_error_seek << "  "
+            << "(with a float time it would be " << max_error_seek_float << ")\n";
+    }
+
+    void set_time_uniform() noexcept {
+        const double speed_scaler_mul_max_magnitude_mul_time = static_cast<double>(speed_scaler * MAX_MAGNITUDE) * sim_time;
+        shader_node.setUniform1d("speed_scaler_mul_max_magnitude_mul_time", speed_scaler_mul_max_magnitude_mul_time);
+    }
+
+    void set_field_uniforms() noexcept {
+        const auto attractor = this->attractor();
+        shader_node.setUniform1f("one_over_max_attractor", one_over_max_attractor());
+        shader_node.setUniform2f("attractor", attractor[0], attractor[1]);
+        set_time_uniform();
+    }
+
+    // The field depends on the world size, so the current positions become
+    // the new initial state and the time starts over.
+    void rebase(const Vec<2>& new_world_size) noexcept {
+        for (unsigned int i = 0; i < nodes_size; i++) {
+            nodes_pos[i] = position_at(nodes_pos[i], sim_time);
+        }
+        world_size = new_world_size;
+        sim_time = 0.0;
+
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes);
+        const unsigned int size_bytes = nodes_size * node_vertex_components * sizeof(float);
+        const float* nodes_data = allocate_and_init_all_nodes_data();
+        glBufferSubData(GL_ARRAY_BUFFER, 0, size_bytes, nodes_data);
+        delete[] nodes_data;
+
+        set_field_uniforms();
+        reset_euler_sample();
+    }
+
+    float* allocate_and_init_all_nodes_data() const noexcept {
+        const auto count = nodes_size * node_vertex_components;
+        float* nodes_data = new float[count];
+        unsigned int i = 0;
+
+        for (unsigned int j = 0; j < nodes_size; j++, i += 5) {
+            nodes_data[i + 0] = nodes_pos[j][0];
+            nodes_data[i + 1] = nodes_pos[j][1];
+            nodes_data[i + 2] = nodes_color[j][0];
+            nodes_data[i + 3] = nodes_color[j][1];
+            nodes_data[i + 4] = nodes_color[j][2];
+        }
+
+        return nodes_data;
+    }
+
+    void set_mvp(const Matrix4f& mvp) noexcept {
+        shader_node.bind();
+        shader_node.setUniformMat4f("u_mvp", mvp);
+    }
+
+    void set_size(const Vec<2>& size) noexcept {
+        rebase(size);
+    }
+
+    void flip_physics() noexcept {
+        physics_on = !physics_on;
+    }
+};
+
+#endif
@@ -0,0 +1,219 @@
+// Headless parameter sweep of the vortex: many small independent worlds in
+// one process, 8 worlds per SIMD register (one world per lane), batches of
+// 8 worlds spread over the cores. Writes one CSV line of summary
+// statistics per world.
+//     make ensemble && ./ensemble [particles per world] [steps] [csv]
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "Vec.h"
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <new>
+#include <charconv>
+#include <cstring>
+
+
+// What is swept, per world
+struct Parameters {
+    float speed_scaler;
+    float max_magnitude;
+    Vec<2> attractor; // in world units
+};
+
+struct Summary {
+    float mean_radius;
+    float radius_deviation;
+    float mean_radial_drift; // |r - r at the start|
+    unsigned int escaped;    // outside of the world at the end
+    Vec<2> min;
+    Vec<2> max;
+};
+
+
+// 8 worlds that advance together. Positions are interleaved by world:
+// for every particle, 8 xs (one per world), then 8 ys.
+struct Batch {
+    static constexpr unsigned int worlds = simd::width;
+    // Independent chains per thread, enough to hide the latency of a step;
+    // 4 leaves the units idle, more than 8 spills the 16 AVX registers
+    static constexpr unsigned int particles_in_flight = 8;
+
+    unsigned int particles;
+    float* xs_ys; // particles * 2 * worlds, aligned
+    Parameters parameters[worlds];
+
+    Batch(unsigned int particles, const std::vector<Vec<2>>& initial, const Parameters* parameters) noexcept : particles(particles) {
+        xs_ys = new (std::align_val_t(simd::alignment)) float[particles * 2 * worlds];
+        for (unsigned int w = 0; w < worlds; w++) this->parameters[w] = parameters[w];
+        for (unsigned int p = 0; p < particles; p++) {
+            for (unsigned int w = 0; w < worlds; w++) {
+                xs_ys[(2 * p + 0) * worlds + w] = initial[p][0];
+                xs_ys[(2 * p + 1) * worlds + w] = initial[p][1];
+            }
+        }
+    }
+
+    ~Batch() {
+        ::operator delete[] (xs_ys, std::align_val_t(simd::alignment));
+    }
+
+    Batch(const Batch&) = delete;
+    Batch& operator=(const Batch&) = delete;
+
+    // The step of World7, with the parameters of every lane
+    void advect(float dt, float one_over_max_attractor, unsigned int steps) noexcept {
+        alignas(simd::alignment) float attr_x[worlds];
+        alignas(simd::alignment) float attr_y[worlds];
+        alignas(simd::alignment) float k[worlds];
+        for (unsigned int w = 0; w < worlds; w++) {
+            attr_x[w] = parameters[w].attractor[0];
+            attr_y[w] = parameters[w].attractor[1];
+            k[w] = parameters[w].speed_scaler * parameters[w].max_magnitude * dt;
+        }
+        const auto attr = simd::Vecs<2>{ simd::load(attr_x), simd::load(attr_y) };
+        const auto speed_scaler_mul_max_magnitude_mul_dt = simd::load(k);
+        const auto one_over_max = simd::set1(one_over_max_attractor);
+        // All the steps of a group of particles at once: they stay in
+        // registers. Every step depends on the one before, so a single
+        // particle would leave the SIMD units waiting on that chain; the
+        // particles of a group are independent and fill the gaps.
+        unsigned int p = 0;
+        for (; p + particles_in_flight <= particles; p += particles_in_flight) {
+            advect_group<particles_in_flight>(p, steps, attr, one_over_max, speed_scaler_mul_max_magnitude_mul_dt);
+        }
+        for (; p < particles; p++) {
+            advect_group<1>(p, steps, attr, one_over_max, speed_scaler_mul_max_magnitude_mul_dt);
+        }
+    }
+
+    // Particles [first, first + COUNT), in 2 * COUNT registers
+    template<unsigned int COUNT>
+    void advect_group(unsigned int first, unsigned int steps, const simd::Vecs<2>& attr,
+            simd::f32x8 one_over_max, simd::f32x8 speed_scaler_mul_max_magnitude_mul_dt) noexcept {
+        simd::Vecs<2> pos[COUNT];
+        for (unsigned int i = 0; i < COUNT; i++) pos[i] = simd::Vecs<2>::load(&xs_ys[2 * (first + i) * worlds], worlds, 0);
+        for (unsigned int s = 0; s < steps; s++) {
+            for (unsigned int i = 0; i < COUNT; i++) {
+                const auto r = pos[i] - attr;
+                const auto mul = (simd::rsqrt(r.length_sqr()) - one_over_max) * speed_scaler_mul_max_magnitude_mul_dt;
+                pos[i][0] = pos[i][0] + r[1] * mul;
+                pos[i][1] = pos[i][1] - r[0] * mul;
+            }
+        }
+        for (unsigned int i = 0; i < COUNT; i++) pos[i].store(&xs_ys[2 * (first + i) * worlds], worlds, 0);
+    }
+
+    Summary summarize(unsigned int w, const std::vector<Vec<2>>& initial, const Vec<2>& world_size) const noexcept {
+        Summary summary{ 0.0f, 0.0f, 0.0f, 0, Vec<2>{ world_size[0], world_size[1] }, Vec<2>{ 0.0f, 0.0f } };
+        const auto& attractor = parameters[w].attractor;
+        double sum_radius = 0.0;
+        double sum_radius_sqr = 0.0;
+        double sum_drift = 0.0;
+        for (unsigned int p = 0; p < particles; p++) {
+            const Vec<2> pos{ xs_ys[(2 * p + 0) * worlds + w], xs_ys[(2 * p + 1) * worlds + w] };
+            const float radius = (pos - attractor).length();
+            sum_radius += radius;
+            sum_radius_sqr += radius * radius;
+            sum_drift += std::abs(radius - (initial[p] - attractor).length());
+            if (pos[0] < 0.0f || pos[1] < 0.0f || pos[0] > world_size[0] || pos[1] > world_size[1]) summary.escaped++;
+            for (unsigned int i = 0; i < 2; i++) {
+                summary.min[i] = std::min(summary.min[i], pos[i]);
+                summary.max[i] = std::max(summary.max[i], pos[i]);
+            }
+        }
+        const double mean = sum_radius / particles;
+        summary.mean_radius = mean;
+        summary.radius_deviation = std::sqrt(std::max(0.0, sum_radius_sqr / particles - mean * mean));
+        summary.mean_radial_drift = sum_drift / particles;
+        return summary;
+    }
+};
+
+
+// 8 speeds x 8 magnitudes x 8 attractor placements along the diagonal
+std::vector<Parameters> make_sweep(const Vec<2>& world_size) noexcept {
+    std::vector<Parameters> sweep;
+    for (unsigned int s = 0; s < 8; s++) {
+        for (unsigned int m = 0; m < 8; m++) {
+            for (unsigned int a = 0; a < 8; a++) {
+                const float t = 0.3f + 0.4f * a / 7.0f;
+                sweep.push_back(Parameters{
+                    (1.0f + s) * 0.0000025f,
+                    0.5f + 0.5f * m,
+                    Vec<2>{ world_size[0] * t, world_size[1] * t }
+                });
+            }
+        }
+    }
+    return sweep;
+}
+
+
+// A whole positive number, or false
+static bool parse_count(const char* text, unsigned int& count) noexcept {
+    const char* end = text + std::strlen(text);
+    const auto [last, error] = std::from_chars(text, end, count);
+    return error == std::errc{} && last == end && count > 0;
+}
+
+
+int main(int argc, char** argv) {
+    unsigned int particles = 4096;
+    unsigned int steps = 3600; // a minute at 60 FPS
+    if ((argc > 1 && !parse_count(argv[1], particles)) || (argc > 2 && !parse_count(argv[2], steps))) {
+        std::cout << "Usage: " << argv[0] << " [particles per world > 0] [steps > 0] [csv]\n";
+        return 1;
+    }
+    const std::string csv_filepath = (argc > 3) ? argv[3] : "ensemble.csv";
+    constexpr float dt = 16'000.0f; // micros
+    const Vec<2> world_size{ 100.0f, 100.0f };
+    const float one_over_max_attractor = 1.0f / world_size.length();
+
+    // The same start for every world, so only the parameters differ
+    std::vector<Vec<2>> initial(particles);
+    std::mt19937 e2(300);
+    const auto border = 10.5f * 0.2f;
+    std::uniform_real_distribution<float> dist_x(border, world_size[0] - border);
+    std::uniform_real_distribution<float> dist_y(border, world_size[1] - border);
+    for (auto& pos : initial) pos = Vec<2>{ dist_x(e2), dist_y(e2) };
+
+    auto sweep = make_sweep(world_size);
+    // Whole batches only: the last one is padded with copies
+    while (sweep.size() % Batch::worlds != 0) sweep.push_back(sweep.back());
+    const unsigned int worlds = sweep.size();
+    const unsigned int batches_count = worlds / Batch::worlds;
+
+    ThreadPool pool;
+    std::cout << "Ensemble: " << worlds << " worlds x " << particles << " particles x " << steps << " steps, "
+        << simd::backend << " on " << pool.size << " threads\n";
+
+    const auto t0 = std::chrono::steady_clock::now();
+    std::vector<Summary> summaries(worlds);
+    pool.run(batches_count, [&](unsigned int b, unsigned int) {
+        Batch batch(particles, initial, &sweep[b * Batch::worlds]);
+        batch.advect(dt, one_over_max_attractor, steps);
+        for (unsigned int w = 0; w < Batch::worlds; w++) summaries[b * Batch::worlds + w] = batch.summarize(w, initial, world_size);
+    });
+    const auto t1 = std::chrono::steady_clock::now();
+
+    std::ofstream csv(csv_filepath);
+    csv << "world,speed_scaler,max_magnitude,attractor_x,attractor_y,mean_radius,radius_deviation,mean_radial_drift,escaped,min_x,min_y,max_x,max_y\n";
+    for (unsigned int w = 0; w < worlds; w++) {
+        const auto& p = sweep[w];
+        const auto& s = summaries[w];
+        csv << w << ',' << p.speed_scaler << ',' << p.max_magnitude << ',' << p.attractor[0] << ',' << p.attractor[1] << ','
+            << s.mean_radius << ',' << s.radius_deviation << ',' << s.mean_radial_drift << ',' << s.escaped << ','
+            << s.min[0] << ',' << s.min[1] << ',' << s.max[0] << ',' << s.max[1] << '\n';
+    }
+
+    const float seconds = std::chrono::duration<float>(t1 - t0).count();
+    const float updates = static_cast<float>(worlds) * particles * steps;
+    std::cout << "Done in " << seconds << " s (" << (updates / seconds / 1e9f) << " G particle steps/s), written to " << csv_filepath << '\n';
+    return 0;
+}
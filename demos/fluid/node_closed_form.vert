@@ -0,0 +1,35 @@
+#version 400 core
+
+layout (location = 0) in vec2 position; // at time 0
+layout (location = 1) in vec3 color;
+
+uniform mat4 u_mvp = mat4(1.0);
+
+uniform float one_over_max_attractor = 1.0f;
+// In double: after a long run or a big seek the product with the angular
+// speed has no fractional part left in a float
+uniform double speed_scaler_mul_max_magnitude_mul_time = 0.0;
+uniform vec2 attractor = vec2(1.0f, 1.0f);
+
+out vec3 v_color;
+
+const double TWO_PI = 6.283185307179586;
+
+void main() {
+    v_color = color;
+
+    // The field is a pure rotation around the attractor with an angular speed
+    // that depends only on the radius, so the radius never changes and the
+    // position at time t is the initial one rotated by (angular speed * t).
+    float x = position.x - attractor.x;
+    float y = position.y - attractor.y;
+    float one_over_length = inversesqrt(x * x + y * y);
+    double full_angle = double(one_over_length - one_over_max_attractor) * speed_scaler_mul_max_magnitude_mul_time;
+    // Into [0, 2pi) while still in double, so that sin() and cos() get a float they can use
+    float angle = float(full_angle - floor(full_angle / TWO_PI) * TWO_PI);
+    float s = sin(angle);
+    float c = cos(angle);
+    vec2 pos = vec2(attractor.x + x * c + y * s, attractor.y + y * c - x * s);
+
+    gl_Position = u_mvp * vec4(pos, 0.5f - 0.00000001 * gl_VertexID, 1.0);
+}
@@ -0,0 +1,21 @@
+#version 330 core
+
+// Blocks of 8 nodes: 8 xs, 8 ys, 8 rs, 8 gs, 8 bs.
+// The layout has no constant stride per attribute, so it is fetched by hand.
+uniform samplerBuffer nodes;
+
+uniform mat4 u_mvp = mat4(1.0);
+
+out vec3 v_color;
+
+void main() {
+    int block = (gl_VertexID >> 3) * 40;
+    int lane = gl_VertexID & 7;
+    float x = texelFetch(nodes, block +  0 + lane).r;
+    float y = texelFetch(nodes, block +  8 + lane).r;
+    float r = texelFetch(nodes, block + 16 + lane).r;
+    float g = texelFetch(nodes, block + 24 + lane).r;
+    float b = texelFetch(nodes, block + 32 + lane).r;
+    v_color = vec3(r, g, b);
+    gl_Position = u_mvp * vec4(x, y, 0.5f + 0.00000001 * gl_VertexID, 1.0);
+}
@@ -0,0 +1,74 @@
+// Throughput of the vortex step on this target, without any GL:
+//     make simd_bench                              (native)
+//     make simd_bench CXX=aarch64-linux-gnu-g++    (cross, run on the ARM machine)
+#include "VortexKernel.h"
+
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <new>
+
+
+// The same step, one node at a time, as the reference
+void advect_vortex_scalar(float* xs_ys, unsigned int count, const Vec<2>& attractor,
+        float one_over_max_attractor, float speed_scaler_mul_max_magnitude_mul_dt) noexcept {
+    float* xs = xs_ys;
+    float* ys = xs_ys + count;
+    for (unsigned int i = 0; i < count; i++) {
+        const float x = xs[i] - attractor[0];
+        const float y = ys[i] - attractor[1];
+        const float one_over_length = 1.0f / std::sqrt(x * x + y * y);
+        const float mul = (one_over_length - one_over_max_attractor) * speed_scaler_mul_max_magnitude_mul_dt;
+        xs[i] += y * mul;
+        ys[i] -= x * mul;
+    }
+}
+
+
+int main() {
+    constexpr unsigned int count = 4 * 500000;
+    constexpr unsigned int runs = 30;
+    const Vec<2> world_size{ 100.0f, 100.0f };
+    const Vec<2> attractor = world_size * 0.5f;
+    const float one_over_max_attractor = 1.0f / world_size.length();
+    const float k = 5.0f * 0.0000025f * 2.0f * 16'000.0f;
+
+    float* simd_xs_ys = new (std::align_val_t(simd::alignment)) float[2 * count];
+    float* scalar_xs_ys = new (std::align_val_t(simd::alignment)) float[2 * count];
+    std::mt19937 e2(300);
+    std::uniform_real_distribution<float> dist(2.1f, 97.9f);
+    for (unsigned int i = 0; i < 2 * count; i++) simd_xs_ys[i] = scalar_xs_ys[i] = dist(e2);
+
+    using clock = std::chrono::steady_clock;
+    auto best_simd = clock::duration::max();
+    auto best_scalar = clock::duration::max();
+    for (unsigned int i = 0; i < runs; i++) {
+        const auto t0 = clock::now();
+        advect_vortex(simd_xs_ys, count, attractor, one_over_max_attractor, k);
+        const auto t1 = clock::now();
+        advect_vortex_scalar(scalar_xs_ys, count, attractor, one_over_max_attractor, k);
+        const auto t2 = clock::now();
+        best_simd = std::min(best_simd, t1 - t0);
+        best_scalar = std::min(best_scalar, t2 - t1);
+    }
+
+    // The approximate rsqrt makes the paths drift apart a little
+    float max_difference = 0.0f;
+    for (unsigned int i = 0; i < 2 * count; i++) {
+        max_difference = std::max(max_difference, std::abs(simd_xs_ys[i] - scalar_xs_ys[i]));
+    }
+
+    const auto ns_per_node = [](clock::duration d) {
+        return std::chrono::duration<float, std::nano>(d).count() / count;
+    };
+    std::cout
+        << "Vortex step on " << count << " nodes, best of " << runs << " runs\n"
+        << "  " << simd::backend << ": " << ns_per_node(best_simd) << " ns/node (" << (1000.0f / ns_per_node(best_simd)) << " M nodes/s)\n"
+        << "  one node at a time: " << ns_per_node(best_scalar) << " ns/node (" << (1000.0f / ns_per_node(best_scalar)) << " M nodes/s)\n"
+        << "  max difference after " << runs << " steps: " << max_difference << '\n';
+
+    ::operator delete[] (simd_xs_ys, std::align_val_t(simd::alignment));
+    ::operator delete[] (scalar_xs_ys, std::align_val_t(simd::alignment));
+    return 0;
+}
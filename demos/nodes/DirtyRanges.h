@@ -0,0 +1,61 @@
+#ifndef DIRTY_RANGES_H
+#define DIRTY_RANGES_H
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+
+// The elements of a GPU buffer that have changed since its last upload, as
+// ranges [begin, end). A mark that touches the last range extends it, so
+// marking one element after another in order costs nothing more than that.
+struct DirtyRanges {
+    std::vector<std::pair<unsigned int, unsigned int>> ranges;
+
+    void mark(unsigned int begin, unsigned int end) noexcept {
+        if (begin >= end) return;
+        if (!ranges.empty()) {
+            auto& last = ranges.back();
+            if (begin <= last.second && end >= last.first) {
+                last.first = std::min(last.first, begin);
+                last.second = std::max(last.second, end);
+                return;
+            }
+        }
+        ranges.emplace_back(begin, end);
+    }
+
+    void mark(unsigned int i) noexcept {
+        mark(i, i + 1);
+    }
+
+    bool empty() const noexcept {
+        return ranges.empty();
+    }
+
+    // Sorted and merged where closer than gap elements, so that a few
+    // untouched elements are uploaded instead of one more write; clipped
+    // to size, because the elements past it are gone
+    const std::vector<std::pair<unsigned int, unsigned int>>& coalesce(unsigned int size, unsigned int gap) noexcept {
+        std::sort(ranges.begin(), ranges.end());
+        unsigned int merged = 0;
+        for (const auto& [begin, end_unclipped] : ranges) {
+            const unsigned int end = std::min(end_unclipped, size);
+            if (begin >= end) continue;
+            if (merged > 0 && begin <= ranges[merged - 1].second + gap) {
+                ranges[merged - 1].second = std::max(ranges[merged - 1].second, end);
+            } else {
+                ranges[merged++] = { begin, end };
+            }
+        }
+        ranges.resize(merged);
+        return ranges;
+    }
+
+    void clear() noexcept {
+        ranges.clear();
+    }
+};
+
+
+#endif
@@ -4,12 +4,23 @@
 #include "Shader.h"
 #include "Texture.h"
 #include "Vector2f.h"
+#include "SpringSolver.h"
+#include "NodeGrid.h"
+#include "Slots.h"
+#include "Snapshot.h"
+#include "Journal.h"
+#include "DirtyRanges.h"
 
 #include <cmath>
 #include <algorithm>
 #include <optional>
 #include <random>
 #include <limits>
+#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <type_traits>
 
 #include <GLFW/glfw3.h>
 
@@ -48,23 +59,14 @@ Vector3f random_color() noexcept {
     return Vector3f{ r, g, b };
 }
 
-unsigned int random_id() noexcept {
-    static unsigned int next = 4;
-    return next++;
-    // return getRandomUniformInt(static_cast<unsigned int>(0), ID_MAX);
-}
-
 Vector3f pinned_color() noexcept {
     return Vector3f{ 1.0f, 1.0f, 1.0f };
 }
 
 
-static constexpr unsigned int ID_MAX = 0xFFFFFFF;
-
-
 static constexpr float NODE_SIZE = 5.0f;
 struct Node {
-    unsigned int id;
+    unsigned int id = Slots::invalid; // a handle, given by World::add_node()
     bool is_pinned = false;
     Vector2f position;
     // Vector2f prev_position = Vector2f{};
@@ -73,15 +75,9 @@ struct Node {
     Vector3f color = is_pinned ? pinned_color() : random_color();
 
     Node(const Vector2f& position) noexcept :
-        id(random_id()),
         position(position) {}
 
     Node(Vector2f&& position) noexcept :
-        id(random_id()),
-        position(std::move(position)) {}
-
-    Node(unsigned int id, Vector2f&& position) noexcept :
-        id(id),
         position(std::move(position)) {}
 
     void pin() noexcept {
@@ -119,6 +115,42 @@ struct Line {
 };
 
 
+// All of the Nodes and Lines with their handles, for the edits that
+// replace them at once
+struct Graph {
+    std::vector<Node> nodes;
+    std::vector<Line> lines;
+    Slots node_slots;
+    Slots line_slots;
+};
+
+
+// One edit of the World as a delta: what it takes to do and to undo it,
+// see World::apply()
+struct Edit {
+    enum class Kind { AddNode, RemoveNode, AddLine, RemoveLine, ChangeNode, AddMesh, ReplaceGraph };
+    struct HandledLine {
+        unsigned int handle;
+        Line line;
+    };
+
+    Kind kind;
+    std::vector<Node> nodes;        // AddNode, RemoveNode: the Node; ChangeNode: before and after; AddMesh: all of them
+    std::vector<HandledLine> lines; // AddLine, RemoveLine: the Line; RemoveNode: the Lines that go with the Node;
+                                    // AddMesh: the Lines between its Nodes
+    std::unique_ptr<Graph> graph;   // ReplaceGraph: the other one
+
+    std::size_t size_bytes() const noexcept {
+        std::size_t size = sizeof(Edit) + nodes.capacity() * sizeof(Node) + lines.capacity() * sizeof(HandledLine);
+        if (graph) {
+            size += sizeof(Graph) + graph->nodes.capacity() * sizeof(Node) + graph->lines.capacity() * sizeof(Line)
+                + graph->node_slots.memory_bytes() + graph->line_slots.memory_bytes();
+        }
+        return size;
+    }
+};
+
+
 struct World {
     Vector2f world_size;
 
@@ -127,27 +159,77 @@ struct World {
     // Dots count possible of twice the Lines amount.
     std::vector<Line> lines;
 
+    // Node ids and Line handles are handles into these. Both vectors stay
+    // compact: a removal moves the last element into the hole.
+    Slots node_slots;
+    Slots line_slots;
+    std::vector<std::vector<unsigned int>> lines_of_node; // Line handles, along with nodes
+    std::unordered_map<unsigned long long, unsigned int> line_of_key; // see line_key()
+    // The neighbours of Node i are adjacency[adjacency_offsets[i] .. adjacency_offsets[i + 1]),
+    // as indices into nodes. Rebuilt in O(N + L) by the next physics step after any change.
+    std::vector<unsigned int> adjacency_offsets;
+    std::vector<unsigned int> adjacency;
+    bool adjacency_outdated = true;
+
+    // For picking; follows the Nodes as they move
+    NodeGrid node_grid{ NODE_SIZE };
+
+    // The other way to do the springs, see SpringSolver.h
+    SpringSolver spring_solver;
+    bool edge_solver_on = false;
+
+    // S and R. The Nodes and Lines go into the file as they are in memory,
+    // see Snapshot.h; the file is written by snapshot_writer.
+    static constexpr const char* snapshot_filepath = "nodes_state.bin";
+    std::vector<unsigned char> snapshot_bytes; // kept, so that the next save does not fault its pages in again
+    std::thread snapshot_writer;
+    std::vector<std::thread> lookup_builders; // see restore_state()
+
+    // Z and Y. Every edit by the user goes in here, a restore as well; the
+    // Nodes that the physics removes do not, see apply().
+    static constexpr std::size_t journal_default_max_bytes = 128 << 20;
+    Journal<Edit> journal{ journal_default_max_bytes };
+
+    // A Node is one instance of the unit quad. Its position and color are
+    // per instance for vao_nodes and per vertex for vao_lines, where the
+    // index of a Node is its vertex.
     unsigned int vao_nodes;
-    unsigned int vbo_nodes;
-    unsigned int ibo_nodes;
+    unsigned int vbo_quad;
+    unsigned int vbo_positions;
+    unsigned int vbo_colors;
 
     unsigned int vao_lines;
-    unsigned int vbo_lines;
     unsigned int ibo_lines;
 
     unsigned int vao, vbo, ibo;
 
+    // What has to go to the GPU before the next draw, see upload_dirty().
+    // nodes_dirty is for the position and the color of a Node,
+    // positions_dirty for the position alone (what physics moves).
+    DirtyRanges nodes_dirty;
+    DirtyRanges positions_dirty;
+    DirtyRanges lines_dirty;
+    static constexpr unsigned int coalesce_gap = 32; // elements
+    unsigned long long uploaded_bytes = 0; // by the last frame
+    unsigned int upload_writes = 0;
+    bool upload_metric_on = false;
+    // Where the writes are built before glBufferSubData(). They only grow,
+    // to the largest range so far, so a frame allocates nothing.
+    std::vector<float> staging_positions;
+    std::vector<unsigned char> staging_colors;
+    std::vector<unsigned int> staging_indices;
+
     bool physics_is_on = false;
 
-    static constexpr unsigned int node_vertex_components = 2 + 3 + 3; // inner_xy + x,y,z + color3
-    static constexpr unsigned int indices_per_node = 6;
-    static constexpr unsigned int vertices_per_node = 4;
-    unsigned int last_known_nodes_capacity;
+    static constexpr unsigned int vertices_per_quad = 4; // a triangle strip
+    static constexpr unsigned int position_components = 2; // x,y; z is from the index
+    static constexpr unsigned int position_size_bytes = position_components * sizeof(float);
+    static constexpr unsigned int color_size_bytes = 4; // RGBA8
+    unsigned int gpu_nodes_capacity; // what the buffers have room for, see reserve_gpu_nodes()
 
-    static constexpr unsigned int dot_vertex_components = 3 + 3; // x,y,z + color3
     static constexpr auto indices_per_line = 2;
-    static constexpr unsigned int vertices_per_dot = 2;
-    unsigned int last_known_lines_capacity;
+    static constexpr unsigned int line_size_bytes = indices_per_line * sizeof(unsigned int);
+    unsigned int gpu_lines_capacity;
 
     Shader shader_node{"node.vert", "node.frag"};
     Shader shader_line{"line.vert", "line.frag"};
@@ -161,25 +243,146 @@ struct World {
         const auto lines_starting_capacity = 8;
         const auto nodes_starting_capacity = 8;
         prepare_nodes(nodes_starting_capacity);
-        prepare_lines(nodes_starting_capacity, lines_starting_capacity);
+        prepare_lines(lines_starting_capacity);
+        set_uniforms();
         add_sample_grid();
     }
 
     ~World() {
-        glDeleteBuffers(1, &ibo_nodes);
-        glDeleteBuffers(1, &vbo_nodes);
+        if (snapshot_writer.joinable()) snapshot_writer.join();
+        wait_for_lookups();
+        glDeleteBuffers(1, &vbo_quad);
+        glDeleteBuffers(1, &vbo_positions);
+        glDeleteBuffers(1, &vbo_colors);
         glDeleteVertexArrays(1, &vao_nodes);
         glDeleteBuffers(1, &ibo_lines);
-        glDeleteBuffers(1, &vbo_lines);
         glDeleteVertexArrays(1, &vao_lines);
     }
 
+    // The arrays are copied here and the handles are given anew, in order.
+    // The lookups (node_grid, lines_of_node, line_of_key) take much longer to
+    // rebuild, so that is done in the background, see rebuild_lookups().
+    // The previous Graph goes into the journal as it is.
     void restore_state() noexcept {
-        std::cout << "Restoring previous state\n";
+        static_assert(std::is_trivially_copyable_v<Node> && std::is_trivially_copyable_v<Line>);
+        if (snapshot_writer.joinable()) snapshot_writer.join(); // the last save must be in the file
+        wait_for_lookups();
+        const auto start = std::chrono::steady_clock::now();
+        const snapshot::MappedFile file(snapshot_filepath, sizeof(Node), sizeof(Line));
+        if (!file.valid()) return;
+        const unsigned int nodes_count = file.header->nodes_count;
+        const unsigned int lines_count = file.header->lines_count;
+        if (nodes_count > Slots::max_size || lines_count > Slots::max_size) {
+            std::cout << "Snapshot: more than " << Slots::max_size << " Nodes or Lines, not restoring\n";
+            return;
+        }
+        const Node* saved_nodes = file.nodes<Node>();
+        const Line* saved_lines = file.lines<Line>();
+        for (unsigned int i = 0; i < lines_count; i++) {
+            const auto& line = saved_lines[i];
+            if (line.id1 >= nodes_count || line.id2 >= nodes_count || line.id1 == line.id2) {
+                std::cout << "Snapshot: Line " << i << " does not connect two Nodes, not restoring\n";
+                return;
+            }
+        }
+
+        auto previous = std::make_unique<Graph>(std::move(nodes), std::move(lines), std::move(node_slots), std::move(line_slots));
+        nodes.assign(saved_nodes, saved_nodes + nodes_count);
+        node_slots.reset(nodes_count);
+        for (unsigned int i = 0; i < nodes_count; i++) nodes[i].id = node_slots.handle_at(i);
+        lines.assign(saved_lines, saved_lines + lines_count);
+        line_slots.reset(lines_count);
+        for (auto& line : lines) line = Line{ node_slots.handle_at(line.id1), node_slots.handle_at(line.id2) };
+        graph_replaced();
+        journal.record(Edit{ Edit::Kind::ReplaceGraph, {}, {}, std::move(previous) });
+
+        const auto ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Restored " << nodes.size() << " Nodes and " << lines.size() << " Lines in " << ms << " ms\n";
+    }
+
+    // For the edits that replace the whole of the Nodes and Lines
+    void swap_graph(Graph& other) noexcept {
+        wait_for_lookups();
+        std::swap(nodes, other.nodes);
+        std::swap(lines, other.lines);
+        std::swap(node_slots, other.node_slots);
+        std::swap(line_slots, other.line_slots);
+        graph_replaced();
     }
 
+    // After nodes, lines and their Slots have been replaced as a whole
+    void graph_replaced() noexcept {
+        adjacency_outdated = true;
+        rebuild_lookups();
+        reserve_gpu_nodes(nodes.size());
+        reserve_gpu_lines(lines.size());
+        nodes_dirty.mark(0, nodes.size());
+        lines_dirty.mark(0, lines.size());
+    }
+
+    // Takes about a second for a million Nodes, so each lookup is rebuilt by
+    // a thread of lookup_builders while the frames go on. The Nodes may move
+    // before they are done, so the grid is built from a copy of the positions.
+    void rebuild_lookups() noexcept {
+        std::vector<Vector2f> positions(nodes.size());
+        for (unsigned int i = 0; i < nodes.size(); i++) positions[i] = nodes[i].position;
+        lookup_builders.emplace_back([this, positions = std::move(positions)] {
+            node_grid.clear();
+            for (unsigned int i = 0; i < positions.size(); i++) {
+                node_grid.insert(node_slots.handle_at(i), positions[i].x, positions[i].y);
+            }
+        });
+        lookup_builders.emplace_back([this] {
+            lines_of_node.assign(nodes.size(), {});
+            for (unsigned int i = 0; i < lines.size(); i++) {
+                const unsigned int handle = line_slots.handle_at(i);
+                lines_of_node[node_slots.index_of(lines[i].id1)].push_back(handle);
+                lines_of_node[node_slots.index_of(lines[i].id2)].push_back(handle);
+            }
+        });
+        lookup_builders.emplace_back([this] {
+            line_of_key.clear();
+            line_of_key.reserve(lines.size());
+            for (unsigned int i = 0; i < lines.size(); i++) {
+                line_of_key[line_key(lines[i].id1, lines[i].id2)] = line_slots.handle_at(i);
+            }
+        });
+    }
+
+    // Called by everything that uses the lookups or changes the Nodes and Lines
+    void wait_for_lookups() noexcept {
+        if (lookup_builders.empty()) return;
+        for (auto& builder : lookup_builders) builder.join();
+        lookup_builders.clear();
+        // The physics may have moved the Nodes meanwhile
+        for (const auto& node : nodes) node_grid.move(node.id, node.position.x, node.position.y);
+    }
+
+    // Only the copy is done here; the file is written in the background.
+    // In the file a Line holds the indices of its Nodes instead of their ids.
     void save_state() noexcept {
-        std::cout << "Saving current state\n";
+        if (snapshot_writer.joinable()) snapshot_writer.join(); // it writes from snapshot_bytes
+        const auto start = std::chrono::steady_clock::now();
+        const auto header = snapshot::header_for(sizeof(Node), nodes.size(), sizeof(Line), lines.size());
+        snapshot_bytes.resize(header.size_bytes);
+        auto* bytes = snapshot_bytes.data();
+        const auto nodes_end = header.nodes_offset + nodes.size() * sizeof(Node);
+        std::memset(bytes, 0, header.nodes_offset); // the padding, so that the same state gives the same file
+        std::memset(bytes + nodes_end, 0, header.lines_offset - nodes_end);
+        std::memcpy(bytes, &header, sizeof(header));
+        std::memcpy(bytes + header.nodes_offset, nodes.data(), nodes.size() * sizeof(Node));
+        auto* saved_lines = reinterpret_cast<Line*>(bytes + header.lines_offset);
+        for (unsigned int i = 0; i < lines.size(); i++) {
+            saved_lines[i] = Line{ node_slots.index_of(lines[i].id1), node_slots.index_of(lines[i].id2) };
+        }
+
+        snapshot_writer = std::thread([this] {
+            snapshot::write_file(snapshot_filepath, snapshot_bytes.data(), snapshot_bytes.size());
+        });
+
+        const auto ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Saving " << nodes.size() << " Nodes and " << lines.size() << " Lines (" << header.size_bytes
+            << " bytes), " << ms << " ms on this thread\n";
     }
 
     void turn_physics_on() noexcept {
@@ -192,10 +395,109 @@ struct World {
         physics_is_on = false;
     }
 
+    void flip_spring_solver() noexcept {
+        edge_solver_on = !edge_solver_on;
+        std::cout << "Springs: " << (edge_solver_on ? "per Line (SpringSolver)" : "per Node") << '\n';
+    }
+
+    void undo() noexcept {
+        if (!journal.undo([this](Edit& edit) { apply(edit, false); })) std::cout << "Nothing to undo\n";
+    }
+
+    void redo() noexcept {
+        if (!journal.redo([this](Edit& edit) { apply(edit, true); })) std::cout << "Nothing to redo\n";
+    }
+
+    // Does the edit, or undoes it. The Nodes and Lines come back under
+    // their old handles, so the edits around this one still find them.
+    // A Node that destroy_distant_nodes() has removed since is not in the
+    // journal: what the edit does to it, or to its Lines, is skipped.
+    void apply(Edit& edit, bool forward) noexcept {
+        using Kind = Edit::Kind;
+        wait_for_lookups();
+        switch (edit.kind) {
+            case Kind::AddNode:
+            case Kind::RemoveNode:
+                if ((edit.kind == Kind::AddNode) == forward) {
+                    if (!node_slots.is_free(edit.nodes[0].id)) break;
+                    add_node(edit.nodes[0], edit.nodes[0].id);
+                    for (const auto& [handle, line] : edit.lines) {
+                        if (can_give_back_line(handle, line)) add_line(line, handle);
+                    }
+                } else {
+                    if (!node_slots.contains(edit.nodes[0].id)) break;
+                    remove_node(node_slots.index_of(edit.nodes[0].id));
+                }
+                break;
+            case Kind::AddLine:
+            case Kind::RemoveLine:
+                if ((edit.kind == Kind::AddLine) == forward) {
+                    if (can_give_back_line(edit.lines[0].handle, edit.lines[0].line)) add_line(edit.lines[0].line, edit.lines[0].handle);
+                } else {
+                    if (line_slots.contains(edit.lines[0].handle)) remove_line(edit.lines[0].handle);
+                }
+                break;
+            case Kind::ChangeNode: {
+                // The pin and the color; the Node stays where it is now
+                if (!node_slots.contains(edit.nodes[0].id)) break;
+                auto& node = nodes[node_slots.index_of(edit.nodes[0].id)];
+                const auto& to = edit.nodes[forward ? 1 : 0];
+                node.is_pinned = to.is_pinned;
+                node.color = to.color;
+                if (node.is_pinned) node.velocity = Vector2f{};
+                nodes_dirty.mark(index_of_node_with_id(node.id));
+                break;
+            }
+            case Kind::AddMesh:
+                if (forward) {
+                    std::vector<Node> given_back;
+                    for (const auto& node : edit.nodes) {
+                        if (node_slots.is_free(node.id)) given_back.push_back(node);
+                    }
+                    add_nodes(given_back, true);
+                    std::vector<Line> lines_given_back;
+                    std::vector<unsigned int> handles;
+                    for (const auto& [handle, line] : edit.lines) {
+                        if (!can_give_back_line(handle, line)) continue;
+                        lines_given_back.push_back(line);
+                        handles.push_back(handle);
+                    }
+                    add_lines(lines_given_back, handles);
+                } else {
+                    // The last Nodes first, so that none has to move
+                    for (auto it = edit.nodes.rbegin(); it != edit.nodes.rend(); ++it) {
+                        if (node_slots.contains(it->id)) remove_node(node_slots.index_of(it->id));
+                    }
+                }
+                break;
+            case Kind::ReplaceGraph:
+                swap_graph(*edit.graph);
+                break;
+        }
+    }
+
+    // Both its Nodes are there and its handle is free
+    bool can_give_back_line(unsigned int handle, const Line& line) const noexcept {
+        return node_slots.contains(line.id1) && node_slots.contains(line.id2) && line_slots.is_free(handle)
+            && !line_of_key.contains(line_key(line.id1, line.id2));
+    }
+
+    // Of the Node at index, before it is removed
+    Edit removal_of_node(unsigned int index) noexcept {
+        wait_for_lookups();
+        Edit edit{ Edit::Kind::RemoveNode, { nodes[index] }, {}, nullptr };
+        for (unsigned int handle : lines_of_node[index]) edit.lines.push_back({ handle, lines[line_slots.index_of(handle)] });
+        return edit;
+    }
+
     void flip_pin_at(const Vector2f& pos) noexcept {
         const auto index_opt = index_of_node_closest_to(pos);
         if (!index_opt) return;
-        nodes[*index_opt].flip_pin();
+        auto& node = nodes[*index_opt];
+        const Node before = node;
+        node.flip_pin();
+        nodes_dirty.mark(*index_opt);
+        journal.record(Edit{ Edit::Kind::ChangeNode, { before, node }, {}, nullptr });
     }
 
     unsigned int pick_id_except_for(const std::vector<Node>& nodes, unsigned int forbidden_id) const noexcept {
@@ -211,7 +513,8 @@ struct World {
     void spawn_node(const Vector2f& pos) noexcept {
         auto node = Node{ pos };
         node.unpin();
-        add_node(std::move(node));
+        if (add_node(std::move(node)) == Slots::invalid) return;
+        journal.record(Edit{ Edit::Kind::AddNode, { nodes.back() }, {}, nullptr });
     }
 
     void spawn_line(const Vector2f& pos1, const Vector2f& pos2) noexcept {
@@ -221,10 +524,56 @@ struct World {
         const auto id1 = nodes[*n1_opt].id;
         const auto id2 = nodes[*n2_opt].id;
         if (id1 == id2) return;
-        for (const auto& line : lines) {
-            if ((line.id1 == id1 && line.id2 == id2) || (line.id1 == id2 && line.id2 == id1)) return;
+        if (line_of_key.contains(line_key(id1, id2))) return;
+        const auto handle = add_line(Line(id1, id2));
+        if (handle == Slots::invalid) return;
+        journal.record(Edit{ Edit::Kind::AddLine, {}, { { handle, Line(id1, id2) } }, nullptr });
+    }
+
+    // A cloth of columns x rows Nodes around center, hanging from its top
+    // row, with a Line to each neighbour across and down; added in one batch
+    // and undone as one edit
+    void spawn_mesh(const Vector2f& center, unsigned int columns, unsigned int rows) noexcept {
+        if (columns == 0 || rows == 0) return;
+        constexpr float spacing = 6.0f; // the rest length of the springs
+        const auto start = std::chrono::steady_clock::now();
+        const unsigned int lines_count = rows * (columns - 1) + (rows - 1) * columns;
+        if (!line_slots.has_room(lines_count)) {
+            std::cout << "Cannot add " << lines_count << " Lines, there are already " << lines.size() << '\n';
+            return;
+        }
+
+        std::vector<Node> mesh_nodes;
+        mesh_nodes.reserve(columns * rows);
+        for (unsigned int r = 0; r < rows; r++) {
+            for (unsigned int c = 0; c < columns; c++) {
+                const Vector2f offset{ (c - 0.5f * (columns - 1)) * spacing, (0.5f * (rows - 1) - r) * spacing };
+                auto& node = mesh_nodes.emplace_back(center + offset);
+                if (r == 0) node.pin();
+                else node.unpin();
+            }
+        }
+        const auto ids = add_nodes(mesh_nodes);
+        if (ids.empty()) return;
+
+        std::vector<Line> mesh_lines;
+        mesh_lines.reserve(lines_count);
+        for (unsigned int r = 0; r < rows; r++) {
+            for (unsigned int c = 0; c < columns; c++) {
+                const unsigned int i = r * columns + c;
+                if (c + 1 < columns) mesh_lines.emplace_back(ids[i], ids[i + 1]);
+                if (r + 1 < rows) mesh_lines.emplace_back(ids[i], ids[i + columns]);
+            }
         }
-        add_line(Line(id1, id2));
+        const auto handles = add_lines(mesh_lines);
+
+        Edit edit{ Edit::Kind::AddMesh, { nodes.end() - ids.size(), nodes.end() }, {}, nullptr };
+        edit.lines.reserve(handles.size());
+        for (unsigned int i = 0; i < handles.size(); i++) edit.lines.push_back({ handles[i], mesh_lines[i] });
+        journal.record(std::move(edit));
+
+        const auto ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Spawned a mesh of " << ids.size() << " Nodes and " << handles.size() << " Lines in " << ms << " ms\n";
     }
 
     void destroy_node(const Vector2f& pos) noexcept {
@@ -233,31 +582,8 @@ struct World {
         if (!index_node_opt) return;
         const unsigned int id = nodes[*index_node_opt].id;
         std::cout << " with id = " << id << '\n';
-
-        // Remove all connected lines
-        // std::cout << "Size before " << lines.size() << std::endl;
-        // for (const auto& line : lines) {
-        //     if ((line.id1 == id) || (line.id2 == id)) {
-        //         std::cout << "Must remove line with ids = " << line.id1 << " and " << line.id2 << '\n';
-        //     } else {
-        //         std::cout << "Will leave line with ids = " << line.id1 << " and " << line.id2 << '\n';
-        //     }
-        // }
-        lines.erase(std::remove_if(lines.begin(), lines.end(), [&id](const Line& line) {
-            return (line.id1 == id) || (line.id2 == id);
-        }), lines.end());
-        // for (const auto& line : lines) {
-            // std::cout << "Line remained with ids = " << line.id1 << " and " << line.id2 << '\n';
-        // }
-        // std::cout << "Size after " << lines.size() << std::endl;
-
-        // Remove the Node itself
-        nodes.erase(std::remove_if(nodes.begin(), nodes.end(), [&id](const Node& node) {
-            return node.id == id;
-        }), nodes.end());
-        // for (const auto& node : nodes) {
-        //     std::cout << "Remaining nodes with id = " << node.id << '\n';
-        // }
+        journal.record(removal_of_node(*index_node_opt));
+        remove_node(*index_node_opt);
         std::cout << '\n';
         std::cout << '\n';
     }
@@ -270,167 +596,273 @@ struct World {
         const unsigned int id1 = nodes[*index1_node_opt].id;
         const unsigned int id2 = nodes[*index2_node_opt].id;
         std::cout << " with ids = " << id1 << " and " << id2 << '\n';
-        lines.erase(std::remove_if(lines.begin(), lines.end(), [id1, id2](const Line& line) {
-            return ((line.id1 == id1) && (line.id2 == id2)) || ((line.id1 == id2) && (line.id2 == id1));
-        }), lines.end());
-        for (const auto& line : lines) {
-            std::cout << "Line remained with ids = " << line.id1 << " and " << line.id2 << '\n';
+        if (const auto it = line_of_key.find(line_key(id1, id2)); it != line_of_key.end()) {
+            const unsigned int handle = it->second;
+            journal.record(Edit{ Edit::Kind::RemoveLine, {}, { { handle, lines[line_slots.index_of(handle)] } }, nullptr });
+            remove_line(handle);
         }
         std::cout << '\n';
         std::cout << '\n';
     }
 
-    std::optional<unsigned int> index_of_node_closest_to(const Vector2f& pos) const noexcept {
-        constexpr float threshold = 6.0f;
-        int min_i = -1;
-        float min_dst = std::numeric_limits<float>::max();
-        for (unsigned int i = 0; i < nodes.size(); i++) {
-            const auto dst = (nodes[i].position - pos).length_sqr();
-            if (dst < min_dst && dst < threshold) {
-                min_dst = dst;
-                min_i = i;
-            }
-        }
-        if (min_i >= 0) {
-            return { static_cast<unsigned int>(min_i) };
-        }
-        return std::nullopt;
+    std::optional<unsigned int> index_of_node_closest_to(const Vector2f& pos) noexcept {
+        wait_for_lookups();
+        constexpr float threshold = 6.0f; // squared distance
+        const auto id_opt = node_grid.closest_within(pos.x, pos.y, std::sqrt(threshold), [this](unsigned int id) -> const Vector2f& {
+            return position_of_node_with_id(id);
+        });
+        if (!id_opt) return std::nullopt;
+        return { index_of_node_with_id(*id_opt) };
+    }
+
+    std::vector<unsigned int> indices_of_nodes_within(const Vector2f& pos, float radius) noexcept {
+        wait_for_lookups();
+        auto indices = node_grid.all_within(pos.x, pos.y, radius, [this](unsigned int id) -> const Vector2f& {
+            return position_of_node_with_id(id);
+        });
+        for (auto& index : indices) index = index_of_node_with_id(index); // ids to indices
+        return indices;
+    }
+
+    const Vector2f& position_of_node_with_id(unsigned int id) const noexcept {
+        return nodes[index_of_node_with_id(id)].position;
     }
 
     unsigned int index_of_node_with_id(unsigned int id) const noexcept {
-        for (unsigned int i = 0; i < nodes.size(); i++) {
-            if (nodes[i].id == id) return i;
-        }
+        if (node_slots.contains(id)) return node_slots.index_of(id);
         std::cout << "[ASSERTION]: no Node with id = " << id << '\n';
         assert(false);
     }
 
-    std::vector<unsigned int> indices_of_lines_connected_to_node_id(unsigned int id) const noexcept {
-        std::vector<unsigned int> indices;
+    // Same for both directions
+    static unsigned long long line_key(unsigned int id1, unsigned int id2) noexcept {
+        if (id1 > id2) std::swap(id1, id2);
+        return (static_cast<unsigned long long>(id1) << 32) | id2;
+    }
+
+    // Together with its Lines. The last Node takes its place, so only that
+    // Node and the indices of its Lines have to be rewritten on the GPU.
+    void remove_node(unsigned int index) noexcept {
+        wait_for_lookups();
+        const unsigned int id = nodes[index].id;
+        while (!lines_of_node[index].empty()) remove_line(lines_of_node[index].back());
+
+        const unsigned int last = nodes.size() - 1;
+        nodes[index] = nodes[last];
+        lines_of_node[index] = std::move(lines_of_node[last]);
+        nodes.pop_back();
+        lines_of_node.pop_back();
+        node_slots.remove(id);
+        node_grid.remove(id);
+        if (index != last) {
+            nodes_dirty.mark(index);
+            for (unsigned int line : lines_of_node[index]) lines_dirty.mark(line_slots.index_of(line));
+        }
+        adjacency_outdated = true;
+    }
+
+    // The last Line takes its place
+    void remove_line(unsigned int handle) noexcept {
+        wait_for_lookups();
+        const unsigned int index = line_slots.index_of(handle);
+        const Line line = lines[index];
+        for (unsigned int id : { line.id1, line.id2 }) {
+            auto& of_node = lines_of_node[index_of_node_with_id(id)];
+            *std::find(of_node.begin(), of_node.end(), handle) = of_node.back();
+            of_node.pop_back();
+        }
+        line_of_key.erase(line_key(line.id1, line.id2));
+
+        const unsigned int last = lines.size() - 1;
+        lines[index] = lines[last];
+        lines.pop_back();
+        line_slots.remove(handle);
+        if (index != last) lines_dirty.mark(index);
+        adjacency_outdated = true;
+    }
+
+    // Counting sort of the Line ends by Node index
+    void rebuild_adjacency() noexcept {
+        adjacency_offsets.assign(nodes.size() + 1, 0);
+        for (const auto& line : lines) {
+            adjacency_offsets[index_of_node_with_id(line.id1) + 1]++;
+            adjacency_offsets[index_of_node_with_id(line.id2) + 1]++;
+        }
+        for (unsigned int i = 0; i < nodes.size(); i++) adjacency_offsets[i + 1] += adjacency_offsets[i];
+
+        adjacency.resize(2 * lines.size());
+        std::vector<unsigned int> next(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+        for (const auto& line : lines) {
+            const auto index1 = index_of_node_with_id(line.id1);
+            const auto index2 = index_of_node_with_id(line.id2);
+            adjacency[next[index1]++] = index2;
+            adjacency[next[index2]++] = index1;
+        }
+
+        spring_solver.resize_nodes(nodes.size());
+        spring_solver.ends1.resize(lines.size());
+        spring_solver.ends2.resize(lines.size());
         for (unsigned int i = 0; i < lines.size(); i++) {
-            const auto& line = lines[i];
-            if (line.id1 == id || line.id2 == id) indices.push_back(i);
+            spring_solver.ends1[i] = index_of_node_with_id(lines[i].id1);
+            spring_solver.ends2[i] = index_of_node_with_id(lines[i].id2);
         }
-        return indices;
+        spring_solver.springs_changed();
+
+        adjacency_outdated = false;
     }
 
     void prepare_nodes(unsigned int starting_capacity) {
         nodes.reserve(starting_capacity);
-        last_known_nodes_capacity = nodes.capacity();
+        gpu_nodes_capacity = starting_capacity;
 
-        glGenVertexArrays(1, &vao_nodes);
-        glBindVertexArray(vao_nodes);
         {
-            glGenBuffers(1, &vbo_nodes);
-            glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes);
-            const unsigned int size_bytes = nodes.capacity() * vertices_per_node * node_vertex_components * sizeof(float);
+            const float corners[vertices_per_quad * 2] = {
+                -1.0f, -1.0f,
+                +1.0f, -1.0f,
+                -1.0f, +1.0f,
+                +1.0f, +1.0f
+            };
+            glGenBuffers(1, &vbo_quad);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_quad);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        }
+        {
             const float* data = 0;
-            glBufferData(GL_ARRAY_BUFFER, size_bytes, data, GL_DYNAMIC_DRAW);
-
-            specify_attribs_for_nodes(); // proper GL_ARRAY_BUFFER must be bound!
+            glGenBuffers(1, &vbo_positions);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_positions);
+            glBufferData(GL_ARRAY_BUFFER, gpu_nodes_capacity * position_size_bytes, data, GL_DYNAMIC_DRAW);
+            glGenBuffers(1, &vbo_colors);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_colors);
+            glBufferData(GL_ARRAY_BUFFER, gpu_nodes_capacity * color_size_bytes, data, GL_DYNAMIC_DRAW);
         }
 
-        fill_nodes_indices_for_capacity(ibo_nodes, nodes.capacity());
-
+        glGenVertexArrays(1, &vao_nodes);
+        glBindVertexArray(vao_nodes);
+        specify_attribs_for_nodes();
         glBindVertexArray(0);
     }
 
-    // Nodes count is for Lines' VBO,
-    // Lines count is for Lines' IBO.
-    void prepare_lines(unsigned int nodes_capacity, unsigned int lines_starting_capacity) {
+    // The vertices are those of the Nodes, so prepare_nodes() goes first
+    void prepare_lines(unsigned int lines_starting_capacity) {
         lines.reserve(lines_starting_capacity);
-        last_known_lines_capacity = lines.capacity();
+        gpu_lines_capacity = lines_starting_capacity;
 
         glGenVertexArrays(1, &vao_lines);
         glBindVertexArray(vao_lines);
-        {
-            // Stores Dots
-            glGenBuffers(1, &vbo_lines);
-            glBindBuffer(GL_ARRAY_BUFFER, vbo_lines);
-            const unsigned int size_bytes = nodes_capacity * dot_vertex_components * sizeof(float);
-            const float* data = 0;
-            glBufferData(GL_ARRAY_BUFFER, size_bytes, data, GL_DYNAMIC_DRAW);
-
-            specify_attribs_for_lines(); // proper GL_ARRAY_BUFFER must be bound!
-        }
+        specify_attribs_for_lines();
 
         // The filling will be done upon Line addition
-        allocate_lines_indices_for_capacity(ibo_lines, lines.capacity());
+        allocate_lines_indices_for_capacity(ibo_lines, gpu_lines_capacity);
 
         glBindVertexArray(0);
     }
 
+    // Into the bound VAO, again whenever the buffers are replaced
     void specify_attribs_for_nodes() const noexcept {
         {
             const auto index = 0;
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_quad);
             glEnableVertexAttribArray(index);
             const auto floats_per_vertex = 2; // inner_xy
-            const auto stride_bytes = node_vertex_components * sizeof(float);
-            const auto offset_bytes = 0;
-            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, 0, 0);
         }
         {
             const auto index = 1;
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_positions);
             glEnableVertexAttribArray(index);
-            const auto floats_per_vertex = 3; // x, y, z
-            const auto stride_bytes = node_vertex_components * sizeof(float);
-            const auto offset_bytes = 2 * sizeof(float); // skip inner_xy
-            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+            glVertexAttribPointer(index, position_components, GL_FLOAT, GL_FALSE, 0, 0);
+            glVertexAttribDivisor(index, 1); // per Node
         }
         {
             const auto index = 2;
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_colors);
             glEnableVertexAttribArray(index);
-            const auto floats_per_vertex = 3; // color3
-            const auto stride_bytes = node_vertex_components * sizeof(float);
-            const auto offset_bytes = (2 + 3) * sizeof(float); // skip inner_xy and x,y,z
-            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+            const auto channels = 4; // RGBA, normalized to [0, 1]
+            glVertexAttribPointer(index, channels, GL_UNSIGNED_BYTE, GL_TRUE, 0, 0);
+            glVertexAttribDivisor(index, 1); // per Node
         }
     }
 
     void specify_attribs_for_lines() const noexcept {
         {
             const auto index = 0;
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_positions);
             glEnableVertexAttribArray(index);
-            const auto floats_per_vertex = 3; // x, y, z
-            const auto stride_bytes = dot_vertex_components * sizeof(float);
-            const auto offset_bytes = 0;
-            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+            glVertexAttribPointer(index, position_components, GL_FLOAT, GL_FALSE, 0, 0);
         }
         {
             const auto index = 1;
+            glBindBuffer(GL_ARRAY_BUFFER, vbo_colors);
             glEnableVertexAttribArray(index);
-            const auto floats_per_vertex = 3; // color3
-            const auto stride_bytes = dot_vertex_components * sizeof(float);
-            const auto offset_bytes = 3 * sizeof(float); // skip x,y,z
-            glVertexAttribPointer(index, floats_per_vertex, GL_FLOAT, GL_FALSE, stride_bytes, reinterpret_cast<const void*>(offset_bytes));
+            const auto channels = 4; // RGBA, normalized to [0, 1]
+            glVertexAttribPointer(index, channels, GL_UNSIGNED_BYTE, GL_TRUE, 0, 0);
         }
     }
 
+    // The depth of a Node goes up with its index, so that the later ones are on top
+    void set_uniforms() noexcept {
+        shader_node.bind();
+        shader_node.setUniform1f("u_half_size", 0.5f * NODE_SIZE);
+        shader_node.setUniform1f("u_z", z_nodes);
+        shader_node.setUniform1f("u_z_delta", z_delta);
+        shader_line.bind();
+        shader_line.setUniform1f("u_z", z_lines);
+        shader_line.setUniform1f("u_z_delta", z_delta);
+    }
+
     void add_sample_grid() noexcept {
-        add_node(Node{ 1, Vector2f{10.0f, 20.0f}});
-        add_node(Node{ 2, Vector2f{20.0f, 20.0f}});
-        add_node(Node{ 3, Vector2f{30.0f, 30.0f}});
+        const auto id1 = add_node(Node{ Vector2f{10.0f, 20.0f}});
+        const auto id2 = add_node(Node{ Vector2f{20.0f, 20.0f}});
+        const auto id3 = add_node(Node{ Vector2f{30.0f, 30.0f}});
         // Depends on Nodes, so must be done after the Nodes have been set up
-        add_line(Line{ 1, 2 });
-        add_line(Line{ 2, 3 });
+        add_line(Line{ id1, id2 });
+        add_line(Line{ id2, id3 });
     }
 
     void update_and_render(float dt) noexcept {
         if (physics_is_on) {
             do_physics(dt);
         }
-        resubmit_nodes_vertices();
-        resubmit_lines_vertices();
-        fill_lines_indices(ibo_lines, lines);
+        upload_dirty();
+        if (upload_metric_on) std::cout << "Upload = " << uploaded_bytes << " bytes in " << upload_writes << " writes\n";
 
         render_lines();
         render_nodes();
     }
 
+    void flip_upload_metric() noexcept {
+        upload_metric_on = !upload_metric_on;
+    }
+
+    // Only what has been marked since the last frame; nothing on an idle one
+    void upload_dirty() noexcept {
+        uploaded_bytes = 0;
+        upload_writes = 0;
+        for (const auto& [begin, end] : nodes_dirty.coalesce(nodes.size(), coalesce_gap)) {
+            write_nodes_colors(begin, end);
+            uploaded_bytes += (end - begin) * color_size_bytes;
+            upload_writes += 1;
+            positions_dirty.mark(begin, end);
+        }
+        for (const auto& [begin, end] : positions_dirty.coalesce(nodes.size(), coalesce_gap)) {
+            write_nodes_positions(begin, end);
+            uploaded_bytes += (end - begin) * position_size_bytes;
+            upload_writes += 1;
+        }
+        for (const auto& [begin, end] : lines_dirty.coalesce(lines.size(), coalesce_gap)) {
+            write_lines_indices(begin, end);
+            uploaded_bytes += (end - begin) * line_size_bytes;
+            upload_writes += 1;
+        }
+        nodes_dirty.clear();
+        positions_dirty.clear();
+        lines_dirty.clear();
+    }
+
     void render_nodes() const noexcept {
         shader_node.bind();
         glBindVertexArray(vao_nodes);
-        glDrawElements(GL_TRIANGLES, nodes.size() * indices_per_node, GL_UNSIGNED_INT, 0);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, vertices_per_quad, nodes.size());
         glBindVertexArray(0);
     }
 
@@ -443,7 +875,11 @@ struct World {
 
     void do_physics(float dt) noexcept {
         // verlet(dt);
-        springs_physics(dt);
+        if (edge_solver_on) springs_physics_per_line(dt);
+        else springs_physics(dt);
+        if (lookup_builders.empty()) { // otherwise wait_for_lookups() does it
+            for (const auto& node : nodes) node_grid.move(node.id, node.position.x, node.position.y);
+        }
     }
 
     // void verlet(float dt) noexcept {
@@ -508,26 +944,18 @@ struct World {
             if (pos.y > 8.0f * world_size.y) return true;
             return false;
         };
-        std::optional<unsigned int> removed_id = std::nullopt;
-        for (auto it = nodes.begin(); it != nodes.end(); ++it) {
-            if (is_too_distant(world_size, it->position)) {
-                std::cout << "Auto-removing Node " << it->id << " because it is too distant\n";
-                removed_id = { it->id };
-                nodes.erase(it);
-                break;
+        for (unsigned int i = 0; i < nodes.size(); i++) {
+            if (is_too_distant(world_size, nodes[i].position)) {
+                std::cout << "Auto-removing Node " << nodes[i].id << " because it is too distant\n";
+                remove_node(i); // not an edit to undo, see apply()
+                return;
             }
         }
-
-        if (!removed_id) return;
-        // Remove all connected lines
-        const auto id = *removed_id;
-        lines.erase(std::remove_if(lines.begin(), lines.end(), [id](const Line& line) {
-            return (line.id1 == id) || (line.id2 == id);
-        }), lines.end());
     }
 
     void springs_physics(float dt) noexcept {
         destroy_distant_nodes();
+        if (adjacency_outdated) rebuild_adjacency();
         // NOTE can improve from O(N2) by pair-calculationg the force
         constexpr float spring_default_length = 6.0f;
         constexpr float G = 9.8f;
@@ -535,7 +963,8 @@ struct World {
         constexpr float time_scaler = 0.0000025f;
         constexpr float dissipation_ration_per_second = 0.1f;
         const float t = time_scaler * dt;
-        for (auto& node : nodes) {
+        for (unsigned int i = 0; i < nodes.size(); i++) {
+            auto& node = nodes[i];
             if (node.is_pinned) continue;
             // std::cout << "Old position of node " << node.id << " is " << node.position << '\n';
             // std::cout << "Old velocity of node " << node.id << " is " << node.velocity << '\n';
@@ -543,10 +972,9 @@ struct World {
             // Apply gravity to speed
             node.velocity += Vector2f{ 0.0f, -1.0f } * (t * G);
             // Apply springs to speed
-            bool has_springs = false;
-            for (unsigned int index : indices_of_lines_connected_to_node_id(node.id)) {
-                has_springs = true;
-                const auto& other_node = nodes[index_of_node_with_id(lines[index].the_other(node.id))];
+            const bool has_springs = adjacency_offsets[i] != adjacency_offsets[i + 1];
+            for (unsigned int a = adjacency_offsets[i]; a < adjacency_offsets[i + 1]; a++) {
+                const auto& other_node = nodes[adjacency[a]];
                 const Vector2f force_dir = (other_node.position - node.position).normalized();
                 const float spring_length = (other_node.position - node.position).length();
                 // const float force_strength_sqrt = spring_default_length - spring_length; // sign is fixed by sqr later
@@ -560,188 +988,226 @@ struct World {
             if (has_springs) node.velocity *= 1.0f - dissipation_ration_per_second * t;
             // Apply speed to position
             node.position += node.velocity * t;
+            positions_dirty.mark(i);
         }
     }
 
-    // TODO @speed add nodes as a batch
-    void add_node(const Node& node) noexcept {
-        nodes.push_back(node);
-
-        if (last_known_nodes_capacity != nodes.capacity()) {
-            std::cout << "Capacity of nodes change" << '\n';
-            last_known_nodes_capacity = nodes.capacity();
+    // The Nodes stay the storage, so their state goes through the SoA of the
+    // solver and back
+    void springs_physics_per_line(float dt) noexcept {
+        destroy_distant_nodes();
+        if (adjacency_outdated) rebuild_adjacency();
+        auto& s = spring_solver;
+        for (unsigned int i = 0; i < nodes.size(); i++) {
+            const auto& node = nodes[i];
+            s.xs[i] = node.position.x;
+            s.ys[i] = node.position.y;
+            s.vxs[i] = node.velocity.x;
+            s.vys[i] = node.velocity.y;
+            s.movable[i] = node.is_pinned ? 0.0f : 1.0f;
+        }
+        s.step(dt);
+        for (unsigned int i = 0; i < nodes.size(); i++) {
+            auto& node = nodes[i];
+            if (node.is_pinned) continue;
+            node.position = Vector2f{ s.xs[i], s.ys[i] };
+            node.velocity = Vector2f{ s.vxs[i], s.vys[i] };
+            positions_dirty.mark(i);
+        }
+    }
 
-            glBindVertexArray(vao_nodes);
-            {
-                // Reallocate IBO
-                glDeleteBuffers(1, &ibo_nodes);
-                fill_nodes_indices_for_capacity(ibo_nodes, nodes.capacity());
+    // Returns the id given to the Node, or Slots::invalid when there are
+    // already Slots::max_size of them. An undo gives the id back with handle.
+    unsigned int add_node(const Node& new_node, unsigned int handle = Slots::invalid) noexcept {
+        if (handle == Slots::invalid && !node_slots.has_room()) {
+            std::cout << "Cannot add a Node, there are already " << nodes.size() << '\n';
+            return Slots::invalid;
+        }
+        wait_for_lookups();
+        nodes.push_back(new_node);
+        auto& node = nodes.back();
+        node.id = (handle == Slots::invalid) ? node_slots.add() : node_slots.revive(handle);
+        lines_of_node.emplace_back();
+        node_grid.insert(node.id, node.position.x, node.position.y);
+        adjacency_outdated = true;
+
+        reserve_gpu_nodes(nodes.size());
+        nodes_dirty.mark(nodes.size() - 1);
+        return node.id;
+    }
 
-                // Reallocate VBO
-                glDeleteBuffers(1, &vbo_nodes);
-                glGenBuffers(1, &vbo_nodes);
-                glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes);
-                const unsigned int size_bytes = nodes.capacity() * vertices_per_node * node_vertex_components * sizeof(float);
-                const float* data = 0;
-                glBufferData(GL_ARRAY_BUFFER, size_bytes, data, GL_DYNAMIC_DRAW);
-                // Refill the old part of VBO
-                resubmit_nodes_vertices();
-                specify_attribs_for_nodes(); // proper GL_ARRAY_BUFFER must be bound!
-            }
+    // Returns the ids given to the Nodes, in order; all of them go to the
+    // GPU in one upload, with the next frame. None is added, and no id
+    // returned, when they do not all fit. An undo gives the ids of
+    // new_nodes back with give_back_ids.
+    std::vector<unsigned int> add_nodes(const std::vector<Node>& new_nodes, bool give_back_ids = false) noexcept {
+        if (!give_back_ids && !node_slots.has_room(new_nodes.size())) {
+            std::cout << "Cannot add " << new_nodes.size() << " Nodes, there are already " << nodes.size() << '\n';
+            return {};
+        }
+        wait_for_lookups();
+        const unsigned int first = nodes.size();
+        nodes.insert(nodes.end(), new_nodes.begin(), new_nodes.end());
+        lines_of_node.resize(nodes.size());
+        std::vector<unsigned int> ids(new_nodes.size());
+        node_grid.reserve(nodes.size());
+        for (unsigned int i = first; i < nodes.size(); i++) {
+            auto& node = nodes[i];
+            node.id = ids[i - first] = give_back_ids ? node_slots.revive(node.id) : node_slots.add();
+            node_grid.insert(node.id, node.position.x, node.position.y);
+        }
+        adjacency_outdated = true;
 
-            glBindVertexArray(vao_lines);
-            {
-                // Reallocate VBO
-                glDeleteBuffers(1, &vbo_lines);
-                glGenBuffers(1, &vbo_lines);
-                glBindBuffer(GL_ARRAY_BUFFER, vbo_lines);
-                const unsigned int size_bytes = nodes.capacity() * vertices_per_dot * dot_vertex_components * sizeof(float);
-                const float* data = 0;
-                glBufferData(GL_ARRAY_BUFFER, size_bytes, data, GL_DYNAMIC_DRAW);
-                // Refill the old part of VBO
-                resubmit_lines_vertices();
-                specify_attribs_for_lines(); // proper GL_ARRAY_BUFFER must be bound!
-            }
-            glBindVertexArray(0);
-        } else {
-            // Append the Node part
-            {
-                glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes);
-                const unsigned int skip_size_bytes = (nodes.size() - 1) * vertices_per_node * node_vertex_components * sizeof(float);
-                const float half_size = 0.5f * NODE_SIZE;
-                const float z = z_nodes + z_delta * (nodes.size() - 1);
-                const float data[vertices_per_node * node_vertex_components] = {
-                    -1.0f, -1.0f, node.position.x - half_size, node.position.y - half_size, z, node.color.x, node.color.y, node.color.z,
-                    -1.0f, +1.0f, node.position.x - half_size, node.position.y + half_size, z, node.color.x, node.color.y, node.color.z,
-                    +1.0f, +1.0f, node.position.x + half_size, node.position.y + half_size, z, node.color.x, node.color.y, node.color.z,
-                    +1.0f, -1.0f, node.position.x + half_size, node.position.y - half_size, z, node.color.x, node.color.y, node.color.z
-                };
-                const unsigned int data_size_bytes = vertices_per_node * node_vertex_components * sizeof(data[0]);
-                glBufferSubData(GL_ARRAY_BUFFER, skip_size_bytes, data_size_bytes, data);
-            }
+        reserve_gpu_nodes(nodes.size());
+        nodes_dirty.mark(first, nodes.size());
+        return ids;
+    }
 
-            // Append the Dot part
-            {
-                glBindBuffer(GL_ARRAY_BUFFER, vbo_lines);
-                const unsigned int skip_size_bytes = (nodes.size() - 1) * dot_vertex_components * sizeof(float);
-                const float z = z_lines + z_delta * (nodes.size() - 1);
-                const float data[dot_vertex_components] = {
-                    node.position.x, node.position.y, z, node.color.x, node.color.y, node.color.z
-                };
-                const unsigned int data_size_bytes = dot_vertex_components * sizeof(data[0]);
-                glBufferSubData(GL_ARRAY_BUFFER, skip_size_bytes, data_size_bytes, data);
-            }
+    // Returns the handle given to the Line, or Slots::invalid as for
+    // add_node(). An undo gives the handle back with handle.
+    unsigned int add_line(const Line& line, unsigned int handle = Slots::invalid) noexcept {
+        if (handle == Slots::invalid && !line_slots.has_room()) {
+            std::cout << "Cannot add a Line, there are already " << lines.size() << '\n';
+            return Slots::invalid;
         }
+        wait_for_lookups();
+        lines.push_back(line);
+        handle = (handle == Slots::invalid) ? line_slots.add() : line_slots.revive(handle);
+        line_of_key[line_key(line.id1, line.id2)] = handle;
+        lines_of_node[index_of_node_with_id(line.id1)].push_back(handle);
+        lines_of_node[index_of_node_with_id(line.id2)].push_back(handle);
+        adjacency_outdated = true;
+
+        reserve_gpu_lines(lines.size());
+        lines_dirty.mark(lines.size() - 1);
+        return handle;
     }
 
-    // TODO @speed add lines as a batch
-    void add_line(const Line& line) noexcept {
-        lines.push_back(line);
+    // Returns the handles given to the Lines, in order; one upload, and all
+    // or none of them, as for add_nodes(). An undo gives the handles back
+    // with given_back_handles, one per Line.
+    std::vector<unsigned int> add_lines(const std::vector<Line>& new_lines, const std::vector<unsigned int>& given_back_handles = {}) noexcept {
+        if (given_back_handles.empty() && !line_slots.has_room(new_lines.size())) {
+            std::cout << "Cannot add " << new_lines.size() << " Lines, there are already " << lines.size() << '\n';
+            return {};
+        }
+        wait_for_lookups();
+        const unsigned int first = lines.size();
+        lines.insert(lines.end(), new_lines.begin(), new_lines.end());
+        line_of_key.reserve(lines.size());
+        // Each list of Lines of a Node grows once
+        std::vector<unsigned int> added_to_node(nodes.size(), 0);
+        for (const auto& line : new_lines) {
+            added_to_node[index_of_node_with_id(line.id1)]++;
+            added_to_node[index_of_node_with_id(line.id2)]++;
+        }
+        for (unsigned int i = 0; i < nodes.size(); i++) {
+            if (added_to_node[i]) lines_of_node[i].reserve(lines_of_node[i].size() + added_to_node[i]);
+        }
+        std::vector<unsigned int> handles(new_lines.size());
+        for (unsigned int i = first; i < lines.size(); i++) {
+            const auto& line = lines[i];
+            const unsigned int handle = handles[i - first] = given_back_handles.empty() ? line_slots.add() : line_slots.revive(given_back_handles[i - first]);
+            line_of_key[line_key(line.id1, line.id2)] = handle;
+            lines_of_node[index_of_node_with_id(line.id1)].push_back(handle);
+            lines_of_node[index_of_node_with_id(line.id2)].push_back(handle);
+        }
+        adjacency_outdated = true;
 
-        if (last_known_lines_capacity != lines.capacity()) {
-            std::cout << "Capacity of lines change" << '\n';
-            last_known_lines_capacity = lines.capacity();
+        reserve_gpu_lines(lines.size());
+        lines_dirty.mark(first, lines.size());
+        return handles;
+    }
 
-            glBindVertexArray(vao_lines);
-            glDeleteBuffers(1, &ibo_lines);
-            allocate_lines_indices_for_capacity(ibo_lines, lines.capacity());
-            glBindVertexArray(0);
-        }
+    // The buffers double when they grow, whatever the vectors do, and keep
+    // what they had: it is copied on the GPU
+    void reserve_gpu_nodes(unsigned int count) noexcept {
+        if (count <= gpu_nodes_capacity) return;
+        const unsigned int capacity = std::max(count, 2 * gpu_nodes_capacity);
+        std::cout << "GPU capacity of Nodes: " << capacity << '\n';
+
+        grow_buffer(vbo_positions, gpu_nodes_capacity * position_size_bytes, capacity * position_size_bytes);
+        grow_buffer(vbo_colors, gpu_nodes_capacity * color_size_bytes, capacity * color_size_bytes);
+        glBindVertexArray(vao_nodes);
+        specify_attribs_for_nodes();
+        glBindVertexArray(vao_lines);
+        specify_attribs_for_lines();
+        glBindVertexArray(0);
 
-        fill_lines_indices(ibo_lines, lines);
+        gpu_nodes_capacity = capacity;
     }
 
-    // TODO @speed store this ram-buffer separately for easier modification
-    void resubmit_nodes_vertices() const noexcept {
-        glBindBuffer(GL_ARRAY_BUFFER, vbo_nodes);
-        const auto count = nodes.size() * vertices_per_node * node_vertex_components;
-        const auto actual_size_bytes = count * sizeof(float);
-        float data[count];
+    void reserve_gpu_lines(unsigned int count) noexcept {
+        if (count <= gpu_lines_capacity) return;
+        const unsigned int capacity = std::max(count, 2 * gpu_lines_capacity);
+        std::cout << "GPU capacity of Lines: " << capacity << '\n';
 
-        for (unsigned int i = 0; i < nodes.size(); i++) {
-            const auto& node = nodes[i];
-            const auto half_size = 0.5f * NODE_SIZE;
-            const float z = z_nodes + z_delta * i;
-
-            data[i * vertices_per_node * node_vertex_components + 0 * node_vertex_components + 0] = -1.0f;
-            data[i * vertices_per_node * node_vertex_components + 0 * node_vertex_components + 1] = -1.0f;
-            data[i * vertices_per_node * node_vertex_components + 0 * node_vertex_components + 2] = node.position.x - half_size;
-            data[i * vertices_per_node * node_vertex_components + 0 * node_vertex_components + 3] = node.position.y - half_size;
-            data[i * vertices_per_node * node_vertex_components + 0 * node_vertex_components + 4] = z;
-            data[i * vertices_per_node * node_vertex_components + 0 * node_vertex_components + 5] = node.color.x;
-            data[i * vertices_per_node * node_vertex_components + 0 * node_vertex_components + 6] = node.color.y;
-            data[i * vertices_per_node * node_vertex_components + 0 * node_vertex_components + 7] = node.color.z;
-
-            data[i * vertices_per_node * node_vertex_components + 1 * node_vertex_components + 0] = -1.0f;
-            data[i * vertices_per_node * node_vertex_components + 1 * node_vertex_components + 1] = +1.0f;
-            data[i * vertices_per_node * node_vertex_components + 1 * node_vertex_components + 2] = node.position.x - half_size;
-            data[i * vertices_per_node * node_vertex_components + 1 * node_vertex_components + 3] = node.position.y + half_size;
-            data[i * vertices_per_node * node_vertex_components + 1 * node_vertex_components + 4] = z;
-            data[i * vertices_per_node * node_vertex_components + 1 * node_vertex_components + 5] = node.color.x;
-            data[i * vertices_per_node * node_vertex_components + 1 * node_vertex_components + 6] = node.color.y;
-            data[i * vertices_per_node * node_vertex_components + 1 * node_vertex_components + 7] = node.color.z;
-
-            data[i * vertices_per_node * node_vertex_components + 2 * node_vertex_components + 0] = +1.0f;
-            data[i * vertices_per_node * node_vertex_components + 2 * node_vertex_components + 1] = +1.0f;
-            data[i * vertices_per_node * node_vertex_components + 2 * node_vertex_components + 2] = node.position.x + half_size;
-            data[i * vertices_per_node * node_vertex_components + 2 * node_vertex_components + 3] = node.position.y + half_size;
-            data[i * vertices_per_node * node_vertex_components + 2 * node_vertex_components + 4] = z;
-            data[i * vertices_per_node * node_vertex_components + 2 * node_vertex_components + 5] = node.color.x;
-            data[i * vertices_per_node * node_vertex_components + 2 * node_vertex_components + 6] = node.color.y;
-            data[i * vertices_per_node * node_vertex_components + 2 * node_vertex_components + 7] = node.color.z;
-
-            data[i * vertices_per_node * node_vertex_components + 3 * node_vertex_components + 0] = +1.0f;
-            data[i * vertices_per_node * node_vertex_components + 3 * node_vertex_components + 1] = -1.0f;
-            data[i * vertices_per_node * node_vertex_components + 3 * node_vertex_components + 2] = node.position.x + half_size;
-            data[i * vertices_per_node * node_vertex_components + 3 * node_vertex_components + 3] = node.position.y - half_size;
-            data[i * vertices_per_node * node_vertex_components + 3 * node_vertex_components + 4] = z;
-            data[i * vertices_per_node * node_vertex_components + 3 * node_vertex_components + 5] = node.color.x;
-            data[i * vertices_per_node * node_vertex_components + 3 * node_vertex_components + 6] = node.color.y;
-            data[i * vertices_per_node * node_vertex_components + 3 * node_vertex_components + 7] = node.color.z;
-        }
-
-        glBufferSubData(GL_ARRAY_BUFFER, 0, actual_size_bytes, data);
-    }
-
-    // Have a Dot in the center of every Node
-    void resubmit_lines_vertices() const noexcept {
-        glBindBuffer(GL_ARRAY_BUFFER, vbo_lines);
-
-        const auto count = nodes.size() * dot_vertex_components;
-        const auto actual_size_bytes = count * sizeof(float);
-        float data[count];
+        grow_buffer(ibo_lines, gpu_lines_capacity * line_size_bytes, capacity * line_size_bytes);
+        glBindVertexArray(vao_lines);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_lines);
+        glBindVertexArray(0);
 
-        for (unsigned int i = 0; i < nodes.size(); i++) {
-            const auto& node = nodes[i];
-            const float z = z_lines + z_delta * i;
+        gpu_lines_capacity = capacity;
+    }
+
+    // A new buffer in place of buffer, starting with the old_size_bytes of it.
+    // The caller binds it wherever the old one was.
+    static void grow_buffer(unsigned int& buffer, unsigned int old_size_bytes, unsigned int new_size_bytes) noexcept {
+        unsigned int grown;
+        glGenBuffers(1, &grown);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+        glBufferData(GL_COPY_WRITE_BUFFER, new_size_bytes, nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, old_size_bytes);
+        glDeleteBuffers(1, &buffer);
+        buffer = grown;
+    }
 
-            data[i * dot_vertex_components + 0] = node.position.x;
-            data[i * dot_vertex_components + 1] = node.position.y;
-            data[i * dot_vertex_components + 2] = z;
-            data[i * dot_vertex_components + 3] = node.color.x;
-            data[i * dot_vertex_components + 4] = node.color.y;
-            data[i * dot_vertex_components + 5] = node.color.z;
+    // Of Nodes [begin, end)
+    void write_nodes_positions(unsigned int begin, unsigned int end) noexcept {
+        float* data = staging_for(staging_positions, (end - begin) * position_components);
+        for (unsigned int i = begin; i < end; i++) {
+            data[(i - begin) * position_components + 0] = nodes[i].position.x;
+            data[(i - begin) * position_components + 1] = nodes[i].position.y;
         }
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_positions);
+        glBufferSubData(GL_ARRAY_BUFFER, begin * position_size_bytes, (end - begin) * position_size_bytes, data);
+    }
 
-        glBufferSubData(GL_ARRAY_BUFFER, 0, actual_size_bytes, data);
+    // Of Nodes [begin, end)
+    void write_nodes_colors(unsigned int begin, unsigned int end) noexcept {
+        const auto channel = [](float c) {
+            return static_cast<unsigned char>(std::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+        };
+        unsigned char* data = staging_for(staging_colors, (end - begin) * color_size_bytes);
+        for (unsigned int i = begin; i < end; i++) {
+            const auto& color = nodes[i].color;
+            unsigned char* rgba = data + (i - begin) * color_size_bytes;
+            rgba[0] = channel(color.x);
+            rgba[1] = channel(color.y);
+            rgba[2] = channel(color.z);
+            rgba[3] = 255;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, vbo_colors);
+        glBufferSubData(GL_ARRAY_BUFFER, begin * color_size_bytes, (end - begin) * color_size_bytes, data);
     }
 
-    // Can be done in advance for capacity, because indices are the same for all Nodes
-    static void fill_nodes_indices_for_capacity(unsigned int& ibo_nodes, unsigned int nodes_capacity) noexcept {
-        unsigned int data[indices_per_node * nodes_capacity];
-        for (unsigned int i = 0; i < nodes_capacity; i++) {
-            data[i * indices_per_node + 0] = i * vertices_per_node + 0;
-            data[i * indices_per_node + 1] = i * vertices_per_node + 1;
-            data[i * indices_per_node + 2] = i * vertices_per_node + 2;
-            data[i * indices_per_node + 3] = i * vertices_per_node + 0;
-            data[i * indices_per_node + 4] = i * vertices_per_node + 2;
-            data[i * indices_per_node + 5] = i * vertices_per_node + 3;
+    // Of Lines [begin, end)
+    void write_lines_indices(unsigned int begin, unsigned int end) noexcept {
+        unsigned int* data = staging_for(staging_indices, (end - begin) * indices_per_line);
+        for (unsigned int i = begin; i < end; i++) {
+            data[(i - begin) * indices_per_line + 0] = index_of_node_with_id(lines[i].id1);
+            data[(i - begin) * indices_per_line + 1] = index_of_node_with_id(lines[i].id2);
         }
-        const unsigned int size_bytes = indices_per_node * nodes_capacity * sizeof(data[0]);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_lines);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, begin * line_size_bytes, (end - begin) * line_size_bytes, data);
+    }
 
-        glGenBuffers(1, &ibo_nodes);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_nodes);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, size_bytes, data, GL_STATIC_DRAW); // will be changed a couple of times
+    // Room for count elements in staging, grown only when it is not there yet
+    template<typename T>
+    static T* staging_for(std::vector<T>& staging, std::size_t count) noexcept {
+        if (staging.size() < count) staging.resize(count);
+        return staging.data();
     }
 
     // Cannot be done in advance for capacity, because indices are different,
@@ -755,21 +1221,6 @@ struct World {
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, size_bytes, data, GL_DYNAMIC_DRAW); // will be changed on every Line addition/removal
     }
 
-    void fill_lines_indices(unsigned int ibo_lines, const std::vector<Line>& lines) const noexcept {
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_lines);
-
-        const auto count = lines.size() * indices_per_line;
-        unsigned int data[count];
-        for (unsigned int i = 0; i < lines.size(); i++) {
-            data[i * indices_per_line + 0] = index_of_node_with_id(lines[i].id1);
-            data[i * indices_per_line + 1] = index_of_node_with_id(lines[i].id2);
-        }
-
-        const auto skip_size_bytes = 0;
-        const auto data_size_bytes = count * sizeof(data[0]);
-        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, skip_size_bytes, data_size_bytes, data);
-    }
-
     void set_mvp(const Matrix4f& mvp) noexcept {
         shader_node.bind();
         shader_node.setUniformMat4f("u_mvp", mvp);
@@ -793,6 +1244,8 @@ struct Game {
         World world;
         Matrix4f mvp;
         static constexpr float world_size_y = 100.0f;
+        static constexpr unsigned int mesh_columns = 16; // M
+        static constexpr unsigned int mesh_rows = 12;
         Vector2f world_size;
         Vector2f window_size;
 
@@ -802,6 +1255,11 @@ struct Game {
         bool pressed_rmb = false;
         bool pressed_mmb = false;
         bool pressed_space = false;
+        bool pressed_e = false;
+        bool pressed_z = false;
+        bool pressed_y = false;
+        bool pressed_u = false;
+        bool pressed_m = false;
         bool physics_on = false;
 
         static Matrix4f mvp_for_world_size(const Vector2f& world_size) noexcept {
@@ -869,6 +1327,46 @@ struct Game {
                 pressed_space = false;
             }
 
+            if (!pressed_e && (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)) {
+                pressed_e = true;
+                world.flip_spring_solver();
+            }
+            if (pressed_e && (glfwGetKey(window, GLFW_KEY_E) == GLFW_RELEASE)) {
+                pressed_e = false;
+            }
+
+            if (!pressed_z && (glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS)) {
+                pressed_z = true;
+                world.undo();
+            }
+            if (pressed_z && (glfwGetKey(window, GLFW_KEY_Z) == GLFW_RELEASE)) {
+                pressed_z = false;
+            }
+
+            if (!pressed_y && (glfwGetKey(window, GLFW_KEY_Y) == GLFW_PRESS)) {
+                pressed_y = true;
+                world.redo();
+            }
+            if (pressed_y && (glfwGetKey(window, GLFW_KEY_Y) == GLFW_RELEASE)) {
+                pressed_y = false;
+            }
+
+            if (!pressed_u && (glfwGetKey(window, GLFW_KEY_U) == GLFW_PRESS)) {
+                pressed_u = true;
+                world.flip_upload_metric();
+            }
+            if (pressed_u && (glfwGetKey(window, GLFW_KEY_U) == GLFW_RELEASE)) {
+                pressed_u = false;
+            }
+
+            if (!pressed_m && (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS)) {
+                pressed_m = true;
+                world.spawn_mesh(cursor_to_world_coord(get_cursor(window)), mesh_columns, mesh_rows);
+            }
+            if (pressed_m && (glfwGetKey(window, GLFW_KEY_M) == GLFW_RELEASE)) {
+                pressed_m = false;
+            }
+
             static std::optional<Vector2f> memorized_coord = std::nullopt;
             if (!pressed_lmb && glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
                 pressed_lmb = true;
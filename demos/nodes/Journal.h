@@ -0,0 +1,96 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <deque>
+#include <cstddef>
+
+
+// The history of edits for undo and redo. An Edit holds what it takes to do
+// and to undo it, and tells its own size_bytes(); the applying is up to the
+// caller. The oldest Edits are forgotten to stay within max_bytes, but never
+// the one just recorded, undone or redone: alone, it may be larger.
+template<typename Edit>
+struct Journal {
+    static constexpr std::size_t none = ~std::size_t{ 0 };
+
+    std::deque<Edit> edits;
+    std::size_t done = 0; // edits[0, done) can be undone, the rest redone
+    std::size_t size_bytes = 0;
+    std::size_t max_bytes;
+
+    Journal(std::size_t max_bytes) noexcept : max_bytes(max_bytes) {}
+
+    // Of an Edit that has just been done; whatever could be redone is gone
+    void record(Edit&& edit) noexcept {
+        while (edits.size() > done) {
+            size_bytes -= edits.back().size_bytes();
+            edits.pop_back();
+        }
+        size_bytes += edit.size_bytes();
+        edits.push_back(std::move(edit));
+        done++;
+        trim(done - 1);
+    }
+
+    // apply(edit) undoes the last done Edit; false if there is none
+    template<typename F>
+    bool undo(F&& apply) noexcept {
+        if (done == 0) return false;
+        done--;
+        apply_at(done, apply);
+        trim(done);
+        return true;
+    }
+
+    // apply(edit) redoes the first undone Edit; false if there is none
+    template<typename F>
+    bool redo(F&& apply) noexcept {
+        if (done == edits.size()) return false;
+        apply_at(done, apply);
+        done++;
+        trim(done - 1);
+        return true;
+    }
+
+    void set_max_bytes(std::size_t bytes) noexcept {
+        max_bytes = bytes;
+        trim(none);
+    }
+
+    void clear() noexcept {
+        edits.clear();
+        done = 0;
+        size_bytes = 0;
+    }
+
+    private:
+        // An Edit may change its size when applied (one that swaps
+        // whole states does)
+        template<typename F>
+        void apply_at(std::size_t i, F&& apply) noexcept {
+            size_bytes -= edits[i].size_bytes();
+            apply(edits[i]);
+            size_bytes += edits[i].size_bytes();
+        }
+
+        // The oldest undo goes first, then the furthest redo; edits[keep]
+        // stays, whatever its size (none keeps nothing)
+        void trim(std::size_t keep) noexcept {
+            while (size_bytes > max_bytes) {
+                if (done > 0 && keep != 0) {
+                    size_bytes -= edits.front().size_bytes();
+                    edits.pop_front();
+                    done--;
+                    if (keep != none) keep--;
+                } else if (edits.size() > done && keep != edits.size() - 1) {
+                    size_bytes -= edits.back().size_bytes();
+                    edits.pop_back();
+                } else {
+                    break;
+                }
+            }
+        }
+};
+
+
+#endif
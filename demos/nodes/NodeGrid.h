@@ -0,0 +1,127 @@
+#ifndef NODE_GRID_H
+#define NODE_GRID_H
+
+#include <vector>
+#include <unordered_map>
+#include <optional>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+
+
+// Uniform grid over the Node positions, for the queries around a point.
+// Unbounded: only the occupied cells exist, hashed by their coordinates.
+// Holds Node ids; the positions are asked from the caller through
+// position_of(id), so a move only costs something when the Node changes cells.
+struct NodeGrid {
+    float cell_size;
+    std::unordered_map<unsigned long long, std::vector<unsigned int>> cells;
+    std::unordered_map<unsigned int, unsigned long long> cell_of_id;
+
+    NodeGrid(float cell_size) noexcept : cell_size(cell_size) {}
+
+    void insert(unsigned int id, float x, float y) noexcept {
+        const auto cell = cell_at(x, y);
+        cells[cell].push_back(id);
+        cell_of_id[id] = cell;
+    }
+
+    void remove(unsigned int id) noexcept {
+        const auto it = cell_of_id.find(id);
+        if (it == cell_of_id.end()) return;
+        remove_from_cell(it->second, id);
+        cell_of_id.erase(it);
+    }
+
+    // To be called whenever a Node may have moved
+    void move(unsigned int id, float x, float y) noexcept {
+        auto& cell = cell_of_id[id];
+        const auto new_cell = cell_at(x, y);
+        if (new_cell == cell) return;
+        remove_from_cell(cell, id);
+        cells[new_cell].push_back(id);
+        cell = new_cell;
+    }
+
+    // For count Nodes in total, ahead of a batch of inserts
+    void reserve(std::size_t count) noexcept {
+        cell_of_id.reserve(count);
+    }
+
+    void clear() noexcept {
+        cells.clear();
+        cell_of_id.clear();
+    }
+
+    // The closest one strictly within radius; O(1) for a radius of the order of cell_size
+    template<typename PositionOf>
+    std::optional<unsigned int> closest_within(float x, float y, float radius, PositionOf&& position_of) const noexcept {
+        std::optional<unsigned int> closest = std::nullopt;
+        float min_dst = radius * radius;
+        for_each_within(x, y, radius, position_of, [&](unsigned int id, float dst) {
+            if (dst < min_dst) {
+                min_dst = dst;
+                closest = { id };
+            }
+        });
+        return closest;
+    }
+
+    // Ids of all the Nodes strictly within radius, in no particular order
+    template<typename PositionOf>
+    std::vector<unsigned int> all_within(float x, float y, float radius, PositionOf&& position_of) const noexcept {
+        std::vector<unsigned int> ids;
+        for_each_within(x, y, radius, position_of, [&](unsigned int id, float) {
+            ids.push_back(id);
+        });
+        return ids;
+    }
+
+    private:
+        static unsigned long long key(int cx, int cy) noexcept {
+            return (static_cast<unsigned long long>(static_cast<unsigned int>(cx)) << 32) | static_cast<unsigned int>(cy);
+        }
+
+        int cell_coord(float v) const noexcept {
+            return static_cast<int>(std::floor(v / cell_size));
+        }
+
+        unsigned long long cell_at(float x, float y) const noexcept {
+            return key(cell_coord(x), cell_coord(y));
+        }
+
+        void remove_from_cell(unsigned long long cell, unsigned int id) noexcept {
+            const auto it = cells.find(cell);
+            if (it == cells.end()) return;
+            auto& ids = it->second;
+            const auto found = std::find(ids.begin(), ids.end(), id);
+            if (found == ids.end()) return;
+            *found = ids.back();
+            ids.pop_back();
+            if (ids.empty()) cells.erase(it);
+        }
+
+        // f(id, squared distance) for every Node strictly within radius
+        template<typename PositionOf, typename F>
+        void for_each_within(float x, float y, float radius, PositionOf&& position_of, F&& f) const noexcept {
+            const float radius_sqr = radius * radius;
+            const int cx_min = cell_coord(x - radius);
+            const int cx_max = cell_coord(x + radius);
+            const int cy_min = cell_coord(y - radius);
+            const int cy_max = cell_coord(y + radius);
+            for (int cy = cy_min; cy <= cy_max; cy++) {
+                for (int cx = cx_min; cx <= cx_max; cx++) {
+                    const auto it = cells.find(key(cx, cy));
+                    if (it == cells.end()) continue;
+                    for (unsigned int id : it->second) {
+                        const auto [px, py] = position_of(id);
+                        const float dst = (px - x) * (px - x) + (py - y) * (py - y);
+                        if (dst < radius_sqr) f(id, dst);
+                    }
+                }
+            }
+        }
+};
+
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef SLOTS_H
+#define SLOTS_H
+
+#include <vector>
+#include <cstddef>
+#include <cassert>
+
+
+// Stable handles to the elements of a dense array that stays compact: an
+// element is removed by moving the last one into its place. The array itself
+// belongs to the caller, which makes the same move; this only keeps track of
+// where every handle went.
+// A handle is a slot (low 24 bits) and the generation of that slot (high 8
+// bits). Removing an element bumps the generation of its slot, so the old
+// handle stops being valid even when the slot is reused. 0 is never valid.
+// So there are at most max_size elements, see has_room(). A slot whose
+// generation has gone through all 255 values is retired instead of being
+// reused, so that a stale handle (one kept in the undo journal, say) can
+// never become valid again; only revive() brings it back.
+struct Slots {
+    static constexpr unsigned int slot_bits = 24;
+    static constexpr unsigned int slot_mask = (1u << slot_bits) - 1;
+    static constexpr unsigned int max_size = 1u << slot_bits;
+    static constexpr unsigned int invalid = 0;
+    static constexpr unsigned int retired = ~0u; // in dense_of_slot
+
+    std::vector<unsigned int> dense_of_slot; // for a free slot, its place in free_slots
+    std::vector<unsigned char> generation_of_slot;
+    std::vector<unsigned int> slot_of_dense;
+    std::vector<unsigned int> free_slots; // the last one is reused first
+
+    unsigned int size() const noexcept {
+        return slot_of_dense.size();
+    }
+
+    std::size_t memory_bytes() const noexcept {
+        return (dense_of_slot.capacity() + slot_of_dense.capacity() + free_slots.capacity()) * sizeof(unsigned int)
+            + generation_of_slot.capacity();
+    }
+
+    // Whether count more elements can be add()ed
+    bool has_room(unsigned int count = 1) const noexcept {
+        return count <= free_slots.size() + (max_size - dense_of_slot.size());
+    }
+
+    // For the element appended at the end of the dense array; see has_room()
+    unsigned int add() noexcept {
+        assert(has_room());
+        unsigned int slot;
+        if (!free_slots.empty()) {
+            slot = free_slots.back();
+            free_slots.pop_back();
+        } else {
+            slot = dense_of_slot.size();
+            dense_of_slot.push_back(0);
+            generation_of_slot.push_back(1);
+        }
+        dense_of_slot[slot] = slot_of_dense.size();
+        slot_of_dense.push_back(slot);
+        return handle(slot);
+    }
+
+    // Same as add(), but gives back a handle that was removed, for an undo.
+    // Its slot must be free or retired.
+    unsigned int revive(unsigned int h) noexcept {
+        const unsigned int slot = h & slot_mask;
+        if (const unsigned int place = dense_of_slot[slot]; place != retired) {
+            const unsigned int last_free = free_slots.back();
+            free_slots[place] = last_free;
+            dense_of_slot[last_free] = place;
+            free_slots.pop_back();
+        }
+
+        generation_of_slot[slot] = h >> slot_bits;
+        dense_of_slot[slot] = slot_of_dense.size();
+        slot_of_dense.push_back(slot);
+        return h;
+    }
+
+    bool contains(unsigned int h) const noexcept {
+        const unsigned int slot = h & slot_mask;
+        return (slot < generation_of_slot.size()) && (generation_of_slot[slot] == (h >> slot_bits))
+            && (dense_of_slot[slot] < slot_of_dense.size()) && (slot_of_dense[dense_of_slot[slot]] == slot);
+    }
+
+    // Whether revive(h) may be called: no element holds the slot of h
+    bool is_free(unsigned int h) const noexcept {
+        const unsigned int slot = h & slot_mask;
+        return (slot < dense_of_slot.size())
+            && !((dense_of_slot[slot] < slot_of_dense.size()) && (slot_of_dense[dense_of_slot[slot]] == slot));
+    }
+
+    unsigned int index_of(unsigned int h) const noexcept {
+        return dense_of_slot[h & slot_mask];
+    }
+
+    unsigned int handle_at(unsigned int index) const noexcept {
+        return handle(slot_of_dense[index]);
+    }
+
+    // The caller moves its last element into index_of(h) and pops the back
+    void remove(unsigned int h) noexcept {
+        const unsigned int slot = h & slot_mask;
+        const unsigned int index = dense_of_slot[slot];
+        const unsigned int last_slot = slot_of_dense.back();
+        slot_of_dense[index] = last_slot;
+        dense_of_slot[last_slot] = index;
+        slot_of_dense.pop_back();
+
+        generation_of_slot[slot]++;
+        if (generation_of_slot[slot] == 0) { // 0 stays invalid, and the old generations stay stale
+            dense_of_slot[slot] = retired;
+            return;
+        }
+        dense_of_slot[slot] = free_slots.size();
+        free_slots.push_back(slot);
+    }
+
+    // count elements, the one at index i in slot i; as count add()s after a clear()
+    void reset(unsigned int count) noexcept {
+        assert(count <= max_size);
+        clear();
+        dense_of_slot.resize(count);
+        slot_of_dense.resize(count);
+        generation_of_slot.assign(count, 1);
+        for (unsigned int i = 0; i < count; i++) dense_of_slot[i] = slot_of_dense[i] = i;
+    }
+
+    void clear() noexcept {
+        dense_of_slot.clear();
+        generation_of_slot.clear();
+        slot_of_dense.clear();
+        free_slots.clear();
+    }
+
+    private:
+        unsigned int handle(unsigned int slot) const noexcept {
+            return (static_cast<unsigned int>(generation_of_slot[slot]) << slot_bits) | slot;
+        }
+};
+
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+// The file of World::save_state(): a header, then all the Node records as
+// they are in memory, then all the Line records, each section at a multiple
+// of 64 bytes. Mapped and copied as a whole, nothing is parsed.
+// The records are only readable by a build with the same layout, so their
+// sizes are in the header next to the version.
+namespace snapshot {
+    static constexpr char magic[8] = { 'N', 'O', 'D', 'E', 'S', 'N', 'A', 'P' };
+    static constexpr std::uint32_t version = 1;
+    static constexpr std::uint64_t section_alignment = 64;
+
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t node_record_size;
+        std::uint32_t line_record_size;
+        std::uint32_t nodes_count;
+        std::uint32_t lines_count;
+        std::uint32_t reserved;
+        std::uint64_t nodes_offset; // bytes from the start of the file
+        std::uint64_t lines_offset;
+        std::uint64_t size_bytes;   // of the whole file
+    };
+
+    inline std::uint64_t aligned(std::uint64_t offset) noexcept {
+        return (offset + section_alignment - 1) / section_alignment * section_alignment;
+    }
+
+    inline Header header_for(std::uint32_t node_record_size, std::uint32_t nodes_count,
+            std::uint32_t line_record_size, std::uint32_t lines_count) noexcept {
+        Header header{};
+        std::memcpy(header.magic, magic, sizeof(magic));
+        header.version = version;
+        header.node_record_size = node_record_size;
+        header.line_record_size = line_record_size;
+        header.nodes_count = nodes_count;
+        header.lines_count = lines_count;
+        header.nodes_offset = aligned(sizeof(Header));
+        header.lines_offset = aligned(header.nodes_offset + std::uint64_t{ node_record_size } * nodes_count);
+        header.size_bytes = header.lines_offset + std::uint64_t{ line_record_size } * lines_count;
+        return header;
+    }
+
+    // Into a temporary file first, so that a reader never sees half of it
+    inline bool write_file(const std::string& filepath, const unsigned char* bytes, std::size_t size_bytes) noexcept {
+        const std::string temporary = filepath + ".tmp";
+        const int file = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (file < 0) {
+            std::cout << "Snapshot: failed to create " << temporary << '\n';
+            return false;
+        }
+        std::size_t written = 0;
+        while (written < size_bytes) {
+            const auto res = write(file, bytes + written, size_bytes - written);
+            if (res <= 0) break;
+            written += res;
+        }
+        close(file);
+        if (written != size_bytes || std::rename(temporary.c_str(), filepath.c_str()) != 0) {
+            std::cout << "Snapshot: failed to write " << filepath << '\n';
+            return false;
+        }
+        return true;
+    }
+
+    // Read-only mapping of a snapshot, checked against the record sizes of
+    // this build. The sections stay valid for as long as this lives.
+    struct MappedFile {
+        int file = -1;
+        const unsigned char* data = nullptr;
+        std::size_t size_bytes = 0;
+        const Header* header = nullptr;
+
+        MappedFile(const std::string& filepath, std::uint32_t node_record_size, std::uint32_t line_record_size) noexcept {
+            file = open(filepath.c_str(), O_RDONLY);
+            struct stat info;
+            if (file < 0 || fstat(file, &info) != 0) {
+                std::cout << "Snapshot: failed to open " << filepath << '\n';
+                return;
+            }
+            size_bytes = info.st_size;
+            if (size_bytes < sizeof(Header)) {
+                std::cout << "Snapshot: " << filepath << " is too short\n";
+                return;
+            }
+            void* mapped = mmap(nullptr, size_bytes, PROT_READ, MAP_PRIVATE | MAP_POPULATE, file, 0);
+            if (mapped == MAP_FAILED) {
+                std::cout << "Snapshot: failed to map " << filepath << '\n';
+                return;
+            }
+            data = static_cast<const unsigned char*>(mapped);
+
+            const auto* h = reinterpret_cast<const Header*>(data);
+            const auto expected = header_for(node_record_size, h->nodes_count, line_record_size, h->lines_count);
+            if (std::memcmp(h->magic, magic, sizeof(magic)) != 0 || h->version != version) {
+                std::cout << "Snapshot: " << filepath << " is not a snapshot of version " << version << '\n';
+            } else if (h->node_record_size != node_record_size || h->line_record_size != line_record_size) {
+                std::cout << "Snapshot: " << filepath << " was written by a build with other records\n";
+            } else if (h->nodes_offset != expected.nodes_offset || h->lines_offset != expected.lines_offset
+                    || h->size_bytes != expected.size_bytes || size_bytes < expected.size_bytes) {
+                std::cout << "Snapshot: " << filepath << " is damaged\n";
+            } else {
+                header = h;
+            }
+        }
+
+        ~MappedFile() {
+            if (data) munmap(const_cast<unsigned char*>(data), size_bytes);
+            if (file >= 0) close(file);
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool valid() const noexcept {
+            return header != nullptr;
+        }
+
+        template<typename NodeRecord>
+        const NodeRecord* nodes() const noexcept {
+            return reinterpret_cast<const NodeRecord*>(data + header->nodes_offset);
+        }
+
+        template<typename LineRecord>
+        const LineRecord* lines() const noexcept {
+            return reinterpret_cast<const LineRecord*>(data + header->lines_offset);
+        }
+    };
+}
+
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef SPRING_SOLVER_H
+#define SPRING_SOLVER_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+
+// The springs of World::springs_physics, one spring at a time instead of one
+// Node at a time: each spring is evaluated once, 8 at a time, and its equal
+// and opposite forces are added to both ends. Everything is in SoA, the
+// springs are pairs of Node indices.
+// NOTE Unlike World::springs_physics, all the forces come from the positions
+// at the beginning of the step, so the result does not depend on the order
+// of the Nodes.
+struct SpringSolver {
+    static constexpr float spring_default_length = 6.0f;
+    static constexpr float G = 9.8f;
+    static constexpr float K = 0.8f;
+    static constexpr float time_scaler = 0.0000025f;
+    static constexpr float dissipation_ration_per_second = 0.1f;
+
+    // Per Node
+    std::vector<float> xs, ys;
+    std::vector<float> vxs, vys;
+    std::vector<float> movable;     // 0 for pinned, 1 otherwise
+    std::vector<float> has_springs; // 0 or 1
+    std::vector<float> fxs, fys;    // scratch
+
+    // Per spring
+    std::vector<int> ends1, ends2;
+
+    void resize_nodes(unsigned int count) noexcept {
+        xs.resize(count);
+        ys.resize(count);
+        vxs.resize(count);
+        vys.resize(count);
+        movable.resize(count);
+        has_springs.resize(count);
+        fxs.resize(count);
+        fys.resize(count);
+    }
+
+    // To be called after ends1 and ends2 have changed and the Nodes have been resized
+    void springs_changed() noexcept {
+        std::fill(has_springs.begin(), has_springs.end(), 0.0f);
+        for (unsigned int i = 0; i < ends1.size(); i++) has_springs[ends1[i]] = has_springs[ends2[i]] = 1.0f;
+    }
+
+    void step(float dt) noexcept {
+        const float t = time_scaler * dt;
+        std::fill(fxs.begin(), fxs.end(), 0.0f);
+        std::fill(fys.begin(), fys.end(), 0.0f);
+        accumulate_forces();
+        integrate(t);
+    }
+
+    private:
+#ifdef __AVX__
+        // 8 floats from base[indices]. A single instruction with AVX2, otherwise
+        // emulated through memory, which still keeps the rest of the loop in AVX.
+        static __m256 gather_ps(const float* base, __m256i indices) noexcept {
+#ifdef __AVX2__
+            return _mm256_i32gather_ps(base, indices, 4);
+#else
+            alignas(32) int i[8];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(i), indices);
+            return _mm256_set_ps(base[i[7]], base[i[6]], base[i[5]], base[i[4]], base[i[3]], base[i[2]], base[i[1]], base[i[0]]);
+#endif
+        }
+#endif
+
+        // The force on end1; end2 gets the opposite one
+        static void spring_force(float dx, float dy, float& fx, float& fy) noexcept {
+            const float length = std::sqrt(dx * dx + dy * dy);
+            const float strength_over_length = (length - spring_default_length) / std::max(length, 1e-6f);
+            fx = dx * strength_over_length;
+            fy = dy * strength_over_length;
+        }
+
+        void accumulate_forces() noexcept {
+            const unsigned int count = ends1.size();
+            unsigned int i = 0;
+#ifdef __AVX__
+            const __m256 l0 = _mm256_set1_ps(spring_default_length);
+            const __m256 tiny = _mm256_set1_ps(1e-6f);
+            alignas(32) float fx[8];
+            alignas(32) float fy[8];
+            for (; i + 8 <= count; i += 8) {
+                const __m256i i1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&ends1[i]));
+                const __m256i i2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&ends2[i]));
+                const __m256 dx = _mm256_sub_ps(gather_ps(xs.data(), i2), gather_ps(xs.data(), i1));
+                const __m256 dy = _mm256_sub_ps(gather_ps(ys.data(), i2), gather_ps(ys.data(), i1));
+                const __m256 length = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+                const __m256 strength_over_length = _mm256_div_ps(_mm256_sub_ps(length, l0), _mm256_max_ps(length, tiny));
+                _mm256_store_ps(fx, _mm256_mul_ps(dx, strength_over_length));
+                _mm256_store_ps(fy, _mm256_mul_ps(dy, strength_over_length));
+                // No scatter in AVX, and the 8 springs may share Nodes anyway
+                for (unsigned int j = 0; j < 8; j++) {
+                    fxs[ends1[i + j]] += fx[j];
+                    fys[ends1[i + j]] += fy[j];
+                    fxs[ends2[i + j]] -= fx[j];
+                    fys[ends2[i + j]] -= fy[j];
+                }
+            }
+#endif
+            for (; i < count; i++) {
+                const int i1 = ends1[i];
+                const int i2 = ends2[i];
+                float fx, fy;
+                spring_force(xs[i2] - xs[i1], ys[i2] - ys[i1], fx, fy);
+                fxs[i1] += fx;
+                fys[i1] += fy;
+                fxs[i2] -= fx;
+                fys[i2] -= fy;
+            }
+        }
+
+        // Gravity, springs, dissipation for the Nodes with springs, then the
+        // position; the pinned Nodes stay where they are
+        void integrate(float t) noexcept {
+            const unsigned int count = xs.size();
+            const float gravity = -G * t;
+            const float spring = K * t;
+            const float dissipation = dissipation_ration_per_second * t;
+            unsigned int i = 0;
+#ifdef __AVX__
+            const __m256 gravity8 = _mm256_set1_ps(gravity);
+            const __m256 spring8 = _mm256_set1_ps(spring);
+            const __m256 dissipation8 = _mm256_set1_ps(dissipation);
+            const __m256 one = _mm256_set1_ps(1.0f);
+            const __m256 t8 = _mm256_set1_ps(t);
+            for (; i + 8 <= count; i += 8) {
+                const __m256 m = _mm256_loadu_ps(&movable[i]);
+                const __m256 damping = _mm256_sub_ps(one, _mm256_mul_ps(dissipation8, _mm256_loadu_ps(&has_springs[i])));
+                __m256 vx = _mm256_add_ps(_mm256_loadu_ps(&vxs[i]), _mm256_mul_ps(_mm256_loadu_ps(&fxs[i]), spring8));
+                __m256 vy = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(&vys[i]), gravity8), _mm256_mul_ps(_mm256_loadu_ps(&fys[i]), spring8));
+                vx = _mm256_mul_ps(_mm256_mul_ps(vx, damping), m);
+                vy = _mm256_mul_ps(_mm256_mul_ps(vy, damping), m);
+                _mm256_storeu_ps(&vxs[i], vx);
+                _mm256_storeu_ps(&vys[i], vy);
+                _mm256_storeu_ps(&xs[i], _mm256_add_ps(_mm256_loadu_ps(&xs[i]), _mm256_mul_ps(vx, t8)));
+                _mm256_storeu_ps(&ys[i], _mm256_add_ps(_mm256_loadu_ps(&ys[i]), _mm256_mul_ps(vy, t8)));
+            }
+#endif
+            for (; i < count; i++) {
+                const float damping = 1.0f - dissipation * has_springs[i];
+                vxs[i] = (vxs[i] + fxs[i] * spring) * damping * movable[i];
+                vys[i] = (vys[i] + gravity + fys[i] * spring) * damping * movable[i];
+                xs[i] += vxs[i] * t;
+                ys[i] += vys[i] * t;
+            }
+        }
+};
+
+
+#endif
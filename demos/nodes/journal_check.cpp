@@ -0,0 +1,87 @@
+// Checks Journal with Edits larger than its max_bytes, alone and among
+// others, and with an Edit that grows when applied (as a ReplaceGraph does):
+// the one just recorded, undone or redone must stay, and undo and redo must
+// keep working after it. Exits with 1 on the first failure.
+//     make journal_check && ./journal_check
+#include "Journal.h"
+
+#include <iostream>
+#include <cstddef>
+#include <utility>
+
+
+// A stand-in for the Edit of Game.h: applying it swaps its two sizes
+struct SizedEdit {
+    int id;
+    std::size_t bytes;
+    std::size_t bytes_when_applied;
+
+    std::size_t size_bytes() const noexcept {
+        return bytes;
+    }
+};
+
+
+static bool consistent(const Journal<SizedEdit>& journal) {
+    std::size_t size = 0;
+    for (const auto& edit : journal.edits) size += edit.size_bytes();
+    return journal.done <= journal.edits.size() && size == journal.size_bytes;
+}
+
+
+static bool check(bool ok, const char* what) {
+    if (!ok) std::cout << "FAILED: " << what << '\n';
+    return ok;
+}
+
+
+int main() {
+    const auto swap_sizes = [](SizedEdit& edit) noexcept { std::swap(edit.bytes, edit.bytes_when_applied); };
+    int applied = -1;
+    const auto apply = [&](SizedEdit& edit) noexcept { applied = edit.id; swap_sizes(edit); };
+
+    {
+        // A single Edit over the cap
+        Journal<SizedEdit> journal(100);
+        journal.record(SizedEdit{ 1, 500, 500 });
+        if (!check(journal.edits.size() == 1 && journal.done == 1 && consistent(journal), "a single oversized Edit is kept when recorded")) return 1;
+        if (!check(journal.undo(apply) && applied == 1 && journal.done == 0 && consistent(journal), "it can be undone")) return 1;
+        if (!check(journal.redo(apply) && applied == 1 && journal.done == 1 && consistent(journal), "it can be redone")) return 1;
+        if (!check(journal.undo(apply) && !journal.undo(apply) && consistent(journal), "nothing before it to undo")) return 1;
+    }
+    {
+        // A single Edit that goes over the cap when undone, with nothing done
+        // after: the Edit just applied is the only one left, the redo
+        Journal<SizedEdit> journal(100);
+        journal.record(SizedEdit{ 1, 10, 500 });
+        if (!check(journal.undo(apply) && journal.done == 0 && journal.edits.size() == 1 && consistent(journal), "an Edit that grows when undone is kept")) return 1;
+        if (!check(journal.redo(apply) && applied == 1 && journal.done == 1 && consistent(journal), "and can be redone")) return 1;
+        if (!check(journal.undo(apply) && applied == 1 && journal.done == 0 && consistent(journal), "and undone again")) return 1;
+    }
+    {
+        // Among others: the older undos and the further redos go first
+        Journal<SizedEdit> journal(100);
+        for (int id = 1; id <= 4; id++) journal.record(SizedEdit{ id, 10, 10 });
+        journal.record(SizedEdit{ 5, 10, 500 });
+        journal.record(SizedEdit{ 6, 10, 10 });
+        if (!check(journal.undo(apply) && applied == 6, "undo of the last Edit")) return 1;
+        if (!check(journal.undo(apply) && applied == 5 && consistent(journal), "undo of the Edit that grows")) return 1;
+        if (!check(journal.edits.size() == 1 && journal.done == 0 && journal.edits[0].id == 5, "only the Edit just undone stays")) return 1;
+        if (!check(!journal.undo(apply), "nothing left to undo")) return 1;
+        if (!check(journal.redo(apply) && applied == 5 && !journal.redo(apply) && consistent(journal), "it alone can be redone")) return 1;
+        journal.undo(apply);
+        journal.record(SizedEdit{ 7, 10, 10 });
+        if (!check(journal.edits.size() == 1 && journal.edits[0].id == 7 && journal.done == 1 && consistent(journal), "a new Edit drops the oversized redo")) return 1;
+    }
+    {
+        // A lower cap keeps nothing back
+        Journal<SizedEdit> journal(100);
+        for (int id = 1; id <= 4; id++) journal.record(SizedEdit{ id, 20, 20 });
+        journal.undo(apply);
+        journal.set_max_bytes(30);
+        if (!check(journal.edits.size() == 1 && journal.done == 0 && journal.edits[0].id == 4 && consistent(journal), "set_max_bytes() trims the undos first")) return 1;
+    }
+
+    std::cout << "Journal: OK\n";
+    return 0;
+}
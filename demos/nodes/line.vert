@@ -1,13 +1,16 @@
 #version 330 core
 
-layout (location = 0) in vec3 position;
-layout (location = 1) in vec3 color;
+layout (location = 0) in vec2 position; // of the Node
+layout (location = 1) in vec4 color;    // of the Node
 
 uniform mat4 u_mvp = mat4(1.0);
+uniform float u_z = 0.2;
+uniform float u_z_delta = 0.00001;
 
 out vec3 v_color;
 
 void main() {
-    v_color = color;
-    gl_Position = u_mvp * vec4(position, 1.0);
+    v_color = color.rgb;
+    float z = u_z + u_z_delta * gl_VertexID; // the index of the Node
+    gl_Position = u_mvp * vec4(position, z, 1.0);
 }
@@ -1,16 +1,20 @@
 #version 330 core
 
-layout (location = 0) in vec2 inner_position;
-layout (location = 1) in vec3 position;
-layout (location = 2) in vec3 color;
+layout (location = 0) in vec2 inner_position; // corner of the unit quad
+layout (location = 1) in vec2 position;       // of the Node, per instance
+layout (location = 2) in vec4 color;          // of the Node, per instance
 
 uniform mat4 u_mvp = mat4(1.0);
+uniform float u_half_size = 2.5;
+uniform float u_z = 0.3;
+uniform float u_z_delta = 0.00001;
 
 out vec2 v_pos;
 out vec3 v_color;
 
 void main() {
     v_pos = inner_position;
-    v_color = color;
-    gl_Position = u_mvp * vec4(position, 1.0);
+    v_color = color.rgb;
+    float z = u_z + u_z_delta * gl_InstanceID;
+    gl_Position = u_mvp * vec4(position + inner_position * u_half_size, z, 1.0);
 }
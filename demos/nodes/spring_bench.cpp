@@ -0,0 +1,185 @@
+// The springs of the nodes demo on a big mesh, without any GL: the per-Node
+// loop of World::springs_physics against SpringSolver, alone and with the
+// copies between the Nodes and its SoA that World pays every step. First
+// checks that one step of SpringSolver matches the per-Node loop taking all
+// its forces from the positions at the start of the step; exits with 1 if not.
+//     make spring_bench && ./spring_bench
+#include "SpringSolver.h"
+#include "Vector2f.h"
+#include "Vector3f.h"
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+
+// The layout of Node in Game.h
+struct BenchNode {
+    unsigned int id;
+    bool is_pinned = false;
+    Vector2f position;
+    Vector2f velocity = Vector2f{};
+    Vector3f color = Vector3f{ 0.5f, 0.5f, 0.5f };
+};
+
+
+// World::springs_physics with its CSR adjacency, without destroy_distant_nodes().
+// With start_positions, the other ends are read from there instead of from
+// nodes, which the loop is updating (Jacobi instead of Gauss-Seidel): what
+// SpringSolver does.
+void springs_per_node(std::vector<BenchNode>& nodes, const std::vector<unsigned int>& offsets, const std::vector<unsigned int>& adjacency, float dt,
+        const std::vector<Vector2f>* start_positions = nullptr) noexcept {
+    constexpr float spring_default_length = 6.0f;
+    constexpr float G = 9.8f;
+    constexpr float K = 0.8f;
+    constexpr float time_scaler = 0.0000025f;
+    constexpr float dissipation_ration_per_second = 0.1f;
+    const float t = time_scaler * dt;
+    for (unsigned int i = 0; i < nodes.size(); i++) {
+        auto& node = nodes[i];
+        if (node.is_pinned) continue;
+        node.velocity += Vector2f{ 0.0f, -1.0f } * (t * G);
+        const bool has_springs = offsets[i] != offsets[i + 1];
+        const Vector2f position = start_positions ? (*start_positions)[i] : node.position;
+        for (unsigned int a = offsets[i]; a < offsets[i + 1]; a++) {
+            const Vector2f other_position = start_positions ? (*start_positions)[adjacency[a]] : nodes[adjacency[a]].position;
+            const Vector2f force_dir = (other_position - position).normalized();
+            const float spring_length = (other_position - position).length();
+            const float force_strength = spring_length - spring_default_length;
+            const Vector2f force = force_dir * force_strength;
+            node.velocity += force * (t * K);
+        }
+        if (has_springs) node.velocity *= 1.0f - dissipation_ration_per_second * t;
+        node.position += node.velocity * t;
+    }
+}
+
+// The copies of World::springs_physics_per_line around SpringSolver::step()
+void nodes_to_solver(const std::vector<BenchNode>& nodes, SpringSolver& s) noexcept {
+    for (unsigned int i = 0; i < nodes.size(); i++) {
+        const auto& node = nodes[i];
+        s.xs[i] = node.position.x;
+        s.ys[i] = node.position.y;
+        s.vxs[i] = node.velocity.x;
+        s.vys[i] = node.velocity.y;
+        s.movable[i] = node.is_pinned ? 0.0f : 1.0f;
+    }
+}
+
+void solver_to_nodes(const SpringSolver& s, std::vector<BenchNode>& nodes) noexcept {
+    for (unsigned int i = 0; i < nodes.size(); i++) {
+        auto& node = nodes[i];
+        if (node.is_pinned) continue;
+        node.position = Vector2f{ s.xs[i], s.ys[i] };
+        node.velocity = Vector2f{ s.vxs[i], s.vys[i] };
+    }
+}
+
+
+int main() {
+    // 708 x 708 grid: 2 * 708 * 707 ~ 1M springs, the top row pinned
+    constexpr unsigned int side = 708;
+    constexpr unsigned int runs = 10;
+    constexpr float dt = 16'000.0f;
+    constexpr float spacing = 6.5f;
+
+    std::vector<BenchNode> nodes;
+    std::vector<int> ends1, ends2;
+    for (unsigned int y = 0; y < side; y++) {
+        for (unsigned int x = 0; x < side; x++) {
+            BenchNode node;
+            node.id = y * side + x;
+            node.is_pinned = (y == side - 1);
+            node.position = Vector2f{ x * spacing, y * spacing };
+            nodes.push_back(node);
+            if (x + 1 < side) { ends1.push_back(y * side + x); ends2.push_back(y * side + x + 1); }
+            if (y + 1 < side) { ends1.push_back(y * side + x); ends2.push_back((y + 1) * side + x); }
+        }
+    }
+    const unsigned int springs = ends1.size();
+
+    std::vector<unsigned int> offsets(nodes.size() + 1, 0);
+    for (unsigned int i = 0; i < springs; i++) { offsets[ends1[i] + 1]++; offsets[ends2[i] + 1]++; }
+    for (unsigned int i = 0; i < nodes.size(); i++) offsets[i + 1] += offsets[i];
+    std::vector<unsigned int> adjacency(2 * springs);
+    std::vector<unsigned int> next(offsets.begin(), offsets.end() - 1);
+    for (unsigned int i = 0; i < springs; i++) {
+        adjacency[next[ends1[i]]++] = ends2[i];
+        adjacency[next[ends2[i]]++] = ends1[i];
+    }
+
+    SpringSolver solver;
+    solver.resize_nodes(nodes.size());
+    solver.ends1 = ends1;
+    solver.ends2 = ends2;
+    solver.springs_changed();
+
+    // A few steps first, so that the springs are stretched and moving, then
+    // one step of each from that same state
+    for (unsigned int i = 0; i < 10; i++) springs_per_node(nodes, offsets, adjacency, dt);
+    {
+        std::vector<BenchNode> jacobi = nodes;
+        std::vector<Vector2f> start_positions(nodes.size());
+        for (unsigned int i = 0; i < nodes.size(); i++) start_positions[i] = nodes[i].position;
+        springs_per_node(jacobi, offsets, adjacency, dt, &start_positions);
+
+        std::vector<BenchNode> per_line = nodes;
+        nodes_to_solver(per_line, solver);
+        solver.step(dt);
+        solver_to_nodes(solver, per_line);
+
+        float max_position_difference = 0.0f;
+        float max_velocity_difference = 0.0f;
+        float max_velocity = 0.0f;
+        for (unsigned int i = 0; i < nodes.size(); i++) {
+            max_position_difference = std::max(max_position_difference, (per_line[i].position - jacobi[i].position).length());
+            max_velocity_difference = std::max(max_velocity_difference, (per_line[i].velocity - jacobi[i].velocity).length());
+            max_velocity = std::max(max_velocity, jacobi[i].velocity.length());
+        }
+        // Positions are up to side * spacing, so a few ulps of that; the
+        // velocities only differ in the order of the sums
+        const float position_tolerance = 1e-6f * side * spacing;
+        const float velocity_tolerance = 1e-4f * max_velocity;
+        const bool ok = max_position_difference <= position_tolerance && max_velocity_difference <= velocity_tolerance;
+        std::cout << "One step of SpringSolver vs the per-Node loop from the start positions: "
+            << "max position difference = " << max_position_difference << " (tolerance " << position_tolerance << ")  "
+            << "max velocity difference = " << max_velocity_difference << " (tolerance " << velocity_tolerance << ")  "
+            << (ok ? "OK" : "FAILED") << '\n';
+        if (!ok) return 1;
+    }
+    nodes_to_solver(nodes, solver);
+
+    using clock = std::chrono::steady_clock;
+    auto best_per_node = clock::duration::max();
+    auto best_per_line = clock::duration::max();
+    auto best_copies = clock::duration::max();
+    std::vector<BenchNode> copied = nodes;
+    for (unsigned int i = 0; i < runs; i++) {
+        const auto t0 = clock::now();
+        springs_per_node(nodes, offsets, adjacency, dt);
+        const auto t1 = clock::now();
+        solver.step(dt);
+        const auto t2 = clock::now();
+        solver_to_nodes(solver, copied);
+        nodes_to_solver(copied, solver);
+        const auto t3 = clock::now();
+        best_per_node = std::min(best_per_node, t1 - t0);
+        best_per_line = std::min(best_per_line, t2 - t1);
+        best_copies = std::min(best_copies, t3 - t2);
+    }
+
+    const auto ms = [](clock::duration d) { return std::chrono::duration<float, std::milli>(d).count(); };
+    std::cout
+        << "Springs on " << nodes.size() << " nodes, " << springs << " springs, best of " << runs << " runs\n"
+#ifdef __AVX__
+        << "  per Line (SpringSolver, AVX): " << ms(best_per_line) << " ms\n"
+#else
+        << "  per Line (SpringSolver, scalar): " << ms(best_per_line) << " ms\n"
+#endif
+        << "  copies Nodes <-> SoA (World::springs_physics_per_line): " << ms(best_copies) << " ms\n"
+        << "  per Node (World::springs_physics): " << ms(best_per_node) << " ms\n"
+        << "  speedup: " << (ms(best_per_node) / ms(best_per_line)) << "x alone, "
+        << (ms(best_per_node) / (ms(best_per_line) + ms(best_copies))) << "x with the copies\n";
+    return 0;
+}